@@ -47,6 +47,9 @@
 
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -62,6 +65,15 @@ extern "C"
 #define cJSON_Object 6
 
 #define cJSON_IsReference 256
+/* Ownership flags set on items which cJSON_Delete mustn't free all of:
+   the item itself, its name (string) or its valuestring. Mask the type
+   with 255 before comparing it when a tree may have these set. */
+#define cJSON_IsArena 512
+#define cJSON_StringIsConst 1024
+#define cJSON_ValueIsConst 2048
+/* Set on a number whose valueint64 is exact, one parsed from an integer
+   or made by cJSON_CreateInt64, rather than saturated from valuedouble. */
+#define cJSON_IsInt64 4096
 
 /* The cJSON structure: */
 typedef struct cJSON {
@@ -82,6 +94,13 @@ typedef struct cJSON {
         char *string; /* The item's name string, if this item is the
                          child of, or is in the list of subitems of an
                          object. */
+
+        int64_t valueint64; /* The item's number, if type==cJSON_Number,
+                               exact for integers which don't fit in
+                               valueint or valuedouble. */
+
+        struct cJSON_Index *index; /* An array or object's lookup index,
+                                      see cJSON_BuildIndex. */
 } cJSON;
 
 typedef struct cJSON_Hooks {
@@ -95,11 +114,196 @@ typedef struct cJSON_Hooks {
 CJSON_PUBLIC_API
 extern void cJSON_InitHooks(cJSON_Hooks* hooks);
 
+/* An allocator for some of the parsing and printing, instead of the
+   hooks, which are global and mustn't be changed while other threads
+   are using cJSON. For instance a pool private to a thread. ctx is
+   passed to every call. */
+typedef struct cJSON_Allocator {
+    void *(*malloc_fn)(void *ctx, size_t sz);
+    void (*free_fn)(void *ctx, void *ptr);
+    void *ctx;
+} cJSON_Allocator;
+
 
 /* Supply a block of JSON, and this returns a cJSON object you can
    interrogate. Call cJSON_Delete when finished. */
 CJSON_PUBLIC_API
 extern cJSON *cJSON_Parse(const char *value);
+/* Parse the value in the length bytes at value, which needn't be NUL
+   terminated: nothing past them is used, so there's no need to copy the
+   text to add a NUL. It's as fast as cJSON_Parse. If end isn't NULL it's
+   set to just after the value on success, so a buffer of several
+   documents can be parsed one after the other, and to NULL on failure.
+   Arrays and objects may be nested 512 deep. */
+CJSON_PUBLIC_API
+extern cJSON *cJSON_ParseWithLength(const char *value, size_t length,
+                                    const char **end);
+/* An arena for cJSON_ParseWithArena to allocate trees from. Memory is
+   taken from the arena in blocks of block_size bytes (0 for the default
+   of 64KiB) by bumping a pointer, and is only given back when the arena
+   is reset or deleted. An arena must not be used by two threads at once. */
+typedef struct cJSON_Arena cJSON_Arena;
+CJSON_PUBLIC_API
+extern cJSON_Arena *cJSON_CreateArena(size_t block_size);
+/* Release everything allocated from the arena, every tree parsed into it,
+   in one go. The first block is kept for reuse. An index built on an
+   arena tree is on the heap: pass the tree to cJSON_Delete first. */
+CJSON_PUBLIC_API
+extern void cJSON_ResetArena(cJSON_Arena *arena);
+CJSON_PUBLIC_API
+extern void cJSON_DeleteArena(cJSON_Arena *arena);
+/* An arena whose blocks come from allocator, which is copied. Parsing
+   into it takes any scratch memory from allocator too, not the hooks. */
+CJSON_PUBLIC_API
+extern cJSON_Arena *cJSON_CreateArenaWithAllocator(size_t block_size,
+                                                   const cJSON_Allocator *allocator);
+/* Parse like cJSON_Parse, but with every item and string allocated from
+   the arena. The tree lives until the arena is reset or deleted and
+   doesn't need cJSON_Delete, which only frees items added to it from
+   the heap. That includes any index from cJSON_BuildIndex, so an
+   indexed tree must be passed to cJSON_Delete before the arena is reset
+   or deleted. Its items have cJSON_IsArena, cJSON_StringIsConst and
+   cJSON_ValueIsConst set in type. */
+CJSON_PUBLIC_API
+extern cJSON *cJSON_ParseWithArena(const char *value, cJSON_Arena *arena);
+/* Parse, print and delete with allocator instead of the hooks. A tree
+   parsed this way must be deleted with the same allocator, and only
+   hold items from it: the other functions which add, replace or delete
+   items use the hooks. cJSON_BuildIndex and key tables use the hooks.
+   Free printed text with the allocator's free_fn. */
+CJSON_PUBLIC_API
+extern cJSON *cJSON_ParseWithAllocator(const char *value,
+                                       const cJSON_Allocator *allocator);
+CJSON_PUBLIC_API
+extern char *cJSON_PrintWithAllocator(cJSON *item, int fmt,
+                                      const cJSON_Allocator *allocator);
+CJSON_PUBLIC_API
+extern void cJSON_DeleteWithAllocator(cJSON *c, const cJSON_Allocator *allocator);
+/* Parse the text in buffer in place, without copying strings. Strings
+   are unescaped over the text, so string and valuestring point into
+   buffer, which must outlive the tree and no longer holds the JSON.
+   Items come from the arena, or the heap if arena is NULL, in which case
+   cJSON_Delete frees the items but leaves the strings. Items have
+   cJSON_StringIsConst and cJSON_ValueIsConst set in type. */
+CJSON_PUBLIC_API
+extern cJSON *cJSON_ParseInSitu(char *buffer, cJSON_Arena *arena);
+/* A table of object member names shared by the documents parsed with
+   it, so each name is kept once however many documents have it, instead
+   of once per member. Parsers on any number of threads can use a table
+   at once. It holds up to max_keys names (0 for the default of 4096)
+   and is never emptied, after which new names are copied into their
+   documents as usual. The table must outlive every tree parsed with it,
+   whose names cJSON_Delete leaves alone. */
+typedef struct cJSON_KeyTable cJSON_KeyTable;
+CJSON_PUBLIC_API
+extern cJSON_KeyTable *cJSON_CreateKeyTable(size_t max_keys);
+CJSON_PUBLIC_API
+extern void cJSON_DeleteKeyTable(cJSON_KeyTable *keys);
+/* The table's copy of string, added if it's new, or NULL if the table is
+   full. Lookups with it in trees parsed with the table compare pointers
+   rather than strings. */
+CJSON_PUBLIC_API
+extern const char *cJSON_InternKey(cJSON_KeyTable *keys, const char *string);
+/* cJSON_Parse, or cJSON_ParseWithArena if arena isn't NULL, with member
+   names from the key table. */
+CJSON_PUBLIC_API
+extern cJSON *cJSON_ParseWithKeys(const char *value, cJSON_KeyTable *keys,
+                                  cJSON_Arena *arena);
+/* A pull parser, for documents too big to hold in memory as a tree or
+   at all. Feed it the text in chunks and call cJSON_ReaderNext for one
+   token at a time until it returns cJSON_TokenEnd, or
+   cJSON_TokenNeedMore when it wants the next chunk. A chunk must stay
+   valid until then. Tokens may be split between chunks. The reader
+   needs memory for the biggest token and a byte for each level of
+   nesting, up to max_depth (0 for the default of 512), and no more. */
+typedef struct cJSON_Reader cJSON_Reader;
+
+#define cJSON_TokenError (-1)
+#define cJSON_TokenNeedMore 0
+#define cJSON_TokenStartObject 1
+#define cJSON_TokenEndObject 2
+#define cJSON_TokenStartArray 3
+#define cJSON_TokenEndArray 4
+#define cJSON_TokenKey 5
+#define cJSON_TokenString 6
+#define cJSON_TokenNumber 7
+#define cJSON_TokenTrue 8
+#define cJSON_TokenFalse 9
+#define cJSON_TokenNull 10
+#define cJSON_TokenEnd 11
+
+typedef struct cJSON_Token {
+    int type; /* One of the above */
+    const char *string; /* A key or string, unescaped and NUL terminated,
+                           valid until the next call */
+    size_t length;
+    double valuedouble; /* A number */
+    int64_t valueint64;
+} cJSON_Token;
+
+CJSON_PUBLIC_API
+extern cJSON_Reader *cJSON_CreateReader(int max_depth);
+/* Supply the next len bytes of the document, last is non-zero for the
+   final chunk. */
+CJSON_PUBLIC_API
+extern void cJSON_ReaderFeed(cJSON_Reader *reader, const char *data, size_t len, int last);
+/* Read the next token into token, and return its type. Once it returns
+   cJSON_TokenError, for bad JSON or no memory, it always does. */
+CJSON_PUBLIC_API
+extern int cJSON_ReaderNext(cJSON_Reader *reader, cJSON_Token *token);
+CJSON_PUBLIC_API
+extern void cJSON_DeleteReader(cJSON_Reader *reader);
+
+/* A read-only document parsed into one compact buffer instead of a tree
+   of cJSON items, for documents which are parsed once and read many
+   times. It takes a fraction of the memory, with no per-item mallocs,
+   and reading it walks memory in order. Items are indexes into the tape:
+   the root is 0 and cJSON_TapeNone is "no item", which every function
+   accepts, so lookups can be chained. */
+typedef struct cJSON_Tape cJSON_Tape;
+#define cJSON_TapeNone ((size_t)-1)
+
+CJSON_PUBLIC_API
+extern cJSON_Tape *cJSON_ParseTape(const char *value);
+CJSON_PUBLIC_API
+extern void cJSON_DeleteTape(cJSON_Tape *tape);
+/* The bytes of memory the tape takes */
+CJSON_PUBLIC_API
+extern size_t cJSON_TapeSize(const cJSON_Tape *tape);
+/* The item's type, cJSON_False to cJSON_Object, or -1 for cJSON_TapeNone */
+CJSON_PUBLIC_API
+extern int cJSON_TapeType(const cJSON_Tape *tape, size_t item);
+/* The items of an array or object, for walking them in order */
+CJSON_PUBLIC_API
+extern size_t cJSON_TapeChild(const cJSON_Tape *tape, size_t item);
+CJSON_PUBLIC_API
+extern size_t cJSON_TapeNext(const cJSON_Tape *tape, size_t item);
+/* The name of a member of an object, or NULL */
+CJSON_PUBLIC_API
+extern const char *cJSON_TapeGetName(const cJSON_Tape *tape, size_t item);
+/* A string's value, or NULL if it's not a string */
+CJSON_PUBLIC_API
+extern const char *cJSON_TapeGetString(const cJSON_Tape *tape, size_t item);
+/* A number's value, or 0 if it's not a number. The int64_t is exact for
+   integers, and saturated for anything else, like valueint64. */
+CJSON_PUBLIC_API
+extern double cJSON_TapeGetNumber(const cJSON_Tape *tape, size_t item);
+CJSON_PUBLIC_API
+extern int64_t cJSON_TapeGetInt64(const cJSON_Tape *tape, size_t item);
+/* As cJSON_GetArraySize, cJSON_GetArrayItem and cJSON_GetObjectItem.
+   The size of an array or object is stored, the lookups are linear. */
+CJSON_PUBLIC_API
+extern int cJSON_TapeGetArraySize(const cJSON_Tape *tape, size_t array);
+CJSON_PUBLIC_API
+extern size_t cJSON_TapeGetArrayItem(const cJSON_Tape *tape, size_t array, int item);
+CJSON_PUBLIC_API
+extern size_t cJSON_TapeGetObjectItem(const cJSON_Tape *tape, size_t object,
+                                      const char *string);
+CJSON_PUBLIC_API
+extern size_t cJSON_TapeGetObjectItemCaseSensitive(const cJSON_Tape *tape,
+                                                   size_t object,
+                                                   const char *string);
+
 /* Render a cJSON entity to text for transfer/storage. Free the char*
    when finished. */
 CJSON_PUBLIC_API
@@ -108,6 +312,13 @@ extern char  *cJSON_Print(cJSON *item);
    formatting. Free the char* when finished. */
 CJSON_PUBLIC_API
 extern char  *cJSON_PrintUnformatted(cJSON *item);
+/* Stream the text of a cJSON entity to a sink, formatted if fmt is
+   non-zero, in pieces of up to a few KB. The sink returns 0 to carry on
+   or non-zero to abandon the print. Returns 0 when everything was
+   written, or -1 if the sink stopped it or the item can't be printed. */
+typedef int (*cJSON_Sink)(void *ctx, const char *data, size_t len);
+CJSON_PUBLIC_API
+extern int cJSON_PrintToSink(cJSON *item, int fmt, cJSON_Sink sink, void *ctx);
 /* Release the memory returned by cJSON_Print and cJSON_PrintUnformatted */
 CJSON_PUBLIC_API
 extern void   cJSON_Free(char *ptr);
@@ -125,6 +336,19 @@ extern cJSON *cJSON_GetArrayItem(cJSON *array,int item);
 /* Get item "string" from object. Case insensitive. */
 CJSON_PUBLIC_API
 extern cJSON *cJSON_GetObjectItem(cJSON *object,const char *string);
+/* Get item "string" from object. Case sensitive. */
+CJSON_PUBLIC_API
+extern cJSON *cJSON_GetObjectItemCaseSensitive(cJSON *object,const char *string);
+
+/* Index the children of an array or object, and theirs too if recursive
+   is non-zero, so that the three functions above take constant time
+   rather than walking the list. The Add, Detach, Replace and Delete
+   functions keep the index up to date, but items must not be linked in
+   or out by hand once it's built. Build the index before sharing a tree
+   between threads. cJSON_Delete frees it, even in an arena tree.
+   Returns 0, or -1 if out of memory. */
+CJSON_PUBLIC_API
+extern int cJSON_BuildIndex(cJSON *item, int recursive);
 
 /* These calls create a cJSON item of the appropriate type. */
 CJSON_PUBLIC_API
@@ -135,6 +359,9 @@ CJSON_PUBLIC_API
 extern cJSON *cJSON_CreateFalse(void);
 CJSON_PUBLIC_API
 extern cJSON *cJSON_CreateNumber(double num);
+/* A number with an exact 64-bit integer value. */
+CJSON_PUBLIC_API
+extern cJSON *cJSON_CreateInt64(int64_t num);
 CJSON_PUBLIC_API
 extern cJSON *cJSON_CreateString(const char *string);
 CJSON_PUBLIC_API
@@ -189,6 +416,8 @@ extern void cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *ne
         cJSON_AddItemToObject(object, name, cJSON_CreateFalse())
 #define cJSON_AddNumberToObject(object,name,n) \
         cJSON_AddItemToObject(object, name, cJSON_CreateNumber(n))
+#define cJSON_AddInt64ToObject(object,name,n) \
+        cJSON_AddItemToObject(object, name, cJSON_CreateInt64(n))
 #define cJSON_AddStringToObject(object,name,s) \
         cJSON_AddItemToObject(object, name, cJSON_CreateString(s))
 
@@ -0,0 +1,177 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// CRCs other than CRC-32C, for data from files and protocols which use
+// them:
+//
+// Couchbase::Crc32 - CRC-32 of zlib, gzip, PNG and Ethernet
+// Couchbase::Crc64 - CRC-64/XZ, the ECMA-182 polynomial as used by xz
+//
+// Both are instances of the Couchbase::Crc template, which shares the
+// crc32c software kernels (slicing-by-16 with a 3-way interleave) and
+// uses PCLMULQDQ folding on x86-64 CPUs which have it. Use crc32c() for
+// CRC-32C, it has the hardware crc32 instruction too.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <platform/visibility.h>
+
+#include <type_traits>
+
+struct iovec;
+
+#ifdef CRC32C_UNIT_TEST
+#undef PLATFORM_PUBLIC_API
+#define PLATFORM_PUBLIC_API
+#endif
+
+namespace Couchbase {
+    /**
+     * A reflected CRC of Width bits (32 or 64) with the polynomial Poly,
+     * in reflected bit order, an initial value of all ones and the result
+     * inverted. The library has Crc32 and Crc64.
+     *
+     * checksum() and combine() work on whole buffers, an instance of the
+     * class checksums data which arrives in pieces, the same way as
+     * Couchbase::Crc32c.
+     */
+    template <uint64_t Poly, int Width>
+    class PLATFORM_PUBLIC_API Crc {
+        static_assert(Width == 32 || Width == 64,
+                      "Couchbase::Crc is for 32 and 64-bit CRCs");
+
+    public:
+        typedef typename std::conditional<Width == 32,
+                                          uint32_t, uint64_t>::type value_type;
+
+        /**
+         * The crc of len bytes at buf, carrying on from crc_in, the crc of
+         * some earlier data.
+         */
+        static value_type checksum(const void* buf, size_t len,
+                                   value_type crc_in = 0);
+
+        /**
+         * The crc of block A followed by block B from crc_a, the crc of
+         * A, crc_b, the crc of B with a crc_in of 0, and len_b, the length
+         * of B. Runs in O(log len_b) time without reading either block.
+         */
+        static value_type combine(value_type crc_a, value_type crc_b,
+                                  size_t len_b);
+
+        /**
+         * Start a checksum, optionally carrying on from crc_in.
+         */
+        explicit Crc(value_type crc_in = 0)
+            : crc(crc_in),
+              length(0) {
+        }
+
+        /**
+         * Add len bytes at buf.
+         */
+        Crc& update(const void* buf, size_t len) {
+            crc = checksum(buf, len, crc);
+            length += len;
+            return *this;
+        }
+
+        /**
+         * Add the contents of a container with contiguous storage, such
+         * as a std::string or std::vector.
+         */
+        template <typename Container>
+        Crc& update(const Container& data) {
+            return update(data.data(), data.size() * sizeof(*data.data()));
+        }
+
+        /**
+         * Add iovcnt buffers described by iov, in order.
+         */
+        Crc& update(const struct iovec* iov, size_t iovcnt);
+
+        /**
+         * Add the data checksummed by other, which must have started
+         * with a crc_in of 0, without reading it again.
+         */
+        Crc& combine(const Crc& other) {
+            return combine(other.crc, other.length);
+        }
+
+        /**
+         * Add len bytes of data whose crc (with a crc_in of 0) is
+         * other_crc, without reading it again.
+         */
+        Crc& combine(value_type other_crc, size_t len) {
+            crc = combine(crc, other_crc, len);
+            length += len;
+            return *this;
+        }
+
+        /**
+         * The crc of everything added so far. Adding more afterwards is
+         * fine.
+         */
+        value_type finalize() const {
+            return crc;
+        }
+
+        /**
+         * The number of bytes added so far.
+         */
+        size_t size() const {
+            return length;
+        }
+
+    private:
+        value_type crc;
+        size_t length;
+    };
+
+    /**
+     * CRC-32 (ISO-HDLC) as used by zlib, gzip, PNG and Ethernet. The check
+     * value, of "123456789", is 0xcbf43926.
+     */
+    typedef Crc<0xedb88320, 32> Crc32;
+
+    /**
+     * CRC-64/XZ, the ECMA-182 polynomial reflected, as used by xz and Go's
+     * hash/crc64.ECMA. The check value is 0x995dc9bbdf1939fa.
+     */
+    typedef Crc<0xc96c5795d7870f42, 64> Crc64;
+
+    /**
+     * The CRC-32C instance of the template is crc32c() and
+     * crc32c_combine(), with the hardware kernels.
+     */
+    template <>
+    PLATFORM_PUBLIC_API uint32_t Crc<0x82f63b78, 32>::checksum(const void* buf,
+                                                               size_t len,
+                                                               uint32_t crc_in);
+
+    template <>
+    PLATFORM_PUBLIC_API uint32_t Crc<0x82f63b78, 32>::combine(uint32_t crc_a,
+                                                              uint32_t crc_b,
+                                                              size_t len_b);
+
+    extern template class Crc<0xedb88320, 32>;
+    extern template class Crc<0xc96c5795d7870f42, 64>;
+    extern template class Crc<0x82f63b78, 32>;
+}
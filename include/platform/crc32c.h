@@ -20,10 +20,31 @@
 // CRC polynomial of 0x1EDC6F41
 //
 // When available a hardware assisted function is used for increased performance.
+// On x86-64 the fastest available of SSE4.2 crc32, PCLMULQDQ folding or
+// AVX-512 VPCLMULQDQ folding is selected at runtime with cpuid, on AArch64
+// the ARMv8 crc32c instructions are used if the CPU has them. Everything
+// else gets a portable slicing-by-16 software version.
 //
-// This module provides one function:
+// This module provides the following functions:
 //
 // uint32_t crc32c(const uint8_t* bug, size_t len, uint32_t crc_in)
+// uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b)
+// uint32_t crc32c_parallel(const uint8_t* buf, size_t len, uint32_t crc_in,
+//                          unsigned nthreads)
+// void crc32c_multi(const uint8_t* bufs[], const size_t lens[],
+//                   uint32_t out[], size_t n)
+// uint32_t crc32c_copy(uint8_t* dst, const uint8_t* src, size_t len,
+//                      uint32_t crc_in)
+// const char* crc32c_calibrate()
+// const char* crc32c_implementation()
+// constexpr uint32_t crc32c_constexpr(const char* buf, size_t len,
+//                                     uint32_t crc_in)
+// constexpr uint32_t crc32c_constexpr(const char (&str)[N])
+//
+// and the Couchbase::Crc32c and Couchbase::Crc32cStreamBuf classes for
+// checksumming data which arrives in pieces.
+//
+// CRC-32 (zlib) and CRC-64 are in platform/crc.h.
 //
 //
 
@@ -32,39 +53,231 @@
 #include <stddef.h>
 #include <platform/visibility.h>
 
-//
-// This module requires X86 for the HW assisted version of the function.
-// For now this #error is here because there's been no requirement for
-// a portable/non-X86 version of this function in Couchbase.
-// To fix will require refactoring to hide the X86 dependencies when
-// built on another platform.
-//
-// The code is also x64 optimised.
-//
-#if !defined(__x86_64__) && !defined(_M_X64)
-#error "crc32c requires X86 for hardware acceleration"
-#endif
+#include <streambuf>
+
+struct iovec;
 
 #ifdef CRC32C_UNIT_TEST
 #undef PLATFORM_PUBLIC_API
 #define PLATFORM_PUBLIC_API
 #endif
 
-// If GCC 4.8 or higher use compiler attributes to select the
-// correct function at runtime. If running the CRC32C unit test
-// disable this as we want individually visible hw/sw versions.
-#if (__GNUC__ > 3) && (__GNUC_MINOR__ > 7) && !defined(CRC32C_UNIT_TEST)
-#define USE_GCC_SSE4_ATTRIBUTE 1
-
-PLATFORM_PUBLIC_API __attribute__ ((target ("default")))
+PLATFORM_PUBLIC_API
 uint32_t crc32c (const uint8_t* buf, size_t len, uint32_t crc_in);
 
-PLATFORM_PUBLIC_API __attribute__ ((target ("sse4.2")))
-uint32_t crc32c (const uint8_t* buf, size_t len, uint32_t crc_in);
+//
+// Combine the crc32c of two adjacent blocks of data without re-reading
+// either of them. crc_a is the crc32c of the first block, crc_b is the
+// crc32c (with a crc_in of 0) of the second block which is len_b bytes
+// long. The result is the crc32c of the first block followed by the
+// second.
+//
+// This allows the crc of a large buffer to be computed in chunks on
+// different threads, or out of order, and merged afterwards. Runs in
+// O(log len_b) time.
+//
+PLATFORM_PUBLIC_API
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b);
 
-#else
+//
+// Multi-threaded crc32c for very large buffers. The buffer is split
+// into nthreads chunks which are checksummed concurrently and merged
+// with crc32c_combine. The result is identical to crc32c().
+//
+// A nthreads of 0 uses one thread per hardware thread. Fewer threads
+// than requested are used when the chunks would be too small (< 1MiB) to
+// be worth it, so it's safe to call with small buffers.
+//
+PLATFORM_PUBLIC_API
+uint32_t crc32c_parallel(const uint8_t* buf, size_t len, uint32_t crc_in,
+                         unsigned nthreads);
 
+//
+// crc32c (with a crc_in of 0) of each of n separate buffers, bufs[i] of
+// lens[i] bytes, into out[i]. Equivalent to calling crc32c for each one,
+// but faster for small buffers of a few hundred bytes: several of them
+// are checksummed at once so the hardware crc unit is kept busy instead
+// of waiting on the latency of one crc chain.
+//
 PLATFORM_PUBLIC_API
-uint32_t crc32c (const uint8_t* buf, size_t len, uint32_t crc_in);
+void crc32c_multi(const uint8_t* bufs[], const size_t lens[],
+                  uint32_t out[], size_t n);
+
+//
+// Copy len bytes from src to dst, which must not overlap, and return the
+// crc32c of them, the same as memcpy followed by crc32c(dst, len, crc_in)
+// but reading the data from memory only once. Large copies bypass the
+// cache for dst, so don't use it for a copy which is about to be read.
+//
+PLATFORM_PUBLIC_API
+uint32_t crc32c_copy(uint8_t* dst, const uint8_t* src, size_t len,
+                     uint32_t crc_in);
+
+//
+// Time the crc32c kernels the CPU supports and switch crc32c to the
+// fastest. This covers the 3, 4 and 6-way crc32 pipelines with a range of
+// block sizes, as well as the carry-less multiply folding kernels.
+// Calibration runs once and takes a few milliseconds. Later calls just
+// return the result. It is thread safe and can be called while other
+// threads are using crc32c.
+//
+// Setting CB_CRC32C_CALIBRATE=1 in the environment calibrates when the
+// library is loaded.
+//
+// Returns the same as crc32c_implementation().
+//
+PLATFORM_PUBLIC_API
+const char* crc32c_calibrate();
+
+//
+// Describe the kernel crc32c is currently using, for example
+// "sse4.2 3-way 8192/256" or "pclmulqdq 8x128". The string is static.
+//
+PLATFORM_PUBLIC_API
+const char* crc32c_implementation();
+
+//
+// crc32c which can be evaluated at compile time, for checksums of string
+// literals and other constants, e.g.
+//
+//   static_assert(crc32c_constexpr("123456789") == 0xe3069283, "");
+//
+// The result is the same as crc32c(). The literal form leaves out the
+// terminating nul. It works a bit at a time, so is only for constants;
+// use crc32c() at run time.
+//
+constexpr uint32_t crc32c_constexpr_bits(uint32_t crc, int n) {
+    return n == 0 ? crc :
+        crc32c_constexpr_bits(crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1,
+                              n - 1);
+}
+
+// Split in halves rather than recursing byte by byte, so the recursion
+// depth is log2(len) and long constants don't hit the compiler's limit.
+constexpr uint32_t crc32c_constexpr_raw(const char* buf, size_t len,
+                                        uint32_t crc) {
+    return len == 0 ? crc :
+        len == 1 ? crc32c_constexpr_bits(crc ^ static_cast<uint8_t>(*buf), 8) :
+        crc32c_constexpr_raw(buf + len / 2, len - len / 2,
+                             crc32c_constexpr_raw(buf, len / 2, crc));
+}
+
+constexpr uint32_t crc32c_constexpr(const char* buf, size_t len,
+                                    uint32_t crc_in) {
+    return ~crc32c_constexpr_raw(buf, len, ~crc_in);
+}
+
+template <size_t N>
+constexpr uint32_t crc32c_constexpr(const char (&str)[N]) {
+    return crc32c_constexpr(str, N - 1, 0);
+}
+
+namespace Couchbase {
+    /**
+     * Incremental crc32c of data which arrives in pieces: a buffer at a
+     * time, as a scatter-gather list or from another Crc32c. The result
+     * is the same as crc32c() of all the data, one after the other.
+     */
+    class PLATFORM_PUBLIC_API Crc32c {
+    public:
+        /**
+         * Start a checksum, optionally carrying on from crc_in, the
+         * crc32c of some earlier data.
+         */
+        explicit Crc32c(uint32_t crc_in = 0)
+            : crc(crc_in),
+              length(0) {
+        }
+
+        /**
+         * Add len bytes at buf.
+         */
+        Crc32c& update(const void* buf, size_t len) {
+            crc = crc32c(static_cast<const uint8_t*>(buf), len, crc);
+            length += len;
+            return *this;
+        }
+
+        /**
+         * Add the contents of a container with contiguous storage, such
+         * as a std::string or std::vector.
+         */
+        template <typename Container>
+        Crc32c& update(const Container& data) {
+            return update(data.data(), data.size() * sizeof(*data.data()));
+        }
+
+        /**
+         * Add iovcnt buffers described by iov, in order. Short buffers
+         * are gathered up and checksummed together, so a list of many
+         * small pieces costs about the same as one buffer of the same
+         * total size.
+         */
+        Crc32c& update(const struct iovec* iov, size_t iovcnt);
+
+        /**
+         * Add the data checksummed by other, which must have started
+         * with a crc_in of 0, without reading it again.
+         */
+        Crc32c& combine(const Crc32c& other) {
+            return combine(other.crc, other.length);
+        }
+
+        /**
+         * Add len bytes of data whose crc32c (with a crc_in of 0) is
+         * other_crc, without reading it again.
+         */
+        Crc32c& combine(uint32_t other_crc, size_t len) {
+            crc = crc32c_combine(crc, other_crc, len);
+            length += len;
+            return *this;
+        }
+
+        /**
+         * The crc32c of everything added so far. Adding more afterwards
+         * is fine.
+         */
+        uint32_t finalize() const {
+            return crc;
+        }
+
+        /**
+         * The number of bytes added so far.
+         */
+        size_t size() const {
+            return length;
+        }
+
+    private:
+        uint32_t crc;
+        size_t length;
+    };
+
+    /**
+     * A std::streambuf which checksums everything written to it, to get
+     * the crc32c of data written through a std::ostream. The data is
+     * passed on to sink if there is one, otherwise it is dropped, and
+     * only what sink accepts is checksummed.
+     */
+    class PLATFORM_PUBLIC_API Crc32cStreamBuf : public std::streambuf {
+    public:
+        explicit Crc32cStreamBuf(std::streambuf* sink = nullptr)
+            : sink(sink) {
+        }
+
+        const Crc32c& crc() const {
+            return hasher;
+        }
+
+    protected:
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+        int_type overflow(int_type ch) override;
+
+        int sync() override;
 
-#endif
\ No newline at end of file
+    private:
+        Crc32c hasher;
+        std::streambuf* sink;
+    };
+}
@@ -21,8 +21,11 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <atomic>
 #include <cstdio>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace Couchbase {
     class PLATFORM_PUBLIC_API MemoryMappedFile {
@@ -64,9 +67,70 @@ namespace Couchbase {
             return size;
         }
 
+        /**
+        * The default block size of a crc index, each block of the file
+        * has its own crc32c.
+        */
+        static const size_t CRC_BLOCK_SIZE = 64 * 1024;
+
+        /**
+        * The name of the sidecar file holding the crc index of fname.
+        */
+        static std::string getCrcIndexName(const std::string &fname);
+
+        /**
+        * Build the crc index of the mapping, one crc32c for each blockSize
+        * bytes, and write it to the sidecar file. blockSize must be a
+        * power of two of at least 4KiB. The blocks are checksummed by
+        * nthreads threads, 0 meaning one per hardware thread. The index
+        * is also loaded, with every block verified. Throws an std::string
+        * on failure.
+        */
+        void writeCrcIndex(size_t blockSize = CRC_BLOCK_SIZE,
+                           unsigned nthreads = 0);
+
+        /**
+        * Load the crc index from the sidecar file, so blocks can be
+        * verified with verifyRange as they are used instead of all at
+        * open time. Throws an std::string if the index is missing,
+        * corrupt or for a file of a different size. Call after open();
+        * close() drops the index.
+        */
+        void loadCrcIndex(void);
+
+        /**
+        * Is a crc index loaded?
+        */
+        bool hasCrcIndex(void) const {
+            return crcBlockSize != 0;
+        }
+
+        /**
+        * Check the crc32c of each block overlapping [offset, offset + len)
+        * which hasn't been verified already against the crc index, so
+        * each block is read for verification at most once. Returns false
+        * if any of them don't match. Throws an std::string if no index is
+        * loaded or the range is outside the mapping. Safe to call from
+        * several threads at once.
+        *
+        * The index is of the file as it was when it was written; changes
+        * made through the mapping aren't tracked, writeCrcIndex again
+        * after making them.
+        */
+        bool verifyRange(size_t offset, size_t len);
+
+        /**
+        * verifyRange over the whole mapping.
+        */
+        bool verify(void) {
+            return verifyRange(0, getSize());
+        }
+
     private:
         MemoryMappedFile(MemoryMappedFile &) = delete;
 
+        void dropCrcIndex(void);
+
         std::string filename;
 #ifdef WIN32
         HANDLE filehandle;
@@ -78,5 +142,11 @@ namespace Couchbase {
         size_t size;
         bool sharedMapping;
         bool readonly;
+
+        // The crc index, crcBlockSize is 0 when there isn't one
+        size_t crcBlockSize;
+        std::vector<uint32_t> crcIndex;
+        // A flag for each block, set once its crc has been checked
+        std::unique_ptr<std::atomic<bool>[]> crcVerified;
     };
 }
@@ -0,0 +1,93 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <platform/visibility.h>
+#include <cJSON.h>
+
+#include <stddef.h>
+#include <vector>
+
+namespace Couchbase {
+    /**
+     * Parses newline-delimited JSON, a document per line as in logs and
+     * exports, on several threads at once.
+     *
+     * The text is split into a run of whole lines for each thread, which
+     * copies its lines and parses them in place into its own arena, so
+     * the threads share nothing and the trees take no mallocs of their
+     * own. The documents come back in the order of the input.
+     */
+    class PLATFORM_PUBLIC_API NdjsonBatch {
+    public:
+        /**
+         * Parse with up to nthreads threads, 0 meaning one per hardware
+         * thread. Small inputs get fewer.
+         */
+        explicit NdjsonBatch(unsigned nthreads = 0);
+
+        ~NdjsonBatch();
+
+        /**
+         * Parse each line of the len bytes at data, for instance a
+         * MemoryMappedFile, replacing the documents of the last call.
+         * Empty lines are skipped, a "\r" before the "\n" is allowed and
+         * the last line needn't end with a "\n". data isn't used after
+         * this returns. Returns the number of documents. Throws
+         * std::bad_alloc if memory runs out.
+         */
+        size_t parse(const char *data, size_t len);
+
+        /**
+         * The number of documents from the last parse.
+         */
+        size_t size(void) const {
+            return documents.size();
+        }
+
+        /**
+         * Document ii, in input order, or NULL if its line isn't valid
+         * JSON. It belongs to the batch and lasts until the next parse
+         * or the batch is destroyed: don't cJSON_Delete it.
+         */
+        cJSON *operator[](size_t ii) const {
+            return documents[ii];
+        }
+
+    private:
+        NdjsonBatch(const NdjsonBatch &) = delete;
+        NdjsonBatch &operator=(const NdjsonBatch &) = delete;
+
+        /**
+         * What one thread parses: its copy of the text, which the trees
+         * point into, and the arena they're allocated from.
+         */
+        struct Chunk {
+            std::vector<char> text;
+            cJSON_Arena *arena;
+            std::vector<cJSON *> documents;
+            bool failed = false;
+        };
+
+        void parseChunk(Chunk &chunk, const char *data, size_t len);
+
+        unsigned nthreads;
+        std::vector<Chunk> chunks;
+        std::vector<cJSON *> documents;
+    };
+}
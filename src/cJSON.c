@@ -31,8 +31,32 @@
 #include <float.h>
 #include <limits.h>
 #include <ctype.h>
+#include <stddef.h>
+#include <locale.h>
+#include <inttypes.h>
 #include "cJSON.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CJSON_SSE2 1
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* The SSE2 scanners load whole aligned blocks, which can't cross into
+   another page but do read past the end of the string. */
+#if defined(__SANITIZE_ADDRESS__)
+#define CJSON_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define CJSON_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef CJSON_NO_SANITIZE_ADDRESS
+#define CJSON_NO_SANITIZE_ADDRESS
+#endif
+
 static int cJSON_strcasecmp(const char *s1, const char *s2)
 {
     if (!s1) {
@@ -76,96 +100,965 @@ static cJSON *cJSON_New_Item(void)
     return cJSON_calloc(1, sizeof(cJSON));
 }
 
+/* The hooks as an allocator, for everything not given one of its own.
+   They're looked up on each call, as cJSON_InitHooks may change them. */
+static void *hooks_malloc(void *ctx, size_t sz)
+{
+    (void)ctx;
+    return cJSON_malloc(sz);
+}
+
+static void hooks_free(void *ctx, void *ptr)
+{
+    (void)ctx;
+    cJSON_free(ptr);
+}
+
+static const cJSON_Allocator hooks_allocator = { hooks_malloc, hooks_free, NULL };
+
+static void *allocator_malloc(const cJSON_Allocator *allocator, size_t size)
+{
+    return allocator->malloc_fn(allocator->ctx, size);
+}
+
+static void allocator_free(const cJSON_Allocator *allocator, void *ptr)
+{
+    if (ptr) {
+        allocator->free_fn(allocator->ctx, ptr);
+    }
+}
+
+/* Arena allocation. The arena is a list of blocks, allocations are bumped
+   off the front one and nothing is freed until the arena is reset. */
+#define CJSON_ARENA_DEFAULT_BLOCK (64 * 1024)
+
+typedef union cJSON_ArenaAlign {
+    void *p;
+    double d;
+    long l;
+} cJSON_ArenaAlign;
+
+#define CJSON_ARENA_ALIGN(sz) \
+    (((sz) + sizeof(cJSON_ArenaAlign) - 1) & ~(sizeof(cJSON_ArenaAlign) - 1))
+
+typedef struct cJSON_ArenaBlock {
+    struct cJSON_ArenaBlock *next;
+    cJSON_ArenaAlign data[1];
+} cJSON_ArenaBlock;
+
+struct cJSON_Arena {
+    cJSON_ArenaBlock *blocks; /* most recent first */
+    cJSON_ArenaBlock *first; /* kept by cJSON_ResetArena */
+    char *ptr;
+    char *end;
+    size_t block_size;
+    cJSON_Allocator allocator; /* where the blocks come from */
+};
+
+static cJSON_ArenaBlock *arena_new_block(cJSON_Arena *arena, size_t size)
+{
+    return allocator_malloc(&arena->allocator, offsetof(cJSON_ArenaBlock, data) + size);
+}
+
+cJSON_Arena *cJSON_CreateArena(size_t block_size)
+{
+    return cJSON_CreateArenaWithAllocator(block_size, &hooks_allocator);
+}
+
+cJSON_Arena *cJSON_CreateArenaWithAllocator(size_t block_size,
+                                            const cJSON_Allocator *allocator)
+{
+    cJSON_Arena *arena = allocator_malloc(allocator, sizeof(cJSON_Arena));
+    if (!arena) {
+        return NULL;
+    }
+    arena->allocator = *allocator;
+    if (block_size == 0) {
+        block_size = CJSON_ARENA_DEFAULT_BLOCK;
+    }
+    arena->block_size = CJSON_ARENA_ALIGN(block_size);
+    arena->first = arena_new_block(arena, arena->block_size);
+    if (!arena->first) {
+        allocator_free(allocator, arena);
+        return NULL;
+    }
+    arena->first->next = NULL;
+    arena->blocks = arena->first;
+    arena->ptr = (char *)arena->first->data;
+    arena->end = arena->ptr + arena->block_size;
+    return arena;
+}
+
+void cJSON_ResetArena(cJSON_Arena *arena)
+{
+    cJSON_ArenaBlock *block = arena->blocks;
+    while (block) {
+        cJSON_ArenaBlock *next = block->next;
+        if (block != arena->first) {
+            allocator_free(&arena->allocator, block);
+        }
+        block = next;
+    }
+    arena->first->next = NULL;
+    arena->blocks = arena->first;
+    arena->ptr = (char *)arena->first->data;
+    arena->end = arena->ptr + arena->block_size;
+}
+
+void cJSON_DeleteArena(cJSON_Arena *arena)
+{
+    if (arena) {
+        cJSON_Allocator allocator = arena->allocator;
+        cJSON_ResetArena(arena);
+        allocator_free(&allocator, arena->first);
+        allocator_free(&allocator, arena);
+    }
+}
+
+static void *arena_alloc(cJSON_Arena *arena, size_t size)
+{
+    cJSON_ArenaBlock *block;
+    void *ret;
+
+    size = CJSON_ARENA_ALIGN(size);
+    if ((size_t)(arena->end - arena->ptr) >= size) {
+        ret = arena->ptr;
+        arena->ptr += size;
+        return ret;
+    }
+
+    if (size > arena->block_size / 4) {
+        /* Big enough for a block of its own, which goes behind the
+           current block so what's left of that can still be used. */
+        block = arena_new_block(arena, size);
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+        return block->data;
+    }
+
+    block = arena_new_block(arena, arena->block_size);
+    if (!block) {
+        return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->ptr = (char *)block->data + size;
+    arena->end = (char *)block->data + arena->block_size;
+    return block->data;
+}
+
+/* The key table is open addressing over a fixed number of slots, each
+   set once with a compare and swap and never changed or removed, so
+   lookups need no lock: a slot holds nothing or its key for good. */
+#define CJSON_KEYS_DEFAULT 4096
+
+#ifdef _MSC_VER
+static char *keys_load(char **slot)
+{
+    return _InterlockedCompareExchangePointer((void *volatile *)slot, NULL, NULL);
+}
+
+static int keys_claim(char **slot, char *key)
+{
+    return _InterlockedCompareExchangePointer((void *volatile *)slot, key, NULL) == NULL;
+}
+
+static long keys_count(volatile long *count, long n)
+{
+    return _InterlockedExchangeAdd(count, n) + n;
+}
+#else
+static char *keys_load(char **slot)
+{
+    return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+}
+
+static int keys_claim(char **slot, char *key)
+{
+    char *expected = NULL;
+    return __atomic_compare_exchange_n(slot, &expected, key, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static long keys_count(volatile long *count, long n)
+{
+    return __atomic_add_fetch(count, n, __ATOMIC_RELAXED);
+}
+#endif
+
+struct cJSON_KeyTable {
+    char **slots;
+    size_t mask;
+    long max_keys;
+    volatile long count;
+};
+
+cJSON_KeyTable *cJSON_CreateKeyTable(size_t max_keys)
+{
+    cJSON_KeyTable *keys = cJSON_calloc(1, sizeof(cJSON_KeyTable));
+    size_t nslots = 16;
+
+    if (!keys) {
+        return NULL;
+    }
+    if (max_keys == 0) {
+        max_keys = CJSON_KEYS_DEFAULT;
+    }
+    if (max_keys > LONG_MAX / 2) {
+        max_keys = LONG_MAX / 2;
+    }
+    /* No more than half full */
+    while (nslots < max_keys * 2) {
+        nslots *= 2;
+    }
+    keys->slots = cJSON_calloc(nslots, sizeof(char *));
+    if (!keys->slots) {
+        cJSON_free(keys);
+        return NULL;
+    }
+    keys->mask = nslots - 1;
+    keys->max_keys = (long)max_keys;
+    return keys;
+}
+
+void cJSON_DeleteKeyTable(cJSON_KeyTable *keys)
+{
+    size_t i;
+    if (keys) {
+        for (i = 0; i <= keys->mask; i++) {
+            cJSON_free(keys->slots[i]);
+        }
+        cJSON_free(keys->slots);
+        cJSON_free(keys);
+    }
+}
+
+/* The table's copy of the len bytes at str, or NULL if it's full. */
+static const char *keys_intern(cJSON_KeyTable *keys, const char *str, size_t len)
+{
+    size_t hash = (size_t)2166136261u;
+    size_t i;
+    char *slot;
+    char *copy = NULL;
+
+    /* FNV-1a */
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+
+    for (i = hash & keys->mask;; i = (i + 1) & keys->mask) {
+        slot = keys_load(&keys->slots[i]);
+        if (!slot) {
+            if (!copy) {
+                if (keys_count(&keys->count, 1) > keys->max_keys) {
+                    keys_count(&keys->count, -1);
+                    return NULL;
+                }
+                copy = cJSON_malloc(len + 1);
+                if (!copy) {
+                    keys_count(&keys->count, -1);
+                    return NULL;
+                }
+                memcpy(copy, str, len);
+                copy[len] = 0;
+            }
+            if (keys_claim(&keys->slots[i], copy)) {
+                return copy;
+            }
+            /* Another thread took the slot, see if it was for this key */
+            slot = keys_load(&keys->slots[i]);
+        }
+        if (!strncmp(slot, str, len) && !slot[len]) {
+            if (copy) {
+                cJSON_free(copy);
+                keys_count(&keys->count, -1);
+            }
+            return slot;
+        }
+    }
+}
+
+const char *cJSON_InternKey(cJSON_KeyTable *keys, const char *string)
+{
+    return keys_intern(keys, string, strlen(string));
+}
+
+/* How deep cJSON_ParseWithLength lets arrays and objects nest */
+#define CJSON_LENGTH_DEPTH 512
+
+/* The state of a parse: where the nodes and strings are allocated from,
+   and the flags each node gets to say what it doesn't own. */
+typedef struct cJSON_Parser {
+    cJSON_Arena *arena;
+    int flags;
+    int insitu; /* unescape strings over the text being parsed */
+    cJSON_KeyTable *keys; /* where object member names come from, if set */
+    const cJSON_Allocator *allocator; /* without an arena */
+    const char *end; /* of the text, or NULL if it's NUL terminated */
+    int depth; /* how much deeper containers may nest, if end is set */
+} cJSON_Parser;
+
+static void *parser_alloc(cJSON_Parser *p, size_t size)
+{
+    if (p->arena) {
+        return arena_alloc(p->arena, size);
+    }
+    return allocator_malloc(p->allocator, size);
+}
+
+static cJSON *parser_new_item(cJSON_Parser *p)
+{
+    cJSON *item;
+    if (!p->arena && p->allocator == &hooks_allocator) {
+        item = cJSON_New_Item();
+    } else {
+        item = parser_alloc(p, sizeof(cJSON));
+        if (item) {
+            memset(item, 0, sizeof(cJSON));
+        }
+    }
+    if (item) {
+        item->type = p->flags;
+    }
+    return item;
+}
+
+typedef struct cJSON_Index cJSON_Index;
+static void index_free(cJSON_Index *idx);
+
 /* Delete a cJSON structure. */
-void cJSON_Delete(cJSON *c)
+static void delete_item(cJSON *c, const cJSON_Allocator *allocator)
 {
     cJSON *next;
     while (c) {
         next = c->next;
         if (!(c->type & cJSON_IsReference) && c->child) {
-            cJSON_Delete(c->child);
+            delete_item(c->child, allocator);
+        }
+        index_free(c->index);
+        if (!(c->type & (cJSON_IsReference | cJSON_ValueIsConst))) {
+            allocator_free(allocator, c->valuestring);
         }
-        if (!(c->type & cJSON_IsReference) && c->valuestring) {
-            cJSON_free(c->valuestring);
+        if (!(c->type & cJSON_StringIsConst)) {
+            allocator_free(allocator, c->string);
         }
-        if (c->string) {
-            cJSON_free(c->string);
+        if (!(c->type & cJSON_IsArena)) {
+            allocator_free(allocator, c);
         }
-        cJSON_free(c);
         c = next;
     }
 }
 
+void cJSON_Delete(cJSON *c)
+{
+    delete_item(c, &hooks_allocator);
+}
+
+void cJSON_DeleteWithAllocator(cJSON *c, const cJSON_Allocator *allocator)
+{
+    delete_item(c, allocator);
+}
+
+/* The powers of ten which are exact as doubles. */
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* 5^q for q from -64 to 64 to 128 bits, normalised so the top bit is set,
+   truncated for q >= 0 and rounded up for q < 0, for Eisel-Lemire. */
+#define CJSON_POW5_MIN (-64)
+#define CJSON_POW5_MAX 64
+
+static const uint64_t powers_of_five_128[][2] = {
+    { 0xa87fea27a539e9a5ULL, 0x3f2398d747b36224ULL }, /* 5^-64 */
+    { 0xd29fe4b18e88640eULL, 0x8eec7f0d19a03aadULL }, /* 5^-63 */
+    { 0x83a3eeeef9153e89ULL, 0x1953cf68300424acULL }, /* 5^-62 */
+    { 0xa48ceaaab75a8e2bULL, 0x5fa8c3423c052dd7ULL }, /* 5^-61 */
+    { 0xcdb02555653131b6ULL, 0x3792f412cb06794dULL }, /* 5^-60 */
+    { 0x808e17555f3ebf11ULL, 0xe2bbd88bbee40bd0ULL }, /* 5^-59 */
+    { 0xa0b19d2ab70e6ed6ULL, 0x5b6aceaeae9d0ec4ULL }, /* 5^-58 */
+    { 0xc8de047564d20a8bULL, 0xf245825a5a445275ULL }, /* 5^-57 */
+    { 0xfb158592be068d2eULL, 0xeed6e2f0f0d56712ULL }, /* 5^-56 */
+    { 0x9ced737bb6c4183dULL, 0x55464dd69685606bULL }, /* 5^-55 */
+    { 0xc428d05aa4751e4cULL, 0xaa97e14c3c26b886ULL }, /* 5^-54 */
+    { 0xf53304714d9265dfULL, 0xd53dd99f4b3066a8ULL }, /* 5^-53 */
+    { 0x993fe2c6d07b7fabULL, 0xe546a8038efe4029ULL }, /* 5^-52 */
+    { 0xbf8fdb78849a5f96ULL, 0xde98520472bdd033ULL }, /* 5^-51 */
+    { 0xef73d256a5c0f77cULL, 0x963e66858f6d4440ULL }, /* 5^-50 */
+    { 0x95a8637627989aadULL, 0xdde7001379a44aa8ULL }, /* 5^-49 */
+    { 0xbb127c53b17ec159ULL, 0x5560c018580d5d52ULL }, /* 5^-48 */
+    { 0xe9d71b689dde71afULL, 0xaab8f01e6e10b4a6ULL }, /* 5^-47 */
+    { 0x9226712162ab070dULL, 0xcab3961304ca70e8ULL }, /* 5^-46 */
+    { 0xb6b00d69bb55c8d1ULL, 0x3d607b97c5fd0d22ULL }, /* 5^-45 */
+    { 0xe45c10c42a2b3b05ULL, 0x8cb89a7db77c506aULL }, /* 5^-44 */
+    { 0x8eb98a7a9a5b04e3ULL, 0x77f3608e92adb242ULL }, /* 5^-43 */
+    { 0xb267ed1940f1c61cULL, 0x55f038b237591ed3ULL }, /* 5^-42 */
+    { 0xdf01e85f912e37a3ULL, 0x6b6c46dec52f6688ULL }, /* 5^-41 */
+    { 0x8b61313bbabce2c6ULL, 0x2323ac4b3b3da015ULL }, /* 5^-40 */
+    { 0xae397d8aa96c1b77ULL, 0xabec975e0a0d081aULL }, /* 5^-39 */
+    { 0xd9c7dced53c72255ULL, 0x96e7bd358c904a21ULL }, /* 5^-38 */
+    { 0x881cea14545c7575ULL, 0x7e50d64177da2e54ULL }, /* 5^-37 */
+    { 0xaa242499697392d2ULL, 0xdde50bd1d5d0b9e9ULL }, /* 5^-36 */
+    { 0xd4ad2dbfc3d07787ULL, 0x955e4ec64b44e864ULL }, /* 5^-35 */
+    { 0x84ec3c97da624ab4ULL, 0xbd5af13bef0b113eULL }, /* 5^-34 */
+    { 0xa6274bbdd0fadd61ULL, 0xecb1ad8aeacdd58eULL }, /* 5^-33 */
+    { 0xcfb11ead453994baULL, 0x67de18eda5814af2ULL }, /* 5^-32 */
+    { 0x81ceb32c4b43fcf4ULL, 0x80eacf948770ced7ULL }, /* 5^-31 */
+    { 0xa2425ff75e14fc31ULL, 0xa1258379a94d028dULL }, /* 5^-30 */
+    { 0xcad2f7f5359a3b3eULL, 0x096ee45813a04330ULL }, /* 5^-29 */
+    { 0xfd87b5f28300ca0dULL, 0x8bca9d6e188853fcULL }, /* 5^-28 */
+    { 0x9e74d1b791e07e48ULL, 0x775ea264cf55347eULL }, /* 5^-27 */
+    { 0xc612062576589ddaULL, 0x95364afe032a819eULL }, /* 5^-26 */
+    { 0xf79687aed3eec551ULL, 0x3a83ddbd83f52205ULL }, /* 5^-25 */
+    { 0x9abe14cd44753b52ULL, 0xc4926a9672793543ULL }, /* 5^-24 */
+    { 0xc16d9a0095928a27ULL, 0x75b7053c0f178294ULL }, /* 5^-23 */
+    { 0xf1c90080baf72cb1ULL, 0x5324c68b12dd6339ULL }, /* 5^-22 */
+    { 0x971da05074da7beeULL, 0xd3f6fc16ebca5e04ULL }, /* 5^-21 */
+    { 0xbce5086492111aeaULL, 0x88f4bb1ca6bcf585ULL }, /* 5^-20 */
+    { 0xec1e4a7db69561a5ULL, 0x2b31e9e3d06c32e6ULL }, /* 5^-19 */
+    { 0x9392ee8e921d5d07ULL, 0x3aff322e62439fd0ULL }, /* 5^-18 */
+    { 0xb877aa3236a4b449ULL, 0x09befeb9fad487c3ULL }, /* 5^-17 */
+    { 0xe69594bec44de15bULL, 0x4c2ebe687989a9b4ULL }, /* 5^-16 */
+    { 0x901d7cf73ab0acd9ULL, 0x0f9d37014bf60a11ULL }, /* 5^-15 */
+    { 0xb424dc35095cd80fULL, 0x538484c19ef38c95ULL }, /* 5^-14 */
+    { 0xe12e13424bb40e13ULL, 0x2865a5f206b06fbaULL }, /* 5^-13 */
+    { 0x8cbccc096f5088cbULL, 0xf93f87b7442e45d4ULL }, /* 5^-12 */
+    { 0xafebff0bcb24aafeULL, 0xf78f69a51539d749ULL }, /* 5^-11 */
+    { 0xdbe6fecebdedd5beULL, 0xb573440e5a884d1cULL }, /* 5^-10 */
+    { 0x89705f4136b4a597ULL, 0x31680a88f8953031ULL }, /* 5^-9 */
+    { 0xabcc77118461cefcULL, 0xfdc20d2b36ba7c3eULL }, /* 5^-8 */
+    { 0xd6bf94d5e57a42bcULL, 0x3d32907604691b4dULL }, /* 5^-7 */
+    { 0x8637bd05af6c69b5ULL, 0xa63f9a49c2c1b110ULL }, /* 5^-6 */
+    { 0xa7c5ac471b478423ULL, 0x0fcf80dc33721d54ULL }, /* 5^-5 */
+    { 0xd1b71758e219652bULL, 0xd3c36113404ea4a9ULL }, /* 5^-4 */
+    { 0x83126e978d4fdf3bULL, 0x645a1cac083126eaULL }, /* 5^-3 */
+    { 0xa3d70a3d70a3d70aULL, 0x3d70a3d70a3d70a4ULL }, /* 5^-2 */
+    { 0xccccccccccccccccULL, 0xcccccccccccccccdULL }, /* 5^-1 */
+    { 0x8000000000000000ULL, 0x0000000000000000ULL }, /* 5^0 */
+    { 0xa000000000000000ULL, 0x0000000000000000ULL }, /* 5^1 */
+    { 0xc800000000000000ULL, 0x0000000000000000ULL }, /* 5^2 */
+    { 0xfa00000000000000ULL, 0x0000000000000000ULL }, /* 5^3 */
+    { 0x9c40000000000000ULL, 0x0000000000000000ULL }, /* 5^4 */
+    { 0xc350000000000000ULL, 0x0000000000000000ULL }, /* 5^5 */
+    { 0xf424000000000000ULL, 0x0000000000000000ULL }, /* 5^6 */
+    { 0x9896800000000000ULL, 0x0000000000000000ULL }, /* 5^7 */
+    { 0xbebc200000000000ULL, 0x0000000000000000ULL }, /* 5^8 */
+    { 0xee6b280000000000ULL, 0x0000000000000000ULL }, /* 5^9 */
+    { 0x9502f90000000000ULL, 0x0000000000000000ULL }, /* 5^10 */
+    { 0xba43b74000000000ULL, 0x0000000000000000ULL }, /* 5^11 */
+    { 0xe8d4a51000000000ULL, 0x0000000000000000ULL }, /* 5^12 */
+    { 0x9184e72a00000000ULL, 0x0000000000000000ULL }, /* 5^13 */
+    { 0xb5e620f480000000ULL, 0x0000000000000000ULL }, /* 5^14 */
+    { 0xe35fa931a0000000ULL, 0x0000000000000000ULL }, /* 5^15 */
+    { 0x8e1bc9bf04000000ULL, 0x0000000000000000ULL }, /* 5^16 */
+    { 0xb1a2bc2ec5000000ULL, 0x0000000000000000ULL }, /* 5^17 */
+    { 0xde0b6b3a76400000ULL, 0x0000000000000000ULL }, /* 5^18 */
+    { 0x8ac7230489e80000ULL, 0x0000000000000000ULL }, /* 5^19 */
+    { 0xad78ebc5ac620000ULL, 0x0000000000000000ULL }, /* 5^20 */
+    { 0xd8d726b7177a8000ULL, 0x0000000000000000ULL }, /* 5^21 */
+    { 0x878678326eac9000ULL, 0x0000000000000000ULL }, /* 5^22 */
+    { 0xa968163f0a57b400ULL, 0x0000000000000000ULL }, /* 5^23 */
+    { 0xd3c21bcecceda100ULL, 0x0000000000000000ULL }, /* 5^24 */
+    { 0x84595161401484a0ULL, 0x0000000000000000ULL }, /* 5^25 */
+    { 0xa56fa5b99019a5c8ULL, 0x0000000000000000ULL }, /* 5^26 */
+    { 0xcecb8f27f4200f3aULL, 0x0000000000000000ULL }, /* 5^27 */
+    { 0x813f3978f8940984ULL, 0x4000000000000000ULL }, /* 5^28 */
+    { 0xa18f07d736b90be5ULL, 0x5000000000000000ULL }, /* 5^29 */
+    { 0xc9f2c9cd04674edeULL, 0xa400000000000000ULL }, /* 5^30 */
+    { 0xfc6f7c4045812296ULL, 0x4d00000000000000ULL }, /* 5^31 */
+    { 0x9dc5ada82b70b59dULL, 0xf020000000000000ULL }, /* 5^32 */
+    { 0xc5371912364ce305ULL, 0x6c28000000000000ULL }, /* 5^33 */
+    { 0xf684df56c3e01bc6ULL, 0xc732000000000000ULL }, /* 5^34 */
+    { 0x9a130b963a6c115cULL, 0x3c7f400000000000ULL }, /* 5^35 */
+    { 0xc097ce7bc90715b3ULL, 0x4b9f100000000000ULL }, /* 5^36 */
+    { 0xf0bdc21abb48db20ULL, 0x1e86d40000000000ULL }, /* 5^37 */
+    { 0x96769950b50d88f4ULL, 0x1314448000000000ULL }, /* 5^38 */
+    { 0xbc143fa4e250eb31ULL, 0x17d955a000000000ULL }, /* 5^39 */
+    { 0xeb194f8e1ae525fdULL, 0x5dcfab0800000000ULL }, /* 5^40 */
+    { 0x92efd1b8d0cf37beULL, 0x5aa1cae500000000ULL }, /* 5^41 */
+    { 0xb7abc627050305adULL, 0xf14a3d9e40000000ULL }, /* 5^42 */
+    { 0xe596b7b0c643c719ULL, 0x6d9ccd05d0000000ULL }, /* 5^43 */
+    { 0x8f7e32ce7bea5c6fULL, 0xe4820023a2000000ULL }, /* 5^44 */
+    { 0xb35dbf821ae4f38bULL, 0xdda2802c8a800000ULL }, /* 5^45 */
+    { 0xe0352f62a19e306eULL, 0xd50b2037ad200000ULL }, /* 5^46 */
+    { 0x8c213d9da502de45ULL, 0x4526f422cc340000ULL }, /* 5^47 */
+    { 0xaf298d050e4395d6ULL, 0x9670b12b7f410000ULL }, /* 5^48 */
+    { 0xdaf3f04651d47b4cULL, 0x3c0cdd765f114000ULL }, /* 5^49 */
+    { 0x88d8762bf324cd0fULL, 0xa5880a69fb6ac800ULL }, /* 5^50 */
+    { 0xab0e93b6efee0053ULL, 0x8eea0d047a457a00ULL }, /* 5^51 */
+    { 0xd5d238a4abe98068ULL, 0x72a4904598d6d880ULL }, /* 5^52 */
+    { 0x85a36366eb71f041ULL, 0x47a6da2b7f864750ULL }, /* 5^53 */
+    { 0xa70c3c40a64e6c51ULL, 0x999090b65f67d924ULL }, /* 5^54 */
+    { 0xd0cf4b50cfe20765ULL, 0xfff4b4e3f741cf6dULL }, /* 5^55 */
+    { 0x82818f1281ed449fULL, 0xbff8f10e7a8921a4ULL }, /* 5^56 */
+    { 0xa321f2d7226895c7ULL, 0xaff72d52192b6a0dULL }, /* 5^57 */
+    { 0xcbea6f8ceb02bb39ULL, 0x9bf4f8a69f764490ULL }, /* 5^58 */
+    { 0xfee50b7025c36a08ULL, 0x02f236d04753d5b4ULL }, /* 5^59 */
+    { 0x9f4f2726179a2245ULL, 0x01d762422c946590ULL }, /* 5^60 */
+    { 0xc722f0ef9d80aad6ULL, 0x424d3ad2b7b97ef5ULL }, /* 5^61 */
+    { 0xf8ebad2b84e0d58bULL, 0xd2e0898765a7deb2ULL }, /* 5^62 */
+    { 0x9b934c3b330c8577ULL, 0x63cc55f49f88eb2fULL }, /* 5^63 */
+    { 0xc2781f49ffcfa6d5ULL, 0x3cbf6b71c76b25fbULL }  /* 5^64 */
+};
+
+static void cJSON_mul128(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *hi = (uint64_t)(r >> 64);
+    *lo = (uint64_t)r;
+#else
+    uint64_t p0 = (a & 0xffffffff) * (b & 0xffffffff);
+    uint64_t p1 = (a & 0xffffffff) * (b >> 32);
+    uint64_t p2 = (a >> 32) * (b & 0xffffffff);
+    uint64_t mid = (p0 >> 32) + (p1 & 0xffffffff) + (p2 & 0xffffffff);
+    *lo = (mid << 32) | (p0 & 0xffffffff);
+    *hi = ((a >> 32) * (b >> 32)) + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+#endif
+}
+
+static int cJSON_clz64(uint64_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(v);
+#else
+    int n = 0;
+    while (!(v & ((uint64_t)1 << 63))) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* The Eisel-Lemire algorithm: the double nearest to w * 10^q from a 128
+   bit product of w and 5^q. Returns 0 for the rare cases it can't round,
+   and for anything outside the table. w must be non-zero. */
+static int eisel_lemire(uint64_t w, int q, double *result)
+{
+    const uint64_t *pow5;
+    uint64_t hi, lo, hi2, lo2, mantissa, bits;
+    int lz, upperbit, shift, power2;
+
+    if (q < CJSON_POW5_MIN || q > CJSON_POW5_MAX) {
+        return 0;
+    }
+    lz = cJSON_clz64(w);
+    w <<= lz;
+    pow5 = powers_of_five_128[q - CJSON_POW5_MIN];
+    cJSON_mul128(w, pow5[0], &hi, &lo);
+    if ((hi & 0x1ff) == 0x1ff) {
+        /* The low bits of the first product may be short, add the rest */
+        cJSON_mul128(w, pow5[1], &hi2, &lo2);
+        lo += hi2;
+        if (hi2 > lo) {
+            hi++;
+        }
+    }
+
+    upperbit = (int)(hi >> 63);
+    shift = upperbit + 64 - 52 - 3;
+    mantissa = hi >> shift;
+    /* floor(log2(10^q)) + 63 from (217706 * q) >> 16, then the bias */
+    power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023;
+    if (power2 <= 0) {
+        return 0; /* subnormal */
+    }
+    /* Exactly half way, where w * 5^q is small enough to be exact, rounds
+       to even rather than up. */
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+        (mantissa << shift) == hi) {
+        mantissa &= ~(uint64_t)1;
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= ((uint64_t)2 << 52)) {
+        mantissa = (uint64_t)1 << 52;
+        power2++;
+    }
+    mantissa &= ~((uint64_t)1 << 52);
+    if (power2 >= 0x7ff) {
+        return 0; /* infinity */
+    }
+    bits = mantissa | ((uint64_t)power2 << 52);
+    memcpy(result, &bits, sizeof(bits));
+    return 1;
+}
+
+/* Set all three number fields from the double, saturating the integers. */
+static void set_number_double(cJSON *item, double num)
+{
+    item->type &= ~cJSON_IsInt64;
+    item->valuedouble = num;
+    if (num >= 9223372036854775807.0) {
+        item->valueint64 = INT64_MAX;
+    } else if (num <= -9223372036854775808.0) {
+        item->valueint64 = INT64_MIN;
+    } else {
+        item->valueint64 = (int64_t)num;
+    }
+    if (item->valueint64 > INT_MAX) {
+        item->valueint = INT_MAX;
+    } else if (item->valueint64 < INT_MIN) {
+        item->valueint = INT_MIN;
+    } else {
+        item->valueint = (int)item->valueint64;
+    }
+}
+
+static void set_number_int64(cJSON *item, int64_t num)
+{
+    set_number_double(item, (double)num);
+    item->valueint64 = num;
+    item->type |= cJSON_IsInt64;
+}
+
+/* Convert the digits from start to end with strtod, correctly rounded but
+   slow, for what the fast paths can't do. The copy is for the locale's
+   decimal point. */
+static int parse_double(const char *start, const char *end, double *result,
+                        const cJSON_Allocator *allocator)
+{
+    char buffer[64];
+    char *copy = buffer;
+    size_t len = (size_t)(end - start);
+    size_t i;
+
+    if (len >= sizeof(buffer)) {
+        copy = allocator_malloc(allocator, len + 1);
+        if (!copy) {
+            return 0;
+        }
+    }
+    for (i = 0; i < len; i++) {
+        copy[i] = start[i] == '.' ? *localeconv()->decimal_point : start[i];
+    }
+    copy[len] = 0;
+    *result = strtod(copy, NULL);
+    if (copy != buffer) {
+        allocator_free(allocator, copy);
+    }
+    return 1;
+}
+
 /* Parse the input text to generate a number, and populate the result into item. */
-static const char *parse_number(cJSON *item, const char *num)
+static const char *parse_number(cJSON *item, const char *num,
+                                const cJSON_Allocator *allocator)
 {
-    double n = 0, sign = 1, scale = 0;
+    const char *digits;
+    uint64_t mantissa = 0; /* the first 19 significant digits */
+    int ndigits = 0;
+    int exponent = 0; /* of ten, to multiply mantissa by */
+    int exact = 1; /* mantissa has every non-zero digit */
+    int integer = 1; /* no fraction or exponent */
+    int negative = 0;
     int subscale = 0, signsubscale = 1;
+    double n;
 
-    /* Could use sscanf for this? */
     if (*num == '-') {
-        sign = -1, num++; /* Has sign? */
+        negative = 1, num++; /* Has sign? */
     }
+    digits = num;
     if (*num == '0') {
         num++; /* is zero */
     }
-    if (*num >= '1' && *num <= '9') {
-        do {
-            n = (n * 10.0) + (*num++ -'0');
-        } while (*num >= '0' && *num <= '9'); /* Number? */
+    while (*num >= '0' && *num <= '9') {
+        if (ndigits < 19) {
+            mantissa = (mantissa * 10) + (*num - '0');
+            ndigits += (mantissa != 0);
+        } else {
+            exponent++;
+            exact &= (*num == '0');
+        }
+        num++;
     }
     if (*num == '.') {
         num++; /* Fractional part? */
-        do {
-            n = (n * 10.0) + (*num++ -'0'), scale--;
-        } while (*num >= '0' && *num <= '9');
+        integer = 0;
+        while (*num >= '0' && *num <= '9') {
+            if (ndigits < 19) {
+                mantissa = (mantissa * 10) + (*num - '0');
+                ndigits += (mantissa != 0);
+                exponent--;
+            } else {
+                exact &= (*num == '0');
+            }
+            num++;
+        }
     }
     if (*num == 'e' || *num == 'E') { /* Exponent? */
         num++;
+        integer = 0;
         if (*num == '+') {
             num++;
         } else if (*num == '-') {
             signsubscale = -1, num++; /* With sign? */
         }
         while (*num >= '0' && *num <= '9') {
-            subscale = (subscale * 10) + (*num++ - '0'); /* Number? */
+            if (subscale < 100000) {
+                subscale = (subscale * 10) + (*num - '0'); /* Number? */
+            }
+            num++;
         }
+        exponent += subscale * signsubscale;
     }
 
-    n = sign * n * pow(10.0, (scale + subscale * signsubscale)); /* number = +/- number.fraction * 10^+/- exponent */
+    if (integer && exact && exponent == 0 &&
+        mantissa <= (uint64_t)INT64_MAX + negative) {
+        /* An integer, which int64_t holds exactly */
+        if (negative) {
+            set_number_int64(item, mantissa ? -(int64_t)(mantissa - 1) - 1 : 0);
+            if (!mantissa) {
+                item->valuedouble = -0.0;
+            }
+        } else {
+            set_number_int64(item, (int64_t)mantissa);
+        }
+        item->type |= cJSON_Number;
+        return num;
+    }
+
+    if (mantissa == 0) {
+        n = 0;
+#if FLT_EVAL_METHOD == 0
+    } else if (exact && mantissa <= ((uint64_t)1 << 53) &&
+               exponent >= -22 && exponent <= 22) {
+        /* Clinger's fast path: the mantissa and the power of ten are both
+           exact, so one multiply or divide rounds correctly. */
+        if (exponent < 0) {
+            n = (double)mantissa / exact_powers_of_ten[-exponent];
+        } else {
+            n = (double)mantissa * exact_powers_of_ten[exponent];
+        }
+#endif
+    } else if (exact && eisel_lemire(mantissa, exponent, &n)) {
+        /* n is set */
+    } else if (!parse_double(digits, num, &n, allocator)) {
+        return NULL; /* memory fail */
+    }
 
-    item->valuedouble = n;
-    item->valueint = (int)n;
-    item->type = cJSON_Number;
+    set_number_double(item, negative ? -n : n);
+    item->type |= cJSON_Number;
     return num;
 }
 
+/* The printer appends everything to one buffer, which either grows or,
+   for cJSON_PrintToSink, is handed to the sink whenever it fills up. */
+#define CJSON_PRINT_BUFFER 256
+#define CJSON_SINK_BUFFER 4096
+
+typedef struct cJSON_Writer {
+    char *buffer;
+    size_t length;
+    size_t size;
+    cJSON_Sink sink;
+    void *ctx;
+    int fmt;
+    const cJSON_Allocator *allocator; /* of the buffer, without a sink */
+} cJSON_Writer;
+
+static int writer_flush(cJSON_Writer *w)
+{
+    if (w->length && w->sink(w->ctx, w->buffer, w->length) != 0) {
+        return 0;
+    }
+    w->length = 0;
+    return 1;
+}
+
+/* Make room for n more bytes at buffer + length. */
+static char *writer_reserve(cJSON_Writer *w, size_t n)
+{
+    char *bigger;
+    size_t size;
+
+    if (w->size - w->length >= n) {
+        return w->buffer + w->length;
+    }
+    if (w->sink) {
+        if (!writer_flush(w) || n > w->size) {
+            return NULL;
+        }
+        return w->buffer;
+    }
+
+    size = w->size * 2;
+    if (size < w->length + n) {
+        size = w->length + n;
+    }
+    bigger = allocator_malloc(w->allocator, size);
+    if (!bigger) {
+        return NULL;
+    }
+    memcpy(bigger, w->buffer, w->length);
+    allocator_free(w->allocator, w->buffer);
+    w->buffer = bigger;
+    w->size = size;
+    return bigger + w->length;
+}
+
+static int writer_put(cJSON_Writer *w, const char *data, size_t len)
+{
+    char *ptr;
+    if (w->sink && len > w->size) {
+        /* Too big to be worth buffering */
+        return writer_flush(w) && w->sink(w->ctx, data, len) == 0;
+    }
+    ptr = writer_reserve(w, len);
+    if (!ptr) {
+        return 0;
+    }
+    memcpy(ptr, data, len);
+    w->length += len;
+    return 1;
+}
+
+static int writer_putc(cJSON_Writer *w, char c)
+{
+    if (w->length < w->size) {
+        w->buffer[w->length++] = c;
+        return 1;
+    }
+    return writer_put(w, &c, 1);
+}
+
 /* Render the number nicely from the given item into a string. */
-static char *print_number(cJSON *item)
+static int print_number(cJSON_Writer *w, cJSON *item)
 {
-    char *str;
+    /* DBL_MAX is 309 digits with %.0f */
+    char *str = writer_reserve(w, 320);
     double d = item->valuedouble;
-    if (fabs(((double)item->valueint) - d) <= DBL_EPSILON && d <= INT_MAX && d >= INT_MIN) {
-        str = cJSON_malloc(21); /* 2^64+1 can be represented in 21 chars. */
-        sprintf(str, "%d", item->valueint);
+    int len;
+
+    if (!str) {
+        return 0;
+    }
+    if ((item->type & cJSON_IsInt64) && (double)item->valueint64 == d) {
+        /* Integers beyond 2^53 print from the exact value, unless
+           valuedouble has been changed since. A saturated valueint64
+           isn't exact: 2^63 would print as INT64_MAX. */
+        len = sprintf(str, "%" PRId64, item->valueint64);
+    } else if (fabs(((double)item->valueint) - d) <= DBL_EPSILON && d <= INT_MAX && d >= INT_MIN) {
+        len = sprintf(str, "%d", item->valueint);
+    } else if (fabs(floor(d) - d) <= DBL_EPSILON) {
+        len = sprintf(str, "%.0f", d);
+    } else if (fabs(d) < 1.0e-6 || fabs(d) > 1.0e9) {
+        len = sprintf(str, "%e", d);
     } else {
-        str = cJSON_malloc(64); /* This is a nice tradeoff. */
-        if (fabs(floor(d) - d) <= DBL_EPSILON) {
-            sprintf(str, "%.0f", d);
-        } else if (fabs(d) < 1.0e-6 || fabs(d) > 1.0e9) {
-            sprintf(str, "%e", d);
-        } else {
-            sprintf(str, "%f", d);
-        }
+        len = sprintf(str, "%f", d);
     }
-    return str;
+    w->length += len;
+    return 1;
 }
 
 /* Parse the input text into an unescaped cstring, and populate item. */
 static const unsigned char firstByteMark[7] = { 0x00, 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
-static const char *parse_string(cJSON *item, const char *str)
+#ifdef CJSON_SSE2
+static int cJSON_ctz(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return (int)idx;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/* Bit n set if byte n of the block is a quote, a backslash or a control
+   character (which includes the terminating NUL). */
+static unsigned string_special(__m128i block)
+{
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(31);
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(block, quote),
+                                   _mm_cmpeq_epi8(block, backslash));
+    special = _mm_or_si128(special,
+                           _mm_cmpeq_epi8(_mm_min_epu8(block, control), block));
+    return (unsigned)_mm_movemask_epi8(special);
+}
+
+/* Find the first quote, backslash or control character from ptr on, 16
+   bytes at a time. */
+CJSON_NO_SANITIZE_ADDRESS
+static const char *scan_string(const char *ptr)
+{
+    const char *block = (const char *)((size_t)ptr & ~(size_t)15);
+    unsigned mask = string_special(_mm_load_si128((const __m128i *)block));
+
+    mask >>= (ptr - block);
+    if (mask) {
+        return ptr + cJSON_ctz(mask);
+    }
+    for (;;) {
+        block += 16;
+        mask = string_special(_mm_load_si128((const __m128i *)block));
+        if (mask) {
+            return block + cJSON_ctz(mask);
+        }
+    }
+}
+
+/* scan_string for text which ends at end rather than at a NUL. Only
+   whole blocks before end are loaded, the last few bytes are looked at
+   one at a time. Returns end if there's nothing special before it. */
+CJSON_NO_SANITIZE_ADDRESS
+static const char *scan_string_bounded(const char *ptr, const char *end)
+{
+    const char *block = (const char *)((size_t)ptr & ~(size_t)15);
+    unsigned mask;
+
+    for (; end - block >= 16; block += 16) {
+        mask = string_special(_mm_load_si128((const __m128i *)block));
+        if (block < ptr) {
+            mask &= ~0u << (ptr - block);
+        }
+        if (mask) {
+            return block + cJSON_ctz(mask);
+        }
+    }
+    if (ptr < block) {
+        ptr = block;
+    }
+    while (ptr < end && (unsigned char)*ptr > 31 && *ptr != '\"' && *ptr != '\\') {
+        ptr++;
+    }
+    return ptr;
+}
+#else
+static const char *scan_string(const char *ptr)
+{
+    while ((unsigned char)*ptr > 31 && *ptr != '\"' && *ptr != '\\') {
+        ptr++;
+    }
+    return ptr;
+}
+
+static const char *scan_string_bounded(const char *ptr, const char *end)
+{
+    while (ptr < end && (unsigned char)*ptr > 31 && *ptr != '\"' && *ptr != '\\') {
+        ptr++;
+    }
+    return ptr;
+}
+#endif
+
+static const char *parser_scan_string(cJSON_Parser *p, const char *ptr)
+{
+    return p->end ? scan_string_bounded(ptr, p->end) : scan_string(ptr);
+}
+
+static const char *parse_string_ptr(cJSON_Parser *p, char **result,
+                                    const char *str)
 {
     const char *ptr = str + 1;
+    const char *end;
     char *ptr2;
     char *out;
     int len = 0;
@@ -174,24 +1067,48 @@ static const char *parse_string(cJSON *item, const char *str)
         return NULL; /* not a string! */
     }
 
-    while (*ptr != '\"' && (unsigned char)*ptr > 31 && ++len) {
-        if (*ptr++ == '\\') {
-            ptr++; /* Skip escaped quotes. */
+    /* With an end, the scan for the length finds where the string stops
+       before it, so unescaping needn't check. In situ text is always NUL
+       terminated. */
+    if (p->insitu) {
+        /* Unescaping never makes a string longer, so it can be done over
+           the top of the text, with the NUL where the quote was. */
+        out = (char *)str + 1;
+    } else {
+        for (;;) {
+            ptr = parser_scan_string(p, ptr);
+            if (ptr == p->end || (*ptr == '\\' && ptr + 1 == p->end)) {
+                return NULL; /* runs off the end of the text */
+            }
+            if (*ptr != '\\' || !ptr[1]) {
+                break;
+            }
+            ptr += 2; /* Skip escaped quotes. */
         }
-    }
 
-    out = cJSON_malloc(len + 1); /* This is how long we need for the string, roughly. */
-    if (!out) {
-        return NULL;
+        /* This is how long we need for the string, roughly. */
+        out = parser_alloc(p, (size_t)(ptr - str));
+        if (!out) {
+            return NULL;
+        }
     }
 
     ptr = str + 1;
     ptr2 = out;
-    while (*ptr != '\"' && (unsigned char)*ptr > 31) {
+    for (;;) {
+        end = scan_string(ptr);
+        if (ptr2 != ptr) {
+            memmove(ptr2, ptr, (size_t)(end - ptr));
+        }
+        ptr2 += end - ptr;
+        ptr = end;
         if (*ptr != '\\') {
-            *ptr2++ = *ptr++;
+            break;
         } else {
             ptr++;
+            if (!*ptr) {
+                break; /* truncated escape */
+            }
             switch (*ptr) {
             case 'b':
                 *ptr2++ = '\b';
@@ -209,6 +1126,12 @@ static const char *parse_string(cJSON *item, const char *str)
                 *ptr2++ = '\t';
                 break;
             case 'u': /* transcode utf16 to utf8. DOES NOT SUPPORT SURROGATE PAIRS CORRECTLY. */
+                if (!isxdigit((unsigned char)ptr[1]) || !isxdigit((unsigned char)ptr[2]) ||
+                    !isxdigit((unsigned char)ptr[3]) || !isxdigit((unsigned char)ptr[4])) {
+                    *ptr2 = 0;
+                    *result = out;
+                    return NULL; /* truncated or invalid escape */
+                }
                 sscanf(ptr + 1, "%4x", &uc); /* get the unicode char. */
                 len = 3;
                 if (uc < 0x80) {
@@ -238,121 +1161,1106 @@ static const char *parse_string(cJSON *item, const char *str)
             ptr++;
         }
     }
+    if (*ptr != '\"') {
+        /* Unterminated, the allocated string is freed with the tree. */
+        *ptr2 = 0;
+        *result = out;
+        return NULL;
+    }
     *ptr2 = 0;
-    if (*ptr == '\"') {
-        ptr++;
+    *result = out;
+    return ptr + 1;
+}
+
+static const char *parse_string(cJSON_Parser *p, cJSON *item, const char *str)
+{
+    str = parse_string_ptr(p, &item->valuestring, str);
+    if (str) {
+        item->type |= cJSON_String;
+    }
+    return str;
+}
+
+/* Render the cstring provided to an escaped version that can be printed. */
+static int print_string_ptr(cJSON_Writer *w, const char *str)
+{
+    const char *end;
+    char escaped[2];
+
+    if (!str) {
+        return 1;
+    }
+    if (!writer_putc(w, '\"')) {
+        return 0;
+    }
+    for (;;) {
+        end = scan_string(str);
+        if (!writer_put(w, str, (size_t)(end - str))) {
+            return 0;
+        }
+        str = end;
+        if (!*str) {
+            break;
+        }
+        escaped[0] = '\\';
+        switch (*str++) {
+        case '\\':
+            escaped[1] = '\\';
+            break;
+        case '\"':
+            escaped[1] = '\"';
+            break;
+        case '\b':
+            escaped[1] = 'b';
+            break;
+        case '\f':
+            escaped[1] = 'f';
+            break;
+        case '\n':
+            escaped[1] = 'n';
+            break;
+        case '\r':
+            escaped[1] = 'r';
+            break;
+        case '\t':
+            escaped[1] = 't';
+            break;
+        default:
+            continue; /* eviscerate with prejudice. */
+        }
+        if (!writer_put(w, escaped, 2)) {
+            return 0;
+        }
+    }
+    return writer_putc(w, '\"');
+}
+
+/* Predeclare these prototypes. */
+static const char *parse_value(cJSON_Parser *p, cJSON *item, const char *value);
+static int print_value(cJSON_Writer *w, cJSON *item, int depth);
+static const char *parse_array(cJSON_Parser *p, cJSON *item, const char *value);
+static int print_array(cJSON_Writer *w, cJSON *item, int depth);
+static const char *parse_object(cJSON_Parser *p, cJSON *item, const char *value);
+static int print_object(cJSON_Writer *w, cJSON *item, int depth);
+
+#ifdef CJSON_SSE2
+/* Bit n set if byte n of the block isn't whitespace or is the NUL. */
+static unsigned not_space(__m128i block)
+{
+    /* Whitespace is 1 to 32, which is 0 to 31 after subtracting 1 */
+    const __m128i limit = _mm_set1_epi8(31);
+    __m128i moved = _mm_sub_epi8(block, _mm_set1_epi8(1));
+    __m128i space = _mm_cmpeq_epi8(_mm_min_epu8(moved, limit), moved);
+    return ~(unsigned)_mm_movemask_epi8(space) & 0xffff;
+}
+
+/* Skip a run of whitespace 16 bytes at a time, as in pretty-printed
+   text. */
+CJSON_NO_SANITIZE_ADDRESS
+static const char *skip_space(const char *in)
+{
+    const char *block = (const char *)((size_t)in & ~(size_t)15);
+    unsigned mask = not_space(_mm_load_si128((const __m128i *)block));
+
+    mask >>= (in - block);
+    if (mask) {
+        return in + cJSON_ctz(mask);
+    }
+    for (;;) {
+        block += 16;
+        mask = not_space(_mm_load_si128((const __m128i *)block));
+        if (mask) {
+            return block + cJSON_ctz(mask);
+        }
+    }
+}
+#endif
+
+/* Utility to jump whitespace and cr/lf */
+static const char *skip(const char *in)
+{
+    if (!in || !*in || (unsigned char)*in > 32) {
+        return in; /* The usual case, there's none. */
+    }
+#ifdef CJSON_SSE2
+    return skip_space(in + 1);
+#else
+    while (*in && (unsigned char)*in <= 32) {
+        in++;
+    }
+    return in;
+#endif
+}
+
+#ifdef CJSON_SSE2
+/* skip_space for text which ends at end, as scan_string_bounded. */
+CJSON_NO_SANITIZE_ADDRESS
+static const char *skip_space_bounded(const char *in, const char *end)
+{
+    const char *block = (const char *)((size_t)in & ~(size_t)15);
+    unsigned mask;
+
+    for (; end - block >= 16; block += 16) {
+        mask = not_space(_mm_load_si128((const __m128i *)block));
+        if (block < in) {
+            mask &= ~0u << (in - block);
+        }
+        if (mask) {
+            return block + cJSON_ctz(mask);
+        }
+    }
+    if (in < block) {
+        in = block;
+    }
+    while (in < end && *in && (unsigned char)*in <= 32) {
+        in++;
+    }
+    return in;
+}
+#endif
+
+/* What skip returns at the end of text with a length: every parse_
+   function fails on it, as on the NUL at the end of other text. */
+static const char parser_eof[1] = "";
+
+static const char *parser_skip(cJSON_Parser *p, const char *in)
+{
+    if (!p->end || !in) {
+        return skip(in);
+    }
+    if (in < p->end && (!*in || (unsigned char)*in > 32)) {
+        return in;
+    }
+#ifdef CJSON_SSE2
+    in = skip_space_bounded(in, p->end);
+#else
+    while (in < p->end && *in && (unsigned char)*in <= 32) {
+        in++;
+    }
+#endif
+    return in < p->end ? in : parser_eof;
+}
+
+/* Parse an object - create a new root, and populate. */
+cJSON *cJSON_Parse(const char *value)
+{
+    cJSON_Parser p = { NULL, 0, 0, NULL, &hooks_allocator };
+    cJSON *c = cJSON_New_Item();
+    if (!c) {
+        return NULL; /* memory fail */
+    }
+
+    if (!parse_value(&p, c, skip(value))) {
+        cJSON_Delete(c);
+        return NULL;
+    }
+    return c;
+}
+
+cJSON *cJSON_ParseWithAllocator(const char *value, const cJSON_Allocator *allocator)
+{
+    cJSON_Parser p = { NULL, 0, 0, NULL, NULL };
+    cJSON *c;
+
+    p.allocator = allocator;
+    c = parser_new_item(&p);
+    if (!c) {
+        return NULL; /* memory fail */
+    }
+    if (!parse_value(&p, c, skip(value))) {
+        delete_item(c, allocator);
+        return NULL;
+    }
+    return c;
+}
+
+cJSON *cJSON_ParseWithArena(const char *value, cJSON_Arena *arena)
+{
+    cJSON_Parser p;
+    cJSON *c;
+
+    p.arena = arena;
+    p.flags = cJSON_IsArena | cJSON_StringIsConst | cJSON_ValueIsConst;
+    p.insitu = 0;
+    p.keys = NULL;
+    p.allocator = arena ? &arena->allocator : &hooks_allocator;
+    p.end = NULL;
+    p.depth = 0;
+    c = parser_new_item(&p);
+    if (!c) {
+        return NULL; /* memory fail */
+    }
+
+    /* On failure whatever was parsed is left in the arena */
+    if (!parse_value(&p, c, skip(value))) {
+        return NULL;
+    }
+    return c;
+}
+
+cJSON *cJSON_ParseWithKeys(const char *value, cJSON_KeyTable *keys, cJSON_Arena *arena)
+{
+    cJSON_Parser p;
+    cJSON *c;
+
+    p.arena = arena;
+    p.flags = arena ? cJSON_IsArena | cJSON_StringIsConst | cJSON_ValueIsConst : 0;
+    p.insitu = 0;
+    p.keys = keys;
+    p.allocator = arena ? &arena->allocator : &hooks_allocator;
+    p.end = NULL;
+    p.depth = 0;
+    c = parser_new_item(&p);
+    if (!c) {
+        return NULL; /* memory fail */
+    }
+    if (!parse_value(&p, c, skip(value))) {
+        if (!arena) {
+            cJSON_Delete(c);
+        }
+        return NULL;
+    }
+    return c;
+}
+
+cJSON *cJSON_ParseInSitu(char *buffer, cJSON_Arena *arena)
+{
+    cJSON_Parser p;
+    cJSON *c;
+
+    p.arena = arena;
+    p.flags = cJSON_StringIsConst | cJSON_ValueIsConst;
+    if (arena) {
+        p.flags |= cJSON_IsArena;
+    }
+    p.insitu = 1;
+    p.keys = NULL;
+    p.allocator = arena ? &arena->allocator : &hooks_allocator;
+    p.end = NULL;
+    p.depth = 0;
+    c = parser_new_item(&p);
+    if (!c) {
+        return NULL; /* memory fail */
+    }
+
+    if (!parse_value(&p, c, skip(buffer))) {
+        if (!arena) {
+            cJSON_Delete(c);
+        }
+        return NULL;
+    }
+    return c;
+}
+
+cJSON *cJSON_ParseWithLength(const char *value, size_t length, const char **end)
+{
+    cJSON_Parser p = { NULL, 0, 0, NULL, &hooks_allocator, NULL, CJSON_LENGTH_DEPTH };
+    const char *ret;
+    cJSON *c;
+
+    if (end) {
+        *end = NULL;
+    }
+    p.end = value + length;
+    c = cJSON_New_Item();
+    if (!c) {
+        return NULL; /* memory fail */
+    }
+    ret = parse_value(&p, c, parser_skip(&p, value));
+    if (!ret) {
+        cJSON_Delete(c);
+        return NULL;
+    }
+    if (end) {
+        *end = ret;
+    }
+    return c;
+}
+
+/* The pull parser. Chunks of text are read in place, except for the
+   token being read, which is copied to buf so a token split between
+   chunks can be put back together. Keys and strings are unescaped in
+   buf too, so it's as big as the biggest token and the stack has a byte
+   for each open container: nothing grows with the document. */
+#define CJSON_READER_DEPTH 512
+
+#define READER_VALUE 0 /* a value is next */
+#define READER_KEY 1 /* a key is next */
+#define READER_COLON 2 /* the colon after a key is next */
+#define READER_NEXT 3 /* a comma or the end of the container is next */
+#define READER_DONE 4 /* the document is complete */
+
+#define READER_STRING 1
+#define READER_NUMBER 2
+#define READER_LITERAL 3
+
+struct cJSON_Reader {
+    const char *pos; /* what's left of the chunk */
+    const char *end;
+    int last; /* the chunk is the end of the document */
+    int state;
+    int first; /* the container has just been opened, so it may close */
+    int depth;
+    int max_depth;
+    char *stack; /* '{' or '[' for each open container */
+    int token; /* the kind of token in buf, or 0 between tokens */
+    int key; /* the string in buf is a key */
+    int escape; /* the last byte of the string in buf was a backslash */
+    int error;
+    char *buf;
+    size_t len;
+    size_t size;
+};
+
+cJSON_Reader *cJSON_CreateReader(int max_depth)
+{
+    cJSON_Reader *reader = cJSON_calloc(1, sizeof(cJSON_Reader));
+    if (!reader) {
+        return NULL;
+    }
+    reader->max_depth = max_depth > 0 ? max_depth : CJSON_READER_DEPTH;
+    reader->stack = cJSON_malloc((size_t)reader->max_depth);
+    reader->size = 64;
+    reader->buf = cJSON_malloc(reader->size);
+    if (!reader->stack || !reader->buf) {
+        cJSON_DeleteReader(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+void cJSON_DeleteReader(cJSON_Reader *reader)
+{
+    if (reader) {
+        cJSON_free(reader->stack);
+        cJSON_free(reader->buf);
+        cJSON_free(reader);
+    }
+}
+
+void cJSON_ReaderFeed(cJSON_Reader *reader, const char *data, size_t len, int last)
+{
+    reader->pos = data;
+    reader->end = data + len;
+    reader->last = last;
+}
+
+static int reader_fail(cJSON_Reader *reader, cJSON_Token *token)
+{
+    reader->error = 1;
+    token->type = cJSON_TokenError;
+    return cJSON_TokenError;
+}
+
+/* Copy len bytes to buf, keeping room for a NUL */
+static int reader_append(cJSON_Reader *reader, const char *data, size_t len)
+{
+    char *bigger;
+    size_t size = reader->size;
+
+    if (reader->len + len >= size) {
+        while (reader->len + len >= size) {
+            size *= 2;
+        }
+        bigger = cJSON_malloc(size);
+        if (!bigger) {
+            return 0;
+        }
+        memcpy(bigger, reader->buf, reader->len);
+        cJSON_free(reader->buf);
+        reader->buf = bigger;
+        reader->size = size;
+    }
+    memcpy(reader->buf + reader->len, data, len);
+    reader->len += len;
+    return 1;
+}
+
+/* Move the token in progress from the chunk to buf, up to its end if
+   that's in the chunk. Returns 1 if the token is complete, 0 if it needs
+   the next chunk, and -1 on failure. */
+static int reader_scan_token(cJSON_Reader *reader)
+{
+    const char *ptr = reader->pos;
+    const char *end = reader->end;
+    int complete = 0;
+
+    if (reader->token == READER_STRING) {
+        while (ptr < end) {
+            if (reader->escape) {
+                reader->escape = 0;
+            } else if (*ptr == '\\') {
+                reader->escape = 1;
+            } else if (*ptr == '\"') {
+                ptr++;
+                complete = 1;
+                break;
+            }
+            ptr++;
+        }
+    } else if (reader->token == READER_NUMBER) {
+        while (ptr < end && ((*ptr >= '0' && *ptr <= '9') || *ptr == '.' ||
+                             *ptr == 'e' || *ptr == 'E' || *ptr == '+' || *ptr == '-')) {
+            ptr++;
+        }
+        complete = ptr < end || reader->last;
+    } else {
+        while (ptr < end && *ptr >= 'a' && *ptr <= 'z') {
+            ptr++;
+        }
+        complete = ptr < end || reader->last;
+    }
+
+    if (!reader_append(reader, reader->pos, (size_t)(ptr - reader->pos))) {
+        return -1;
+    }
+    reader->pos = ptr;
+    if (!complete && reader->last) {
+        return -1; /* an unterminated string */
+    }
+    return complete;
+}
+
+/* A value has been read, what comes after it? */
+static void reader_value_done(cJSON_Reader *reader)
+{
+    reader->state = reader->depth ? READER_NEXT : READER_DONE;
+}
+
+/* Decode the complete token in buf. */
+static int reader_finish_token(cJSON_Reader *reader, cJSON_Token *token)
+{
+    cJSON_Parser p = { NULL, 0, 1, NULL, &hooks_allocator };
+    cJSON number;
+    const char *end;
+    char *str;
+    int kind = reader->token;
+
+    reader->token = 0;
+    reader->buf[reader->len] = 0;
+    if (kind == READER_STRING) {
+        end = parse_string_ptr(&p, &str, reader->buf);
+        if (end != reader->buf + reader->len) {
+            return reader_fail(reader, token);
+        }
+        token->type = reader->key ? cJSON_TokenKey : cJSON_TokenString;
+        token->string = str;
+        token->length = strlen(str);
+        if (reader->key) {
+            reader->state = READER_COLON;
+        } else {
+            reader_value_done(reader);
+        }
+        return token->type;
+    }
+
+    if (kind == READER_NUMBER) {
+        memset(&number, 0, sizeof(number));
+        end = parse_number(&number, reader->buf, &hooks_allocator);
+        if (end != reader->buf + reader->len) {
+            return reader_fail(reader, token);
+        }
+        token->type = cJSON_TokenNumber;
+        token->valuedouble = number.valuedouble;
+        token->valueint64 = number.valueint64;
+    } else if (!strcmp(reader->buf, "true")) {
+        token->type = cJSON_TokenTrue;
+    } else if (!strcmp(reader->buf, "false")) {
+        token->type = cJSON_TokenFalse;
+    } else if (!strcmp(reader->buf, "null")) {
+        token->type = cJSON_TokenNull;
+    } else {
+        return reader_fail(reader, token);
+    }
+    reader_value_done(reader);
+    return token->type;
+}
+
+static int reader_start_token(cJSON_Reader *reader, int kind, cJSON_Token *token)
+{
+    int ret;
+
+    reader->token = kind;
+    reader->key = reader->state == READER_KEY;
+    reader->escape = 0;
+    reader->len = 0;
+    if (kind == READER_STRING) {
+        reader_append(reader, "\"", 1); /* fits in the initial size */
+        reader->pos++;
+    }
+    ret = reader_scan_token(reader);
+    if (ret < 0) {
+        return reader_fail(reader, token);
+    }
+    if (ret == 0) {
+        token->type = cJSON_TokenNeedMore;
+        return cJSON_TokenNeedMore;
+    }
+    return reader_finish_token(reader, token);
+}
+
+static int reader_close(cJSON_Reader *reader, cJSON_Token *token)
+{
+    reader->pos++;
+    reader->depth--;
+    token->type = reader->stack[reader->depth] == '{' ?
+                  cJSON_TokenEndObject : cJSON_TokenEndArray;
+    reader_value_done(reader);
+    return token->type;
+}
+
+int cJSON_ReaderNext(cJSON_Reader *reader, cJSON_Token *token)
+{
+    char c;
+    char top;
+    int ret;
+
+    if (reader->error) {
+        return reader_fail(reader, token);
+    }
+    if (reader->token) {
+        ret = reader_scan_token(reader);
+        if (ret < 0) {
+            return reader_fail(reader, token);
+        }
+        if (ret == 0) {
+            token->type = cJSON_TokenNeedMore;
+            return cJSON_TokenNeedMore;
+        }
+        return reader_finish_token(reader, token);
+    }
+
+    for (;;) {
+        while (reader->pos < reader->end && *reader->pos && (unsigned char)*reader->pos <= 32) {
+            reader->pos++;
+        }
+        if (reader->pos == reader->end) {
+            if (!reader->last) {
+                token->type = cJSON_TokenNeedMore;
+            } else if (reader->state == READER_DONE) {
+                token->type = cJSON_TokenEnd;
+            } else {
+                return reader_fail(reader, token); /* truncated */
+            }
+            return token->type;
+        }
+
+        c = *reader->pos;
+        top = reader->depth ? reader->stack[reader->depth - 1] : 0;
+        switch (reader->state) {
+        case READER_COLON:
+            if (c != ':') {
+                return reader_fail(reader, token);
+            }
+            reader->pos++;
+            reader->state = READER_VALUE;
+            reader->first = 0;
+            continue;
+
+        case READER_NEXT:
+            if (c == ',') {
+                reader->pos++;
+                reader->state = top == '{' ? READER_KEY : READER_VALUE;
+                reader->first = 0;
+                continue;
+            }
+            if (c == (top == '{' ? '}' : ']')) {
+                return reader_close(reader, token);
+            }
+            return reader_fail(reader, token);
+
+        case READER_KEY:
+            if (c == '}' && reader->first) {
+                return reader_close(reader, token);
+            }
+            if (c != '\"') {
+                return reader_fail(reader, token);
+            }
+            return reader_start_token(reader, READER_STRING, token);
+
+        case READER_VALUE:
+            if (c == ']' && reader->first && top == '[') {
+                return reader_close(reader, token);
+            }
+            if (c == '{' || c == '[') {
+                if (reader->depth == reader->max_depth) {
+                    return reader_fail(reader, token);
+                }
+                reader->stack[reader->depth++] = c;
+                reader->pos++;
+                reader->state = c == '{' ? READER_KEY : READER_VALUE;
+                reader->first = 1;
+                token->type = c == '{' ? cJSON_TokenStartObject : cJSON_TokenStartArray;
+                return token->type;
+            }
+            if (c == '\"') {
+                return reader_start_token(reader, READER_STRING, token);
+            }
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                return reader_start_token(reader, READER_NUMBER, token);
+            }
+            if (c >= 'a' && c <= 'z') {
+                return reader_start_token(reader, READER_LITERAL, token);
+            }
+            return reader_fail(reader, token);
+
+        default:
+            return reader_fail(reader, token); /* trailing garbage */
+        }
+    }
+}
+
+/* The tape: a read-only tree in three arrays. Each value is one 64-bit
+   entry, its type in the top byte and the rest the offset of its string
+   in the string pool, the index of its number in the number array or,
+   for an array or object, the index of its end entry, which holds the
+   number of items. Every member of an object is a key entry followed by
+   the value. So an item's size on the tape is known from its first
+   entry and walking it is a scan through memory. */
+#define TAPE_KEY 7
+#define TAPE_END 8
+#define TAPE_SHIFT 56
+#define TAPE_PAYLOAD ((((uint64_t)1) << TAPE_SHIFT) - 1)
+/* A number stored as an int64_t rather than as a double */
+#define TAPE_INT64 (((uint64_t)1) << (TAPE_SHIFT - 1))
+
+struct cJSON_Tape {
+    uint64_t *entries;
+    size_t count;
+    size_t capacity;
+    uint64_t *numbers;
+    size_t nnumbers;
+    size_t numbers_capacity;
+    char *strings;
+    size_t length;
+};
+
+/* Make room for one more in an array which grows by doubling. */
+static int tape_grow(uint64_t **array, size_t count, size_t *capacity)
+{
+    uint64_t *bigger;
+    size_t size;
+
+    if (count < *capacity) {
+        return 1;
+    }
+    size = *capacity ? *capacity * 2 : 64;
+    bigger = cJSON_malloc(size * sizeof(uint64_t));
+    if (!bigger) {
+        return 0;
+    }
+    if (count) {
+        memcpy(bigger, *array, count * sizeof(uint64_t));
+    }
+    cJSON_free(*array);
+    *array = bigger;
+    *capacity = size;
+    return 1;
+}
+
+static int tape_append(cJSON_Tape *tape, int type, uint64_t payload)
+{
+    if (!tape_grow(&tape->entries, tape->count, &tape->capacity)) {
+        return 0;
+    }
+    tape->entries[tape->count++] = ((uint64_t)type << TAPE_SHIFT) | payload;
+    return 1;
+}
+
+/* Unescape a string into the pool, which has room for all of the text.
+   The raw string goes in first and is unescaped in place. */
+static const char *tape_parse_string(cJSON_Tape *tape, int type, const char *str)
+{
+    cJSON_Parser p = { NULL, 0, 1, NULL, &hooks_allocator };
+    const char *end = str + 1;
+    const char *after;
+    char *copy = tape->strings + tape->length;
+    char *result;
+
+    if (*str != '\"') {
+        return NULL;
+    }
+    for (;;) {
+        end = scan_string(end);
+        if (*end != '\\' || !end[1]) {
+            break;
+        }
+        end += 2;
+    }
+    memcpy(copy, str, (size_t)(end - str) + 1);
+    copy[end - str + 1] = 0;
+
+    after = parse_string_ptr(&p, &result, copy);
+    if (!after || !tape_append(tape, type, (uint64_t)(result - tape->strings))) {
+        return NULL;
+    }
+    tape->length = (size_t)(result - tape->strings) + strlen(result) + 1;
+    return str + (after - copy);
+}
+
+static const char *tape_parse_number(cJSON_Tape *tape, const char *num)
+{
+    cJSON item;
+    double exact;
+    uint64_t bits;
+    uint64_t flag = 0;
+
+    memset(&item, 0, sizeof(item));
+    num = parse_number(&item, num, &hooks_allocator);
+    if (!num || !tape_grow(&tape->numbers, tape->nnumbers, &tape->numbers_capacity)) {
+        return NULL;
+    }
+    /* An integer is kept as one if that loses nothing, -0 included */
+    exact = (double)item.valueint64;
+    if (!memcmp(&exact, &item.valuedouble, sizeof(double))) {
+        bits = (uint64_t)item.valueint64;
+        flag = TAPE_INT64;
+    } else {
+        memcpy(&bits, &item.valuedouble, sizeof(double));
+    }
+    tape->numbers[tape->nnumbers] = bits;
+    if (!tape_append(tape, cJSON_Number, flag | tape->nnumbers++)) {
+        return NULL;
+    }
+    return num;
+}
+
+/* The same grammar as parse_value, parse_array and parse_object. */
+static const char *tape_parse_value(cJSON_Tape *tape, const char *value)
+{
+    size_t start = tape->count;
+    uint64_t items = 0;
+    int type;
+    char close;
+
+    if (!value) {
+        return NULL;
+    }
+    if (*value == '\"') {
+        return tape_parse_string(tape, cJSON_String, value);
+    }
+    if (*value == '-' || (*value >= '0' && *value <= '9')) {
+        return tape_parse_number(tape, value);
+    }
+    if (!strncmp(value, "null", 4)) {
+        return tape_append(tape, cJSON_NULL, 0) ? value + 4 : NULL;
+    }
+    if (!strncmp(value, "false", 5)) {
+        return tape_append(tape, cJSON_False, 0) ? value + 5 : NULL;
+    }
+    if (!strncmp(value, "true", 4)) {
+        return tape_append(tape, cJSON_True, 0) ? value + 4 : NULL;
+    }
+    if (*value == '[') {
+        type = cJSON_Array;
+        close = ']';
+    } else if (*value == '{') {
+        type = cJSON_Object;
+        close = '}';
+    } else {
+        return NULL; /* failure. */
+    }
+
+    if (!tape_append(tape, type, 0)) {
+        return NULL;
+    }
+    value = skip(value + 1);
+    if (*value != close) {
+        for (;;) {
+            if (type == cJSON_Object) {
+                value = skip(tape_parse_string(tape, TAPE_KEY, skip(value)));
+                if (!value || *value != ':') {
+                    return NULL;
+                }
+                value++;
+            }
+            value = skip(tape_parse_value(tape, skip(value)));
+            if (!value) {
+                return NULL;
+            }
+            items++;
+            if (*value != ',') {
+                break;
+            }
+            value++;
+        }
+        if (*value != close) {
+            return NULL; /* malformed. */
+        }
+    }
+
+    tape->entries[start] |= tape->count;
+    return tape_append(tape, TAPE_END, items) ? value + 1 : NULL;
+}
+
+/* Give back the spare room at the end of an array. */
+static void *tape_shrink(void *array, size_t size)
+{
+    void *exact;
+
+    if (!size) {
+        cJSON_free(array);
+        return NULL;
+    }
+    exact = cJSON_malloc(size);
+    if (!exact) {
+        return array;
+    }
+    memcpy(exact, array, size);
+    cJSON_free(array);
+    return exact;
+}
+
+cJSON_Tape *cJSON_ParseTape(const char *value)
+{
+    cJSON_Tape *tape = cJSON_calloc(1, sizeof(cJSON_Tape));
+
+    if (!tape) {
+        return NULL;
+    }
+    /* The raw strings never take more room than the whole text, plus the
+       NUL after the last one */
+    tape->strings = cJSON_malloc(strlen(value) + 2);
+    if (!tape->strings || !tape_parse_value(tape, skip(value))) {
+        cJSON_DeleteTape(tape);
+        return NULL;
+    }
+    tape->entries = tape_shrink(tape->entries, tape->count * sizeof(uint64_t));
+    tape->numbers = tape_shrink(tape->numbers, tape->nnumbers * sizeof(uint64_t));
+    tape->strings = tape_shrink(tape->strings, tape->length);
+    return tape;
+}
+
+void cJSON_DeleteTape(cJSON_Tape *tape)
+{
+    if (tape) {
+        cJSON_free(tape->entries);
+        cJSON_free(tape->numbers);
+        cJSON_free(tape->strings);
+        cJSON_free(tape);
+    }
+}
+
+size_t cJSON_TapeSize(const cJSON_Tape *tape)
+{
+    return sizeof(cJSON_Tape) + tape->length +
+           (tape->count + tape->nnumbers) * sizeof(uint64_t);
+}
+
+static int tape_type(const cJSON_Tape *tape, size_t item)
+{
+    return (int)(tape->entries[item] >> TAPE_SHIFT);
+}
+
+static uint64_t tape_payload(const cJSON_Tape *tape, size_t item)
+{
+    return tape->entries[item] & TAPE_PAYLOAD;
+}
+
+/* The entry after the whole of an item. */
+static size_t tape_skip(const cJSON_Tape *tape, size_t item)
+{
+    int type = tape_type(tape, item);
+    if (type == cJSON_Array || type == cJSON_Object) {
+        return (size_t)tape_payload(tape, item) + 1;
+    }
+    return item + 1;
+}
+
+static int tape_is_container(const cJSON_Tape *tape, size_t item)
+{
+    int type;
+    if (item == cJSON_TapeNone) {
+        return 0;
     }
-    item->valuestring = out;
-    item->type = cJSON_String;
-    return ptr;
+    type = tape_type(tape, item);
+    return type == cJSON_Array || type == cJSON_Object;
 }
 
-/* Render the cstring provided to an escaped version that can be printed. */
-static char *print_string_ptr(const char *str)
+int cJSON_TapeType(const cJSON_Tape *tape, size_t item)
 {
-    const char *ptr;
-    char *ptr2, *out;
-    int len = 0;
+    return item == cJSON_TapeNone ? -1 : tape_type(tape, item);
+}
 
-    if (!str) {
-        return cJSON_strdup("");
+size_t cJSON_TapeChild(const cJSON_Tape *tape, size_t item)
+{
+    if (!tape_is_container(tape, item) || tape_payload(tape, item) == item + 1) {
+        return cJSON_TapeNone;
     }
-    ptr = str;
-    while (*ptr && ++len) {
-        if ((unsigned char)*ptr < 32 || *ptr == '\"' || *ptr == '\\') {
-            len++;
-        }
-        ptr++;
+    /* Step over the key of an object's first member */
+    return tape_type(tape, item) == cJSON_Object ? item + 2 : item + 1;
+}
+
+size_t cJSON_TapeNext(const cJSON_Tape *tape, size_t item)
+{
+    if (item == cJSON_TapeNone) {
+        return cJSON_TapeNone;
+    }
+    item = tape_skip(tape, item);
+    switch (tape_type(tape, item)) {
+    case TAPE_END:
+        return cJSON_TapeNone;
+    case TAPE_KEY:
+        return item + 1;
+    default:
+        return item;
     }
+}
 
-    out = cJSON_malloc(len + 3);
-    ptr2 = out;
-    ptr = str;
-    *ptr2++ = '\"';
-    while (*ptr) {
-        if ((unsigned char)*ptr > 31 && *ptr != '\"' && *ptr != '\\') {
-            *ptr2++ = *ptr++;
-        } else {
-            *ptr2++ = '\\';
-            switch (*ptr++) {
-            case '\\':
-                *ptr2++ = '\\';
-                break;
-            case '\"':
-                *ptr2++ = '\"';
-                break;
-            case '\b':
-                *ptr2++ = 'b';
-                break;
-            case '\f':
-                *ptr2++ = 'f';
-                break;
-            case '\n':
-                *ptr2++ = 'n';
-                break;
-            case '\r':
-                *ptr2++ = 'r';
-                break;
-            case '\t':
-                *ptr2++ = 't';
-                break;
-            default:
-                ptr2--;
-                break; /* eviscerate with prejudice. */
-            }
-        }
+const char *cJSON_TapeGetName(const cJSON_Tape *tape, size_t item)
+{
+    if (item == cJSON_TapeNone || item == 0 || tape_type(tape, item - 1) != TAPE_KEY) {
+        return NULL;
     }
-    *ptr2++ = '\"';
-    *ptr2++ = 0;
-    return out;
+    return tape->strings + tape_payload(tape, item - 1);
 }
-/* Invote print_string_ptr (which is useful) on an item. */
-static char *print_string(cJSON *item)
+
+const char *cJSON_TapeGetString(const cJSON_Tape *tape, size_t item)
 {
-    return print_string_ptr(item->valuestring);
+    if (item == cJSON_TapeNone || tape_type(tape, item) != cJSON_String) {
+        return NULL;
+    }
+    return tape->strings + tape_payload(tape, item);
 }
 
-/* Predeclare these prototypes. */
-static const char *parse_value(cJSON *item, const char *value);
-static char *print_value(cJSON *item, int depth, int fmt);
-static const char *parse_array(cJSON *item, const char *value);
-static char *print_array(cJSON *item, int depth, int fmt);
-static const char *parse_object(cJSON *item, const char *value);
-static char *print_object(cJSON *item, int depth, int fmt);
+double cJSON_TapeGetNumber(const cJSON_Tape *tape, size_t item)
+{
+    uint64_t payload;
+    double value;
 
-/* Utility to jump whitespace and cr/lf */
-static const char *skip(const char *in)
+    if (item == cJSON_TapeNone || tape_type(tape, item) != cJSON_Number) {
+        return 0;
+    }
+    payload = tape_payload(tape, item);
+    if (payload & TAPE_INT64) {
+        return (double)(int64_t)tape->numbers[payload & ~TAPE_INT64];
+    }
+    memcpy(&value, &tape->numbers[payload], sizeof(double));
+    return value;
+}
+
+int64_t cJSON_TapeGetInt64(const cJSON_Tape *tape, size_t item)
 {
-    while (in && (unsigned char)*in <= 32) {
-        in++;
+    uint64_t payload;
+    cJSON number;
+
+    if (item == cJSON_TapeNone || tape_type(tape, item) != cJSON_Number) {
+        return 0;
     }
-    return in;
+    payload = tape_payload(tape, item);
+    if (payload & TAPE_INT64) {
+        return (int64_t)tape->numbers[payload & ~TAPE_INT64];
+    }
+    number.type = cJSON_Number;
+    set_number_double(&number, cJSON_TapeGetNumber(tape, item));
+    return number.valueint64;
 }
 
-/* Parse an object - create a new root, and populate. */
-cJSON *cJSON_Parse(const char *value)
+int cJSON_TapeGetArraySize(const cJSON_Tape *tape, size_t array)
 {
-    cJSON *c = cJSON_New_Item();
-    if (!c) {
-        return NULL; /* memory fail */
+    if (!tape_is_container(tape, array)) {
+        return 0;
     }
+    return (int)tape_payload(tape, (size_t)tape_payload(tape, array));
+}
 
-    if (!parse_value(c, skip(value))) {
-        cJSON_Delete(c);
-        return NULL;
+size_t cJSON_TapeGetArrayItem(const cJSON_Tape *tape, size_t array, int item)
+{
+    size_t c = cJSON_TapeChild(tape, array);
+    while (c != cJSON_TapeNone && item > 0) {
+        item--, c = cJSON_TapeNext(tape, c);
     }
     return c;
 }
 
+static size_t tape_lookup(const cJSON_Tape *tape, size_t object,
+                          const char *string, int case_sensitive)
+{
+    size_t c;
+    const char *name;
+
+    if (!string || cJSON_TapeType(tape, object) != cJSON_Object) {
+        return cJSON_TapeNone;
+    }
+    for (c = cJSON_TapeChild(tape, object); c != cJSON_TapeNone;
+         c = cJSON_TapeNext(tape, c)) {
+        name = tape->strings + tape_payload(tape, c - 1);
+        if (case_sensitive ? !strcmp(name, string) : !cJSON_strcasecmp(name, string)) {
+            return c;
+        }
+    }
+    return cJSON_TapeNone;
+}
+
+size_t cJSON_TapeGetObjectItem(const cJSON_Tape *tape, size_t object,
+                               const char *string)
+{
+    return tape_lookup(tape, object, string, 0);
+}
+
+size_t cJSON_TapeGetObjectItemCaseSensitive(const cJSON_Tape *tape,
+                                            size_t object, const char *string)
+{
+    return tape_lookup(tape, object, string, 1);
+}
+
 /* Render a cJSON item/entity/structure to text. */
+static char *print_buffered(cJSON *item, int fmt, const cJSON_Allocator *allocator)
+{
+    cJSON_Writer w;
+
+    if (!item) {
+        return NULL;
+    }
+    memset(&w, 0, sizeof(w));
+    w.fmt = fmt;
+    w.allocator = allocator;
+    w.size = CJSON_PRINT_BUFFER;
+    w.buffer = allocator_malloc(allocator, w.size);
+    if (!w.buffer) {
+        return NULL;
+    }
+    if (!print_value(&w, item, 0) || !writer_putc(&w, 0)) {
+        allocator_free(allocator, w.buffer);
+        return NULL;
+    }
+    return w.buffer;
+}
+
 char *cJSON_Print(cJSON *item)
 {
-    return print_value(item, 0, 1);
+    return print_buffered(item, 1, &hooks_allocator);
 }
 
 char *cJSON_PrintUnformatted(cJSON *item)
 {
-    return print_value(item, 0, 0);
+    return print_buffered(item, 0, &hooks_allocator);
+}
+
+char *cJSON_PrintWithAllocator(cJSON *item, int fmt, const cJSON_Allocator *allocator)
+{
+    return print_buffered(item, fmt, allocator);
+}
+
+int cJSON_PrintToSink(cJSON *item, int fmt, cJSON_Sink sink, void *ctx)
+{
+    char buffer[CJSON_SINK_BUFFER];
+    cJSON_Writer w;
+
+    if (!item) {
+        return -1;
+    }
+    w.buffer = buffer;
+    w.length = 0;
+    w.size = sizeof(buffer);
+    w.sink = sink;
+    w.ctx = ctx;
+    w.fmt = fmt;
+    w.allocator = NULL;
+    if (!print_value(&w, item, 0) || !writer_flush(&w)) {
+        return -1;
+    }
+    return 0;
 }
 
 void cJSON_Free(char *ptr)
@@ -361,33 +2269,87 @@ void cJSON_Free(char *ptr)
 }
 
 /* Parser core - when encountering text, process appropriately. */
-static const char *parse_value(cJSON *item, const char *value)
+/* A number which may run up to the end of the text: parse_number reads
+   up to the first character which can't be part of one, so if there's
+   none before the end it parses a NUL terminated copy. */
+static const char *parse_number_bounded(cJSON_Parser *p, cJSON *item, const char *num)
+{
+    char buffer[64];
+    char *copy = buffer;
+    const char *ptr = num;
+    size_t len;
+
+    while (ptr < p->end && ((*ptr >= '0' && *ptr <= '9') || *ptr == '.' ||
+                            *ptr == 'e' || *ptr == 'E' || *ptr == '+' || *ptr == '-')) {
+        ptr++;
+    }
+    if (ptr < p->end) {
+        return parse_number(item, num, p->allocator);
+    }
+
+    len = (size_t)(ptr - num);
+    if (len >= sizeof(buffer)) {
+        copy = allocator_malloc(p->allocator, len + 1);
+        if (!copy) {
+            return NULL;
+        }
+    }
+    memcpy(copy, num, len);
+    copy[len] = 0;
+    ptr = parse_number(item, copy, p->allocator);
+    if (copy != buffer) {
+        allocator_free(p->allocator, copy);
+    }
+    return ptr ? num + (ptr - copy) : NULL;
+}
+
+static int parse_literal(cJSON_Parser *p, const char *value, const char *literal, size_t len)
+{
+    if (p->end && (size_t)(p->end - value) < len) {
+        return 0;
+    }
+    return !strncmp(value, literal, len);
+}
+
+static const char *parse_value(cJSON_Parser *p, cJSON *item, const char *value)
 {
+    const char *ret;
+
     if (!value) {
         return NULL; /* Fail on null. */
     }
     if (*value == '\"') {
-        return parse_string(item, value);
+        return parse_string(p, item, value);
     }
     if (*value == '-' || (*value >= '0' && *value <= '9')) {
-        return parse_number(item, value);
-    }
-    if (*value == '[') {
-        return parse_array(item, value);
+        if (p->end) {
+            return parse_number_bounded(p, item, value);
+        }
+        return parse_number(item, value, p->allocator);
     }
-    if (*value == '{') {
-        return parse_object(item, value);
+    if (*value == '[' || *value == '{') {
+        if (p->end && p->depth == 0) {
+            return NULL; /* nested too deep */
+        }
+        p->depth--;
+        if (*value == '[') {
+            ret = parse_array(p, item, value);
+        } else {
+            ret = parse_object(p, item, value);
+        }
+        p->depth++;
+        return ret;
     }
-    if (!strncmp(value, "null", 4)) {
-        item->type = cJSON_NULL;
+    if (parse_literal(p, value, "null", 4)) {
+        item->type |= cJSON_NULL;
         return value + 4;
     }
-    if (!strncmp(value, "false", 5)) {
-        item->type = cJSON_False;
+    if (parse_literal(p, value, "false", 5)) {
+        item->type |= cJSON_False;
         return value + 5;
     }
-    if (!strncmp(value, "true", 4)) {
-        item->type = cJSON_True;
+    if (parse_literal(p, value, "true", 4)) {
+        item->type |= cJSON_True;
         item->valueint = 1;
         return value + 4;
     }
@@ -396,70 +2358,59 @@ static const char *parse_value(cJSON *item, const char *value)
 }
 
 /* Render a value to text. */
-static char *print_value(cJSON *item, int depth, int fmt)
+static int print_value(cJSON_Writer *w, cJSON *item, int depth)
 {
-    char *out = 0;
-    if (!item) {
-        return NULL;
-    }
     switch ((item->type) & 255) {
     case cJSON_NULL:
-        out = cJSON_strdup("null");
-        break;
+        return writer_put(w, "null", 4);
     case cJSON_False:
-        out = cJSON_strdup("false");
-        break;
+        return writer_put(w, "false", 5);
     case cJSON_True:
-        out = cJSON_strdup("true");
-        break;
+        return writer_put(w, "true", 4);
     case cJSON_Number:
-        out = print_number(item);
-        break;
+        return print_number(w, item);
     case cJSON_String:
-        out = print_string(item);
-        break;
+        return print_string_ptr(w, item->valuestring);
     case cJSON_Array:
-        out = print_array(item, depth, fmt);
-        break;
+        return print_array(w, item, depth);
     case cJSON_Object:
-        out = print_object(item, depth, fmt);
-        break;
+        return print_object(w, item, depth);
     }
-    return out;
+    return 0;
 }
 
 /* Build an array from input text. */
-static const char *parse_array(cJSON *item, const char *value)
+static const char *parse_array(cJSON_Parser *p, cJSON *item, const char *value)
 {
     cJSON *child;
     if (*value != '[') {
         return NULL; /* not an array! */
     }
 
-    item->type = cJSON_Array;
-    value = skip(value + 1);
+    item->type |= cJSON_Array;
+    value = parser_skip(p, value + 1);
     if (*value == ']') {
         return value + 1; /* empty array. */
     }
 
-    item->child = child = cJSON_New_Item();
+    item->child = child = parser_new_item(p);
     if (!item->child) {
         return NULL; /* memory fail */
     }
-    value = skip(parse_value(child, skip(value))); /* skip any spacing, get the value. */
+    value = parser_skip(p, parse_value(p, child, parser_skip(p, value))); /* skip any spacing, get the value. */
     if (!value) {
         return NULL;
     }
 
     while (*value == ',') {
         cJSON *new_item;
-        if (!(new_item = cJSON_New_Item())) {
+        if (!(new_item = parser_new_item(p))) {
             return NULL; /* memory fail */
         }
         child->next = new_item;
         new_item->prev = child;
         child = new_item;
-        value = skip(parse_value(child, skip(value + 1)));
+        value = parser_skip(p, parse_value(p, child, parser_skip(p, value + 1)));
         if (!value) {
             return NULL; /* memory fail */
         }
@@ -472,124 +2423,108 @@ static const char *parse_array(cJSON *item, const char *value)
 }
 
 /* Render an array to text */
-static char *print_array(cJSON *item, int depth, int fmt)
+static int print_array(cJSON_Writer *w, cJSON *item, int depth)
 {
-    char **entries;
-    char *out = 0, *ptr, *ret;
-    size_t len = 5;
     cJSON *child = item->child;
-    int numentries = 0, i = 0, fail = 0;
 
-    /* How many entries in the array? */
-    while (child) {
-        numentries++, child = child->next;
-    }
-    /* Allocate an array to hold the values for each */
-    entries = cJSON_calloc(numentries, sizeof(char *));
-    if (!entries) {
-        return NULL;
+    if (!writer_putc(w, '[')) {
+        return 0;
     }
-    /* Retrieve all the results: */
-    child = item->child;
-    while (child && !fail) {
-        ret = print_value(child, depth + 1, fmt);
-        entries[i++] = ret;
-        if (ret) {
-            len += (int)strlen(ret) + 2 + (fmt ? 1 : 0);
-        } else {
-            fail = 1;
+    while (child) {
+        if (!print_value(w, child, depth + 1)) {
+            return 0;
         }
         child = child->next;
+        if (child && !writer_put(w, ", ", w->fmt ? 2 : 1)) {
+            return 0;
+        }
     }
+    return writer_putc(w, ']');
+}
 
-    /* If we didn't fail, try to malloc the output string */
-    if (!fail) {
-        out = cJSON_malloc(len);
-    }
-    /* If that fails, we fail. */
-    if (!out) {
-        fail = 1;
+/* Parse an object member's name, taking it from the key table if there
+   is one. A name without escapes is looked up straight from the text. */
+static const char *parse_key(cJSON_Parser *p, cJSON *item, const char *str)
+{
+    cJSON_Parser heap = { NULL, 0, 0, NULL, NULL };
+    const char *end;
+    char *name = NULL;
+
+    if (!p->keys || !str || *str != '\"') {
+        return parse_string_ptr(p, &item->string, str);
+    }
+    end = parser_scan_string(p, str + 1);
+    if (end != p->end && *end == '\"') {
+        item->string = (char *)keys_intern(p->keys, str + 1, (size_t)(end - str - 1));
+        if (item->string) {
+            item->type |= cJSON_StringIsConst;
+            return end + 1;
+        }
+        return parse_string_ptr(p, &item->string, str); /* the table is full */
     }
 
-    /* Handle failure. */
-    if (fail) {
-        for (i = 0; i < numentries; i++) {
-            if (entries[i]) {
-                cJSON_free(entries[i]);
-            }
-        }
-        cJSON_free(entries);
+    heap.allocator = p->allocator;
+    heap.end = p->end;
+    end = parse_string_ptr(&heap, &name, str);
+    if (!end) {
+        allocator_free(p->allocator, name); /* set by a bad string too */
         return NULL;
     }
-
-    /* Compose the output array. */
-    *out = '[';
-    ptr = out + 1;
-    *ptr = 0;
-    for (i = 0; i < numentries; i++) {
-        strcpy(ptr, entries[i]);
-        ptr += strlen(entries[i]);
-        if (i != numentries - 1) {
-            *ptr++ = ',';
-            if (fmt) {
-                *ptr++ = ' ';
-            }*ptr = 0;
-        }
-        cJSON_free(entries[i]);
+    item->string = (char *)keys_intern(p->keys, name, strlen(name));
+    allocator_free(p->allocator, name);
+    if (item->string) {
+        item->type |= cJSON_StringIsConst;
+        return end;
     }
-    cJSON_free(entries);
-    *ptr++ = ']';
-    *ptr++ = 0;
-    return out;
+    return parse_string_ptr(p, &item->string, str);
 }
 
 /* Build an object from the text. */
-static const char *parse_object(cJSON *item, const char *value)
+static const char *parse_object(cJSON_Parser *p, cJSON *item, const char *value)
 {
     cJSON *child;
     if (*value != '{') {
         return NULL; /* not an object! */
     }
 
-    item->type = cJSON_Object;
-    value = skip(value + 1);
+    item->type |= cJSON_Object;
+    value = parser_skip(p, value + 1);
     if (*value == '}') {
         return value + 1; /* empty array. */
     }
 
-    item->child = child = cJSON_New_Item();
-    value = skip(parse_string(child, skip(value)));
+    item->child = child = parser_new_item(p);
+    if (!item->child) {
+        return NULL; /* memory fail */
+    }
+    value = parser_skip(p, parse_key(p, child, parser_skip(p, value)));
     if (!value) {
         return NULL;
     }
-    child->string = child->valuestring;
-    child->valuestring = 0;
     if (*value != ':') {
         return NULL; /* fail! */
     }
-    value = skip(parse_value(child, skip(value + 1))); /* skip any spacing, get the value. */
+    value = parser_skip(p, parse_value(p, child, parser_skip(p, value + 1))); /* skip any spacing, get the value. */
     if (!value) {
         return NULL;
     }
 
     while (*value == ',') {
         cJSON *new_item;
-        if (!(new_item = cJSON_New_Item())) {
+        if (!(new_item = parser_new_item(p))) {
             return NULL; /* memory fail */
         }
         child->next = new_item;
         new_item->prev = child;
         child = new_item;
-        value = skip(parse_string(child, skip(value + 1)));
+        value = parser_skip(p, parse_key(p, child, parser_skip(p, value + 1)));
         if (!value) {
             return NULL;
         }
-        child->string = child->valuestring;
-        child->valuestring = 0;
         if (*value != ':') {
             return NULL; /* fail! */
         }
-        value = skip(parse_value(child, skip(value + 1))); /* skip any spacing, get the value. */
+        value = parser_skip(p, parse_value(p, child, parser_skip(p, value + 1))); /* skip any spacing, get the value. */
         if (!value) {
             return NULL;
         }
@@ -602,110 +2537,277 @@ static const char *parse_object(cJSON *item, const char *value)
     return NULL; /* malformed. */
 }
 
+static int print_indent(cJSON_Writer *w, int depth)
+{
+    while (depth-- > 0) {
+        if (!writer_putc(w, '\t')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /* Render an object to text. */
-static char *print_object(cJSON *item, int depth, int fmt)
+static int print_object(cJSON_Writer *w, cJSON *item, int depth)
 {
-    char **entries = 0, **names = 0;
-    char *out = 0, *ptr, *ret, *str;
-    size_t len = 7;
-    int i = 0, j;
     cJSON *child = item->child;
-    int numentries = 0, fail = 0;
-    /* Count the number of entries. */
-    while (child) {
-        numentries++, child = child->next;
-    }
-    /* Allocate space for the names and the objects */
-    entries = cJSON_calloc(numentries, sizeof(char *));
-    if (!entries) {
-        return NULL;
-    }
-    names = cJSON_calloc(numentries, sizeof(char *));
-    if (!names) {
-        cJSON_free(entries);
-        return NULL;
-    }
 
-    /* Collect all the results into our arrays: */
-    child = item->child;
     depth++;
-    if (fmt) {
-        len += depth;
+    if (!writer_put(w, "{\n", w->fmt ? 2 : 1)) {
+        return 0;
     }
     while (child) {
-        names[i] = str = print_string_ptr(child->string);
-        entries[i++] = ret = print_value(child, depth, fmt);
-        if (str && ret) {
-            len += (int)strlen(ret) + (int)strlen(str) + 2 + (fmt ? 2 + depth : 0);
-        } else {
-            fail = 1;
+        if (w->fmt && !print_indent(w, depth)) {
+            return 0;
+        }
+        if (!print_string_ptr(w, child->string) ||
+            !writer_put(w, ":\t", w->fmt ? 2 : 1) ||
+            !print_value(w, child, depth)) {
+            return 0;
         }
         child = child->next;
+        if (child && !writer_putc(w, ',')) {
+            return 0;
+        }
+        if (w->fmt && !writer_putc(w, '\n')) {
+            return 0;
+        }
+    }
+    if (w->fmt && !print_indent(w, depth - 1)) {
+        return 0;
+    }
+    return writer_putc(w, '}');
+}
+
+/* The index of an array or object: its children in order, and for an
+   object a linear probing hash table of them by their names folded to
+   lower case, so both kinds of lookup can use it. Children with the
+   same folded name sit in the table in list order, so a lookup finds
+   the same one as a walk of the list. */
+struct cJSON_Index {
+    cJSON **items;
+    int count;
+    int capacity;
+    cJSON **slots; /* NULL for an array */
+    size_t mask; /* number of slots - 1 */
+};
+
+static size_t hash_name(const char *str)
+{
+    /* FNV-1a */
+    size_t hash = (size_t)2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)tolower(*(const unsigned char *)str++);
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    /* Try to allocate the output string */
-    if (!fail) {
-        out = cJSON_malloc(len);
+static void index_free(cJSON_Index *idx)
+{
+    if (idx) {
+        cJSON_free(idx->items);
+        cJSON_free(idx->slots);
+        cJSON_free(idx);
     }
-    if (!out) {
-        fail = 1;
+}
+
+/* Add to the hash table. Returns 1 if another child has the same name
+   ignoring case, which is then ahead of this one. */
+static int index_insert(cJSON_Index *idx, cJSON *item)
+{
+    size_t slot = hash_name(item->string) & idx->mask;
+    int duplicate = 0;
+    while (idx->slots[slot]) {
+        duplicate |= !cJSON_strcasecmp(idx->slots[slot]->string, item->string);
+        slot = (slot + 1) & idx->mask;
+    }
+    idx->slots[slot] = item;
+    return duplicate;
+}
+
+static void index_remove(cJSON_Index *idx, cJSON *item)
+{
+    size_t slot = hash_name(item->string) & idx->mask;
+    size_t next, home;
+
+    while (idx->slots[slot] != item) {
+        slot = (slot + 1) & idx->mask;
+    }
+    /* Shift the rest of the run back, keeping the order of the children
+       in it, so there are no tombstones. */
+    for (next = (slot + 1) & idx->mask; idx->slots[next];
+         next = (next + 1) & idx->mask) {
+        home = hash_name(idx->slots[next]->string) & idx->mask;
+        if (((next - home) & idx->mask) >= ((next - slot) & idx->mask)) {
+            idx->slots[slot] = idx->slots[next];
+            slot = next;
+        }
     }
+    idx->slots[slot] = NULL;
+}
 
-    /* Handle failure */
-    if (fail) {
-        for (i = 0; i < numentries; i++) {
-            if (names[i]) {
-                free(names[i]);
-            }
-            if (entries[i]) {
-                free(entries[i]);
-            }
+/* (Re)build the hash table with room for the children up to capacity. */
+static int index_rehash(cJSON_Index *idx)
+{
+    size_t nslots = 16;
+    int i;
+    while (nslots < (size_t)idx->capacity * 2) {
+        nslots *= 2;
+    }
+    cJSON_free(idx->slots);
+    idx->slots = cJSON_calloc(nslots, sizeof(cJSON *));
+    if (!idx->slots) {
+        return 0;
+    }
+    idx->mask = nslots - 1;
+    for (i = 0; i < idx->count; i++) {
+        if (idx->items[i]->string) {
+            index_insert(idx, idx->items[i]);
         }
-        free(names);
-        free(entries);
-        return NULL;
     }
+    return 1;
+}
 
-    /* Compose the output: */
-    *out = '{';
-    ptr = out + 1;
-    if (fmt) {
-        *ptr++ = '\n';
-    }*ptr = 0;
-    for (i = 0; i < numentries; i++) {
-        if (fmt) {
-            for (j = 0; j < depth; j++) {
-                *ptr++ = '\t';
-            }
+static int index_build(cJSON *item)
+{
+    cJSON_Index *idx;
+    cJSON *c;
+    int count = 0;
+
+    index_free(item->index);
+    item->index = NULL;
+    for (c = item->child; c; c = c->next) {
+        count++;
+    }
+    idx = cJSON_calloc(1, sizeof(cJSON_Index));
+    if (!idx) {
+        return 0;
+    }
+    idx->capacity = count < 8 ? 8 : count;
+    idx->items = cJSON_malloc(idx->capacity * sizeof(cJSON *));
+    if (!idx->items) {
+        index_free(idx);
+        return 0;
+    }
+    for (c = item->child; c; c = c->next) {
+        idx->items[idx->count++] = c;
+    }
+    if ((item->type & 255) == cJSON_Object && !index_rehash(idx)) {
+        index_free(idx);
+        return 0;
+    }
+    item->index = idx;
+    return 1;
+}
+
+/* When the index can't be kept up to date it's dropped, and lookups go
+   back to walking the list. */
+static void index_drop(cJSON *item)
+{
+    index_free(item->index);
+    item->index = NULL;
+}
+
+static void index_append(cJSON *array, cJSON *item)
+{
+    cJSON_Index *idx = array->index;
+    cJSON **items;
+
+    if (idx->count == idx->capacity) {
+        items = cJSON_malloc(idx->capacity * 2 * sizeof(cJSON *));
+        if (!items) {
+            index_drop(array);
+            return;
         }
-        strcpy(ptr, names[i]);
-        ptr += strlen(names[i]);
-        *ptr++ = ':';
-        if (fmt) {
-            *ptr++ = '\t';
+        memcpy(items, idx->items, idx->count * sizeof(cJSON *));
+        cJSON_free(idx->items);
+        idx->items = items;
+        idx->capacity *= 2;
+        if (idx->slots && !index_rehash(idx)) {
+            index_drop(array);
+            return;
         }
-        strcpy(ptr, entries[i]);
-        ptr += strlen(entries[i]);
-        if (i != numentries - 1) {
-            *ptr++ = ',';
+    }
+    idx->items[idx->count++] = item;
+    if (idx->slots && item->string) {
+        index_insert(idx, item);
+    }
+}
+
+/* Remove the child at position which */
+static void index_detach(cJSON *array, int which)
+{
+    cJSON_Index *idx = array->index;
+    cJSON *item = idx->items[which];
+
+    memmove(idx->items + which, idx->items + which + 1,
+            (idx->count - which - 1) * sizeof(cJSON *));
+    idx->count--;
+    if (idx->slots && item->string) {
+        index_remove(idx, item);
+    }
+}
+
+static void index_replace(cJSON *array, int which, cJSON *newitem)
+{
+    cJSON_Index *idx = array->index;
+    cJSON *item = idx->items[which];
+
+    idx->items[which] = newitem;
+    if (!idx->slots) {
+        return;
+    }
+    if (item->string) {
+        index_remove(idx, item);
+    }
+    /* Anywhere but the end of its run it could be ahead of a child with
+       the same name which is before it in the list. */
+    if (newitem->string && index_insert(idx, newitem) && !index_rehash(idx)) {
+        index_drop(array);
+    }
+}
+
+/* The position of a child, which must be there. */
+static int index_position(cJSON_Index *idx, cJSON *item)
+{
+    int i = 0;
+    while (idx->items[i] != item) {
+        i++;
+    }
+    return i;
+}
+
+static cJSON *index_lookup(cJSON_Index *idx, const char *string, int case_sensitive)
+{
+    size_t slot = hash_name(string) & idx->mask;
+    cJSON *c;
+    while ((c = idx->slots[slot]) != NULL) {
+        if (case_sensitive ? !strcmp(c->string, string) : !cJSON_strcasecmp(c->string, string)) {
+            return c;
         }
-        if (fmt) {
-            *ptr++ = '\n';
-        }*ptr = 0;
-        cJSON_free(names[i]);
-        cJSON_free(entries[i]);
+        slot = (slot + 1) & idx->mask;
     }
+    return NULL;
+}
 
-    cJSON_free(names);
-    cJSON_free(entries);
-    if (fmt) {
-        for (i = 0; i < depth - 1; i++) {
-            *ptr++ = '\t';
+int cJSON_BuildIndex(cJSON *item, int recursive)
+{
+    cJSON *c;
+    if ((item->type & 255) != cJSON_Array && (item->type & 255) != cJSON_Object) {
+        return 0;
+    }
+    if (!index_build(item)) {
+        return -1;
+    }
+    if (recursive) {
+        for (c = item->child; c; c = c->next) {
+            if (cJSON_BuildIndex(c, 1) != 0) {
+                return -1;
+            }
         }
     }
-    *ptr++ = '}';
-    *ptr++ = 0;
-    return out;
+    return 0;
 }
 
 /* Get Array size/item / object item. */
@@ -713,6 +2815,9 @@ int cJSON_GetArraySize(cJSON *array)
 {
     cJSON *c = array->child;
     int i = 0;
+    if (array->index) {
+        return array->index->count;
+    }
     while (c) {
         i++, c = c->next;
     }
@@ -722,6 +2827,12 @@ int cJSON_GetArraySize(cJSON *array)
 cJSON *cJSON_GetArrayItem(cJSON *array, int item)
 {
     cJSON *c = array->child;
+    if (array->index) {
+        if (item < 0) {
+            item = 0;
+        }
+        return item < array->index->count ? array->index->items[item] : NULL;
+    }
     while (c && item > 0) {
         item--, c = c->next;
     }
@@ -731,12 +2842,29 @@ cJSON *cJSON_GetArrayItem(cJSON *array, int item)
 cJSON *cJSON_GetObjectItem(cJSON *object, const char *string)
 {
     cJSON *c = object->child;
+    if (object->index && object->index->slots && string) {
+        return index_lookup(object->index, string, 0);
+    }
     while (c && cJSON_strcasecmp(c->string, string)) {
         c = c->next;
     }
     return c;
 }
 
+cJSON *cJSON_GetObjectItemCaseSensitive(cJSON *object, const char *string)
+{
+    cJSON *c = object->child;
+    if (object->index && object->index->slots && string) {
+        return index_lookup(object->index, string, 1);
+    }
+    /* Names from a key table are the same pointer */
+    while (c && !(c->string && string &&
+                  (c->string == string || !strcmp(c->string, string)))) {
+        c = c->next;
+    }
+    return c;
+}
+
 /* Utility for array list handling. */
 static void suffix_object(cJSON *prev, cJSON *item)
 {
@@ -750,8 +2878,10 @@ static cJSON *create_reference(cJSON *item)
     cJSON *ref = cJSON_New_Item();
     memcpy(ref, item, sizeof(cJSON));
     ref->string = 0;
+    ref->type &= ~(cJSON_IsArena | cJSON_StringIsConst);
     ref->type |= cJSON_IsReference;
     ref->next = ref->prev = 0;
+    ref->index = NULL;
     return ref;
 }
 
@@ -761,20 +2891,26 @@ void cJSON_AddItemToArray(cJSON *array, cJSON *item)
     cJSON *c = array->child;
     if (!c) {
         array->child = item;
+    } else if (array->index) {
+        suffix_object(array->index->items[array->index->count - 1], item);
     } else {
         while (c && c->next) {
             c = c->next;
         }
         suffix_object(c, item);
     }
+    if (array->index) {
+        index_append(array, item);
+    }
 }
 
 void cJSON_AddItemToObject(cJSON *object, const char *string, cJSON *item)
 {
-    if (item->string) {
+    if (item->string && !(item->type & cJSON_StringIsConst)) {
         cJSON_free(item->string);
     }
     item->string = cJSON_strdup(string);
+    item->type &= ~cJSON_StringIsConst;
     cJSON_AddItemToArray(object, item);
 }
 
@@ -791,8 +2927,19 @@ void cJSON_AddItemReferenceToObject(cJSON *object, const char *string, cJSON *it
 cJSON *cJSON_DetachItemFromArray(cJSON *array, int which)
 {
     cJSON *c = array->child;
-    while (c && which > 0) {
-        c = c->next, which--;
+    if (array->index) {
+        if (which < 0) {
+            which = 0;
+        }
+        if (which >= array->index->count) {
+            return NULL;
+        }
+        c = array->index->items[which];
+        index_detach(array, which);
+    } else {
+        while (c && which > 0) {
+            c = c->next, which--;
+        }
     }
     if (!c) {
         return NULL;
@@ -819,6 +2966,13 @@ cJSON *cJSON_DetachItemFromObject(cJSON *object, const char *string)
 {
     int i = 0;
     cJSON *c = object->child;
+    if (object->index && object->index->slots && string) {
+        c = index_lookup(object->index, string, 0);
+        if (c) {
+            return cJSON_DetachItemFromArray(object, index_position(object->index, c));
+        }
+        return NULL;
+    }
     while (c && cJSON_strcasecmp(c->string, string)) {
         i++, c = c->next;
     }
@@ -837,8 +2991,19 @@ void cJSON_DeleteItemFromObject(cJSON *object, const char *string)
 void cJSON_ReplaceItemInArray(cJSON *array, int which, cJSON *newitem)
 {
     cJSON *c = array->child;
-    while (c && which > 0) {
-        c = c->next, which--;
+    if (array->index) {
+        if (which < 0) {
+            which = 0;
+        }
+        if (which >= array->index->count) {
+            return;
+        }
+        c = array->index->items[which];
+        index_replace(array, which, newitem);
+    } else {
+        while (c && which > 0) {
+            c = c->next, which--;
+        }
     }
     if (!c) {
         return;
@@ -861,11 +3026,22 @@ void cJSON_ReplaceItemInObject(cJSON *object, const char *string, cJSON *newitem
 {
     int i = 0;
     cJSON *c = object->child;
-    while (c && cJSON_strcasecmp(c->string, string)) {
-        i++, c = c->next;
+    if (object->index && object->index->slots && string) {
+        c = index_lookup(object->index, string, 0);
+        if (c) {
+            i = index_position(object->index, c);
+        }
+    } else {
+        while (c && cJSON_strcasecmp(c->string, string)) {
+            i++, c = c->next;
+        }
     }
     if (c) {
+        if (newitem->string && !(newitem->type & cJSON_StringIsConst)) {
+            cJSON_free(newitem->string);
+        }
         newitem->string = cJSON_strdup(string);
+        newitem->type &= ~cJSON_StringIsConst;
         cJSON_ReplaceItemInArray(object, i, newitem);
     }
 }
@@ -895,9 +3071,20 @@ cJSON *cJSON_CreateFalse(void)
 cJSON *cJSON_CreateNumber(double num)
 {
     cJSON *item = cJSON_New_Item();
-    item->type = cJSON_Number;
-    item->valuedouble = num;
-    item->valueint = (int)num;
+    if (item) {
+        item->type = cJSON_Number;
+        set_number_double(item, num);
+    }
+    return item;
+}
+
+cJSON *cJSON_CreateInt64(int64_t num)
+{
+    cJSON *item = cJSON_New_Item();
+    if (item) {
+        item->type = cJSON_Number;
+        set_number_int64(item, num);
+    }
     return item;
 }
 
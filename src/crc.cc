@@ -0,0 +1,90 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Couchbase::Crc, the crc engine of crc_engine.h for polynomials other than
+// CRC-32C. Without a crc instruction to use, buffers of PCLMUL_MIN bytes
+// and over are folded with PCLMULQDQ on x86-64 CPUs which have it and
+// everything else gets the 3-way slicing-by-16.
+//
+
+#include "platform/crc.h"
+#include "crc32c_private.h"
+
+#ifdef WIN32
+#include <platform/platform.h>
+#else
+#include <sys/uio.h>
+#endif
+
+// Spot checks that the tables are generated at compile time, and right.
+static_assert(crc32_engine::sw::table[0][1] == 0x77073096, "crc32 sw table");
+static_assert(crc64_engine::sw::table[0][1] == 0xb32e4cbe03a75f6fULL,
+              "crc64 sw table");
+
+#if defined(CRC32C_HW_X86)
+static bool crc_pclmul_available() {
+    static const bool available = crc32c_hw_pclmul_available();
+    return available;
+}
+#endif
+
+template <uint64_t Poly, int Width>
+typename Couchbase::Crc<Poly, Width>::value_type
+Couchbase::Crc<Poly, Width>::checksum(const void* buf, size_t len,
+                                      value_type crc_in) {
+    typedef crc_engine<value_type, Poly> engine;
+    const uint8_t* data = static_cast<const uint8_t*>(buf);
+#if defined(CRC32C_HW_X86)
+    if (crc_pclmul_available()) {
+        return crc_pclmul<value_type, Poly>(data, len, crc_in);
+    }
+#endif
+    return engine::sw_3way(data, len, crc_in);
+}
+
+template <uint64_t Poly, int Width>
+typename Couchbase::Crc<Poly, Width>::value_type
+Couchbase::Crc<Poly, Width>::combine(value_type crc_a, value_type crc_b,
+                                     size_t len_b) {
+    return crc_engine<value_type, Poly>::combine(crc_a, crc_b, len_b);
+}
+
+template <uint64_t Poly, int Width>
+Couchbase::Crc<Poly, Width>&
+Couchbase::Crc<Poly, Width>::update(const struct iovec* iov, size_t iovcnt) {
+    for (size_t ii = 0; ii < iovcnt; ii++) {
+        update(iov[ii].iov_base, iov[ii].iov_len);
+    }
+    return *this;
+}
+
+template <>
+uint32_t Couchbase::Crc<0x82f63b78, 32>::checksum(const void* buf, size_t len,
+                                                  uint32_t crc_in) {
+    return crc32c(static_cast<const uint8_t*>(buf), len, crc_in);
+}
+
+template <>
+uint32_t Couchbase::Crc<0x82f63b78, 32>::combine(uint32_t crc_a, uint32_t crc_b,
+                                                 size_t len_b) {
+    return crc32c_combine(crc_a, crc_b, len_b);
+}
+
+template class Couchbase::Crc<0xedb88320, 32>;
+template class Couchbase::Crc<0xc96c5795d7870f42, 64>;
+template class Couchbase::Crc<0x82f63b78, 32>;
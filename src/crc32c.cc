@@ -44,163 +44,52 @@
 //    ii) See crc32c_bench.cc for testing
 //  f) Validated with IETF test vectors.
 //    i) See crc32c_test.cc.
-//  g) Use of GCC4.8 attributes to select SSE4.2 vs SW version/
-//  h) Custom cpuid code works for GCC(<4.8), CLANG and MSVC.
-//  i) Use static initialistion instead of pthread_once.
-//
-
-#include "platform/crc32c.h"
-
-#include <stdint.h>
-#include <stddef.h>
-
-// select header file for cpuid and crc instructions.
-#if defined(WIN32)
-#include <nmmintrin.h>
-#include <intrin.h>
-#elif defined(__clang__)
-#include <cpuid.h>
-#include <smmintrin.h>
-#elif defined(__GNUC__)
-#include <smmintrin.h>
-#include <cpuid.h>
-#endif
-
-#include <limits>
-#include <array>
-
-typedef uint32_t (*crc32c_function) (const uint8_t* buf, size_t len, uint32_t crc_in);
+//  g) Custom cpuid code works for GCC, CLANG and MSVC.
+//  h) Use static initialistion instead of pthread_once, see k).
+//  i) Carry-less multiply (PCLMULQDQ/VPCLMULQDQ) folding for large
+//     buffers on CPUs which support it.
+//  j) ARMv8 crc32c instructions on AArch64, and the software kernels
+//     everywhere else. The hardware kernels for each architecture are in
+//     their own file, see crc32c_private.h.
+//  k) Tables generated at compile time and the kernel chosen on the first
+//     call, so there is nothing for a static initialiser to do.
+//  l) The tables, software kernels and combine are the crc engine of
+//     crc_engine.h, shared with Couchbase::Crc for CRC-32 and CRC-64.
+//
 
-#ifdef USE_GCC_SSE4_ATTRIBUTE
-#define CRC32C_SW  __attribute__ ((target ("default"))) \
-                   uint32_t crc32c (const uint8_t* buf, size_t len, uint32_t crc_in)
+#include "crc32c_private.h"
 
-#define CRC32C_HW  __attribute__ ((target ("sse4.2"))) \
-                   uint32_t crc32c (const uint8_t* buf, size_t len, uint32_t crc_in)
+#ifdef WIN32
+#include <platform/platform.h>
 #else
-#define CRC32C_SW uint32_t crc32c_sw (const uint8_t* buf, size_t len, uint32_t crc_in)
-#define CRC32C_HW uint32_t crc32c_hw (const uint8_t* buf, size_t len, uint32_t crc_in)
+#include <sys/uio.h>
 #endif
 
-static bool setup_tables();
-static bool tables_setup = setup_tables();
-
-const uint32_t CRC32C_POLYNOMIAL_REV = 0x82F63B78;
-const uintptr_t ALIGN64_MASK = sizeof(uint64_t)-1;
-const int TABLE_X = 8, TABLE_Y = 256, SHIFT_TABLE_X = 4, SHIFT_TABLE_Y = 256;
-static uint32_t crc32c_sw_lookup_table[TABLE_X][TABLE_Y];
-/* Tables for hardware crc that shift a crc by LONG and SHORT zeros. */
-static uint32_t crc32c_long[SHIFT_TABLE_X][SHIFT_TABLE_Y];
-static uint32_t crc32c_short[SHIFT_TABLE_X][SHIFT_TABLE_Y];
-/* Block sizes for three-way parallel crc computation.  LONG and SHORT must
-   both be powers of two.  The associated string constants must be set
-   accordingly, for use in constructing the assembler instructions. */
-const int LONG_BLOCK = 8192;
-const int SHORT_BLOCK = 256;
-
-/* Multiply a matrix times a vector over the Galois field of two elements,
-   GF(2).  Each element is a bit in an unsigned integer.  mat must have at
-   least as many entries as the power of two for most significant one bit in
-   vec. */
-static inline uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec) {
-    uint32_t sum = 0;
-
-    while (vec > 0) {
-        if (vec & 1) {
-            sum ^= *mat;
-        }
-        vec >>= 1;
-        mat++;
-    }
-    return sum;
-}
-
-/* Multiply a matrix by itself over GF(2).  Both mat and square must have 32
-   rows. The result is written to 'square' */
-static inline void gf2_matrix_square(uint32_t *square, const uint32_t *mat) {
-    int n = 0;
-
-    for (n = 0; n < 32; n++) {
-        square[n] = gf2_matrix_times(mat, mat[n]);
-    }
-}
-
-/* Construct an operator to apply len zeros to a crc.  len must be a power of
-   two.  If len is not a power of two, then the result is the same as for the
-   largest power of two less than len.  The result for len == 0 is the same as
-   for len == 1.  A version of this routine could be easily written for any
-   len, but that is not needed for this application. */
-static void crc32c_zeros_op(uint32_t *even, size_t len) {
-    int n = 0;
-    uint32_t row = 1;
-    uint32_t odd[32];       /* odd-power-of-two zeros operator */
-
-    /* put operator for one zero bit in odd */
-    odd[0] = CRC32C_POLYNOMIAL_REV;              /* CRC-32C polynomial */
-
-    for (n = 1; n < 32; n++) {
-        odd[n] = row;
-        row <<= 1;
-    }
-
-    /* put operator for two zero bits in even */
-    gf2_matrix_square(even, odd);
-
-    /* put operator for four zero bits in odd */
-    gf2_matrix_square(odd, even);
-
-    /* first square will put the operator for one zero byte (eight zero bits),
-       in even -- buf square puts operator for two zero bytes in odd, and so
-       on, until len has been rotated down to zero */
-    do {
-        gf2_matrix_square(even, odd);
-        len >>= 1;
-        if (len == 0) {
-            return;
-        }
-        gf2_matrix_square(odd, even);
-        len >>= 1;
-    } while (len > 0);
-
-    /* answer ended up in odd -- copy to even */
-    for (n = 0; n < 32; n++) {
-        even[n] = odd[n];
-    }
-}
-
-/* Take a length and build four lookup tables for applying the zeros operator
-   for that length, byte-by-byte on the operand. */
-static void crc32c_zeros(uint32_t zeros[SHIFT_TABLE_X][SHIFT_TABLE_Y], size_t len) {
-    uint32_t op[32];
-
-    crc32c_zeros_op(op, len);
-    for (uint32_t n = 0; n < 256; n++) {
-        zeros[0][n] = gf2_matrix_times(op, n);
-        zeros[1][n] = gf2_matrix_times(op, n << 8);
-        zeros[2][n] = gf2_matrix_times(op, n << 16);
-        zeros[3][n] = gf2_matrix_times(op, n << 24);
-    }
-}
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
 
-/* Apply the zeros operator table to crc. */
-static inline uint32_t crc32c_shift(uint32_t zeros[SHIFT_TABLE_X][SHIFT_TABLE_Y],
-                                    uint32_t crc) {
-    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
-           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
-}
+// Spot checks that the tables are generated at compile time, and right.
+static_assert(crc32c_sw_lookup_table[0][1] == 0xf26b8303, "crc32c sw table");
+static_assert(crc32c_sw_lookup_table[7][255] == 0x1f1530a5, "crc32c sw table");
+static_assert(crc32c_sw_lookup_table[15][255] == 0x8fda7dfa, "crc32c sw table");
+static_assert(crc32c_engine::x2n::table[0] == uint32_t(1) << 30, "crc32c x2n table");
 
-// single CRC in software
-static inline uint64_t crc32c_sw_inner(uint64_t crc, const uint8_t* buffer) {
-    crc ^= *reinterpret_cast<const uint64_t*>(buffer);
-    crc = crc32c_sw_lookup_table[7][crc & 0xff] ^
-        crc32c_sw_lookup_table[6][(crc >> 8) & 0xff] ^
-        crc32c_sw_lookup_table[5][(crc >> 16) & 0xff] ^
-        crc32c_sw_lookup_table[4][(crc >> 24) & 0xff] ^
-        crc32c_sw_lookup_table[3][(crc >> 32) & 0xff] ^
-        crc32c_sw_lookup_table[2][(crc >> 40) & 0xff] ^
-        crc32c_sw_lookup_table[1][(crc >> 48) & 0xff] ^
-        crc32c_sw_lookup_table[0][crc >> 56];
-        return crc;
+//
+// Combine two crc32c values, crc_a of block A and crc_b of block B
+// (len_b bytes long) into the crc32c of A followed by B.
+//
+PLATFORM_PUBLIC_API
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b) {
+    return crc32c_engine::combine(crc_a, crc_b, len_b);
 }
 
 //
@@ -208,27 +97,7 @@ static inline uint64_t crc32c_sw_inner(uint64_t crc, const uint8_t* buffer) {
 // No optimisation
 //
 uint32_t crc32c_sw_1way(const uint8_t* buf, size_t len, uint32_t crc_in) {
-    uint64_t crc = static_cast<uint64_t>(~crc_in);
-
-    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
-        crc = crc32c_sw_lookup_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
-    }
-
-    while (len >= sizeof(uint64_t)) {
-        crc  = crc32c_sw_inner(crc, buf);
-        buf += sizeof(uint64_t);
-        len -= sizeof(uint64_t);
-    }
-
-    while (len > 0) {
-        crc = crc32c_sw_lookup_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
-    }
-
-    return static_cast<uint32_t>(crc ^ std::numeric_limits<uint32_t>::max());
+    return crc32c_engine::sw_1way(buf, len, crc_in);
 }
 
 //
@@ -236,347 +105,398 @@ uint32_t crc32c_sw_1way(const uint8_t* buf, size_t len, uint32_t crc_in) {
 // allowing some free CPU pipelining/parallelisation.
 //
 uint32_t crc32c_sw_short_block(const uint8_t* buf, size_t len, uint32_t crc_in) {
-    // If len is less the 3 x SHORT_BLOCK just use the 1-way sw version
-    if (len < (3 * SHORT_BLOCK)) {
-        return crc32c_sw_1way(buf, len, crc_in);
-    }
+    return crc32c_engine::sw_short_block(buf, len, crc_in);
+}
 
-    uint64_t crc = static_cast<uint64_t>(~crc_in), crc1 = 0, crc2 = 0;
+//
+// CRC32-C software implementation.
+//
+uint32_t crc32c_sw(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_engine::sw_3way(buf, len, crc_in);
+}
 
-    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
-        crc = crc32c_sw_lookup_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
-    }
+#if !defined(CRC32C_HW)
+//
+// No crc instructions on this architecture. crc32c_hw_available() is
+// false so the dispatcher and crc32c_calibrate never use the rest.
+//
+bool crc32c_hw_available() {
+    return false;
+}
 
-    // process the data in 3 blocks and combine the crc's using the shift trick
-    while (len >= (3 * SHORT_BLOCK)) {
-        crc1 = 0;
-        crc2 = 0;
-        const uint8_t* end = buf + SHORT_BLOCK;
-        do
-        {
-            crc  = crc32c_sw_inner(crc, buf);
-            crc1 = crc32c_sw_inner(crc1, (buf + SHORT_BLOCK));
-            crc2 = crc32c_sw_inner(crc2, (buf + (2 * SHORT_BLOCK)));
-            buf += sizeof(uint64_t);
-        } while (buf < end);
-        crc = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc)) ^ crc1;
-        crc = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc)) ^ crc2;
-        buf += 2 * SHORT_BLOCK;
-        len -= 3 * SHORT_BLOCK;
-    }
+crc32c_function crc32c_hw_select() {
+    return nullptr;
+}
 
-    // swallow any remaining longs.
-    while (len >= sizeof(uint64_t)) {
-        crc = crc32c_sw_inner(crc, buf);
-        buf += sizeof(uint64_t);
-        len -= sizeof(uint64_t);
-    }
+std::vector<crc32c_function> crc32c_hw_candidates() {
+    return std::vector<crc32c_function>();
+}
 
-    // swallow the remaining bytes.
-    while (len > 0) {
-        crc = crc32c_sw_lookup_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
-    }
+const char* crc32c_hw_kernel_name(crc32c_function) {
+    return nullptr;
+}
 
-    return static_cast<uint32_t>(crc ^ std::numeric_limits<uint32_t>::max());
+uint32_t crc32c_hw_1way(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_sw_1way(buf, len, crc_in);
 }
 
-//
-// CRC32-C software implementation.
-//
-CRC32C_SW {
-    // If len is less than the 3 x LONG_BLOCK it's faster to use the short-block only.
-    if (len < (3 * LONG_BLOCK)) {
-        return crc32c_sw_short_block(buf, len, crc_in);
-    }
+uint32_t crc32c_hw_short_block(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_sw_short_block(buf, len, crc_in);
+}
 
-    uint64_t crc = static_cast<uint64_t>(~crc_in), crc1 = 0, crc2 = 0;
+uint32_t crc32c_hw(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_sw(buf, len, crc_in);
+}
 
-    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
-        crc = crc32c_sw_lookup_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
-    }
+uint32_t crc32c_hw_nway(const crc32c_hw_tuning&,
+                        const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_sw(buf, len, crc_in);
+}
 
-    // process the data in 3 blocks and combine the crc's using the shift trick
-    while (len >= (3 * LONG_BLOCK)) {
-        crc1 = 0;
-        crc2 = 0;
-        const uint8_t* end = buf + LONG_BLOCK;
-        do
-        {
-            crc  = crc32c_sw_inner(crc, buf);
-            crc1 = crc32c_sw_inner(crc1, (buf + LONG_BLOCK));
-            crc2 = crc32c_sw_inner(crc2, (buf + (2 * LONG_BLOCK)));
-            buf += sizeof(uint64_t);
-        } while (buf < end);
-        crc = crc32c_shift(crc32c_long, static_cast<uint32_t>(crc)) ^ crc1;
-        crc = crc32c_shift(crc32c_long, static_cast<uint32_t>(crc)) ^ crc2;
-        buf += 2 * LONG_BLOCK;
-        len -= 3 * LONG_BLOCK;
+void crc32c_hw_multi(const uint8_t* bufs[], const size_t lens[],
+                     uint32_t out[], size_t n) {
+    for (size_t ii = 0; ii < n; ii++) {
+        out[ii] = crc32c_sw(bufs[ii], lens[ii], 0);
     }
+}
 
-    // process the data in 3 blocks and combine the crc's using the shift trick
-    while (len >= (3 * SHORT_BLOCK)) {
-        crc1 = 0;
-        crc2 = 0;
-        const uint8_t* end = buf + SHORT_BLOCK;
-        do
-        {
-            crc  = crc32c_sw_inner(crc, buf);
-            crc1 = crc32c_sw_inner(crc1, (buf + SHORT_BLOCK));
-            crc2 = crc32c_sw_inner(crc2, (buf + (2 * SHORT_BLOCK)));
-            buf += sizeof(uint64_t);
-        } while (buf < end);
-        crc = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc)) ^ crc1;
-        crc = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc)) ^ crc2;
-        buf += 2 * SHORT_BLOCK;
-        len -= 3 * SHORT_BLOCK;
-    }
+void crc32c_copy_stream(uint8_t* dst, const uint8_t* src, size_t len) {
+    std::memcpy(dst, src, len);
+}
+#endif
 
-    // swallow any remaining longs.
-    while (len >= sizeof(uint64_t)) {
-        crc = crc32c_sw_inner(crc, buf);
-        buf += sizeof(uint64_t);
-        len -= sizeof(uint64_t);
-    }
+const int TUNING_WAYS[] = {3, 4, 6};
+const size_t TUNING_LONG_BLOCKS[] = {4096, 8192, 16384};
+const size_t TUNING_SHORT_BLOCKS[] = {128, 256, 512};
+
+static void crc32c_hw_tuning_init(crc32c_hw_tuning& tuning, int ways,
+                                  size_t long_block, size_t short_block) {
+    tuning.ways = ways;
+    tuning.long_block = long_block;
+    tuning.short_block = short_block;
+    crc32c_engine::zeros(tuning.long_table, long_block);
+    crc32c_engine::zeros(tuning.short_table, short_block);
+    snprintf(tuning.description, sizeof(tuning.description),
+             CRC32C_HW_ISA " %d-way %zu/%zu", ways, long_block, short_block);
+}
 
-    // swallow any remaining bytes.
-    while (len > 0) {
-        crc = crc32c_sw_lookup_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
-    }
+// The tuning used by crc32c_hw_tuned. Once published a tuning is never
+// freed as other threads may still be using it.
+static std::atomic<const crc32c_hw_tuning*> hw_tuning(nullptr);
 
-    return static_cast<uint32_t>(crc ^ std::numeric_limits<uint32_t>::max());
+//
+// HW assisted crc32c using the published tuning, or crc32c_hw if there's
+// none yet.
+//
+uint32_t crc32c_hw_tuned(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    const crc32c_hw_tuning* tuning = hw_tuning.load(std::memory_order_acquire);
+    if (tuning == nullptr) {
+        return crc32c_hw(buf, len, crc_in);
+    }
+    return crc32c_hw_nway(*tuning, buf, len, crc_in);
 }
 
 //
-// CRC32-C implementation using SSE4.2 acceleration
-// no pipeline optimisation.
+// Publish a new tuning for crc32c_hw_tuned. Returns false if ways isn't
+// one of the supported widths or a block size isn't a multiple of 8.
 //
-uint32_t crc32c_hw_1way (const uint8_t* buf, size_t len, uint32_t crc_in) {
-    uint64_t crc = static_cast<uint64_t>(~crc_in);
-    // use crc32-byte instruction until the buf pointer is 8-byte aligned
-    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
-        crc = _mm_crc32_u8(static_cast<uint32_t>(crc), *buf);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
-    }
+bool crc32c_hw_set_tuning(int ways, size_t long_block, size_t short_block) {
+    if (std::find(std::begin(TUNING_WAYS), std::end(TUNING_WAYS), ways) ==
+            std::end(TUNING_WAYS) ||
+        long_block == 0 || short_block == 0 ||
+        (long_block & ALIGN64_MASK) != 0 || (short_block & ALIGN64_MASK) != 0) {
+        return false;
+    }
+    crc32c_hw_tuning* tuning = new crc32c_hw_tuning;
+    crc32c_hw_tuning_init(*tuning, ways, long_block, short_block);
+    hw_tuning.store(tuning, std::memory_order_release);
+    return true;
+}
 
-    // use crc32-64 instruction until there's no more 64-bits to eat
-    while (len >= sizeof(uint64_t)) {
-        crc = _mm_crc32_u64(crc, *reinterpret_cast<const uint64_t*>(buf));
-        buf += sizeof(uint64_t);
-        len -= sizeof(uint64_t);
+//
+// crc32c of many separate buffers, interleaving them when there are crc
+// instructions to keep busy.
+//
+PLATFORM_PUBLIC_API
+void crc32c_multi(const uint8_t* bufs[], const size_t lens[],
+                  uint32_t out[], size_t n) {
+    static const bool hw_multi = crc32c_hw_available();
+    if (hw_multi) {
+        crc32c_hw_multi(bufs, lens, out, n);
+        return;
     }
-
-    // finish the rest using the byte instruction
-    while (len > 0) {
-        crc = _mm_crc32_u8(static_cast<uint32_t>(crc), *buf);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
+    for (size_t ii = 0; ii < n; ii++) {
+        out[ii] = crc32c(bufs[ii], lens[ii], 0);
     }
-
-    return static_cast<uint32_t>(crc ^ std::numeric_limits<uint32_t>::max());
 }
 
 //
-// HW assisted crc32c that processes as much data in parallel using 3xSHORT_BLOCKs
+// crc32c_copy works through the data in chunks small enough to still be
+// in L1 when they're copied. Copies of at least COPY_STREAM_MIN bytes, more
+// than a core's share of L2, use non-temporal stores: a copy that big would
+// only push everything else out of the cache, and it saves reading each
+// line of dst in before it's overwritten.
 //
-uint32_t crc32c_hw_short_block (const uint8_t* buf, size_t len, uint32_t crc_in) {
+const size_t COPY_CHUNK = 8 * 1024;
+const size_t COPY_STREAM_MIN = 256 * 1024;
 
-    // If len is less the 3xSHORT_BLOCK just use the 1-way hw version
-    if (len < (3*SHORT_BLOCK)) {
-        return crc32c_hw_1way(buf, len, crc_in);
+//
+// Copy len bytes from src to dst and return the crc32c of them. Each
+// chunk is checksummed from src, pulling it into L1, then copied from L1,
+// so the data is only read from memory once.
+//
+PLATFORM_PUBLIC_API
+uint32_t crc32c_copy(uint8_t* dst, const uint8_t* src, size_t len,
+                     uint32_t crc_in) {
+    const bool stream = len >= COPY_STREAM_MIN;
+    uint32_t crc = crc_in;
+    while (len > 0) {
+        size_t chunk = len < COPY_CHUNK ? len : COPY_CHUNK;
+        crc = crc32c(src, chunk, crc);
+        if (stream) {
+            crc32c_copy_stream(dst, src, chunk);
+        } else {
+            std::memcpy(dst, src, chunk);
+        }
+        dst += chunk;
+        src += chunk;
+        len -= chunk;
     }
+    return crc;
+}
 
-    uint64_t crc0 = static_cast<uint64_t>(~crc_in), crc1 = 0, crc2 = 0;
-
-    // use crc32-byte instruction until the buf pointer is 8-byte aligned
-    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+//
+// Don't bother splitting the work into chunks smaller than this, the
+// thread start-up would cost more than is saved.
+//
+const size_t PARALLEL_MIN_CHUNK = 1024 * 1024;
 
-        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
+//
+// Multi-threaded crc32c. The buffer is split into nthreads chunks,
+// nthreads - 1 worker threads checksum all but the first chunk, which
+// the calling thread does itself, then the crc of each chunk is
+// merged in order with crc32c_combine.
+//
+PLATFORM_PUBLIC_API
+uint32_t crc32c_parallel(const uint8_t* buf, size_t len, uint32_t crc_in,
+                         unsigned nthreads) {
+    if (nthreads == 0) {
+        nthreads = std::thread::hardware_concurrency();
+    }
+    if (len / PARALLEL_MIN_CHUNK < nthreads) {
+        nthreads = static_cast<unsigned>(len / PARALLEL_MIN_CHUNK);
+    }
+    if (nthreads <= 1) {
+        return crc32c(buf, len, crc_in);
+    }
+
+    // Round the chunk size up to a whole number of 8-byte words so that
+    // each chunk starts with the same alignment as buf.
+    size_t chunk = ((len / nthreads) + ALIGN64_MASK) & ~ALIGN64_MASK;
+    std::vector<uint32_t> crcs(nthreads, 0);
+    std::vector<std::thread> workers;
+    workers.reserve(nthreads - 1);
+
+    for (unsigned ii = 1; ii < nthreads; ii++) {
+        const uint8_t* start = buf + (ii * chunk);
+        size_t size = ii == nthreads - 1 ? len - (ii * chunk) : chunk;
+        uint32_t* result = &crcs[ii];
+        try {
+            workers.emplace_back([start, size, result]() {
+                *result = crc32c(start, size, 0);
+            });
+        } catch (const std::system_error&) {
+            // Couldn't start a thread, do the work here instead.
+            *result = crc32c(start, size, 0);
+        }
     }
 
-    // process the data using 3 pipelined crc working on 3 blocks of SHORT_BLOCK
-    while (len >= (3 * SHORT_BLOCK)) {
-        crc1 = 0;
-        crc2 = 0;
-        const uint8_t* end = buf + SHORT_BLOCK;
-        do
-        {
-            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
-            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t*>(buf + SHORT_BLOCK));
-            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t*>(buf + (2 * SHORT_BLOCK)));
-            buf += sizeof(uint64_t);
-        } while (buf < end);
-        crc0 = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc0)) ^ crc1;
-        crc0 = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc0)) ^ crc2;
-        buf += 2 * SHORT_BLOCK;
-        len -= 3 * SHORT_BLOCK;
-    }
+    uint32_t crc = crc32c(buf, chunk, crc_in);
 
-    // use crc32-64 instruction until there's no more 64-bits to eat
-    while (len >= sizeof(uint64_t)) {
-        crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
-        buf += sizeof(uint64_t);
-        len -= sizeof(uint64_t);
+    for (auto& worker : workers) {
+        worker.join();
     }
 
-    // finish the rest using the byte instruction
-    while (len > 0) {
-        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
+    for (unsigned ii = 1; ii < nthreads; ii++) {
+        size_t size = ii == nthreads - 1 ? len - (ii * chunk) : chunk;
+        crc = crc32c_combine(crc, crcs[ii], size);
     }
-
-    return static_cast<uint32_t>(crc0 ^ std::numeric_limits<uint32_t>::max());
+    return crc;
 }
 
-
 //
-// A parallelised crc32c issuing 3 crc at once.
-// Generally 3 crc instructions can be issued at once.
+// Return the appropriate function for the platform, the best hardware
+// kernel the CPU supports or else software.
 //
-CRC32C_HW {
-
-    // if len is less than the long block it's faster to just process using 3way short-block
-    if (len < 3*LONG_BLOCK) {
-        return crc32c_hw_short_block(buf, len, crc_in);
-    }
+crc32c_function setup_crc32c() {
+    crc32c_function f = crc32c_hw_select();
+    return f != nullptr ? f : crc32c_sw;
+}
 
-    uint64_t crc0 = static_cast<uint64_t>(~crc_in), crc1 = 0, crc2 = 0;
+static uint32_t crc32c_resolve(const uint8_t* buf, size_t len, uint32_t crc_in);
 
-    // use crc32-byte instruction until the buf pointer is 8-byte aligned
-    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+// Starts out as crc32c_resolve, a constant, so it's set before any static
+// initialiser runs.
+static std::atomic<crc32c_function> safe_crc32c(crc32c_resolve);
+static std::atomic<const char*> safe_crc32c_name(nullptr);
 
-        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
-    }
-
-    /* compute the crc on sets of LONG_BLOCK*3 bytes, executing three independent crc
-       instructions, each on LONG_BLOCK bytes -- this is optimized for the Nehalem,
-       Westmere, Sandy Bridge, and Ivy Bridge architectures, which have a
-       throughput of one crc per cycle, but a latency of three cycles */
-    while (len >= (3 * LONG_BLOCK)) {
-        crc1 = 0;
-        crc2 = 0;
-        const uint8_t* end = buf + LONG_BLOCK;
-        do
-        {
-            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
-            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t*>(buf + LONG_BLOCK));
-            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t*>(buf + (2 * LONG_BLOCK)));
-            buf += sizeof(uint64_t);
-        } while (buf < end);
-        crc0 = crc32c_shift(crc32c_long, static_cast<uint32_t>(crc0)) ^ crc1;
-        crc0 = crc32c_shift(crc32c_long, static_cast<uint32_t>(crc0)) ^ crc2;
-        buf += 2 * LONG_BLOCK;
-        len -= 3 * LONG_BLOCK;
+//
+// The kernel crc32c is using, choosing it with setup_crc32c if that
+// hasn't happened yet. Unless crc32c_calibrate got there first.
+//
+static crc32c_function crc32c_resolved() {
+    crc32c_function f = safe_crc32c.load(std::memory_order_acquire);
+    if (f == crc32c_resolve) {
+        crc32c_function best = setup_crc32c();
+        if (safe_crc32c.compare_exchange_strong(f, best,
+                                                std::memory_order_acq_rel)) {
+            f = best;
+        }
     }
+    return f;
+}
 
-    /* do the same thing, but now on SHORT_BLOCK*3 blocks for the remaining data less
-       than a LONG_BLOCK*3 block */
-    while (len >= (3 * SHORT_BLOCK)) {
-        crc1 = 0;
-        crc2 = 0;
-        const uint8_t* end = buf + SHORT_BLOCK;
-        do
-        {
-            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
-            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t*>(buf + SHORT_BLOCK));
-            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t*>(buf + (2 * SHORT_BLOCK)));
-            buf += sizeof(uint64_t);
-        } while (buf < end);
-        crc0 = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc0)) ^ crc1;
-        crc0 = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc0)) ^ crc2;
-        buf += 2 * SHORT_BLOCK;
-        len -= 3 * SHORT_BLOCK;
-    }
+//
+// crc32c's kernel until the first call replaces it.
+//
+static uint32_t crc32c_resolve(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_resolved()(buf, len, crc_in);
+}
 
-    // use crc32-64 instruction until there's no more 64-bits to eat
-    while (len >= sizeof(uint64_t)) {
-        crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
-        buf += sizeof(uint64_t);
-        len -= sizeof(uint64_t);
+//
+// Describe one of the fixed (not tuned) kernels.
+//
+static const char* crc32c_kernel_name(crc32c_function f) {
+    if (f == crc32c_hw) {
+        return CRC32C_HW_ISA " 3-way 8192/256";
     }
+    const char* name = crc32c_hw_kernel_name(f);
+    return name != nullptr ? name : "software slicing-by-16";
+}
 
-    // finish the rest using the byte instruction
-    while (len > 0) {
-        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
-        buf += sizeof(uint8_t);
-        len -= sizeof(uint8_t);
+PLATFORM_PUBLIC_API
+const char* crc32c_implementation() {
+    const char* name = safe_crc32c_name.load(std::memory_order_acquire);
+    if (name == nullptr) {
+        name = crc32c_kernel_name(crc32c_resolved());
     }
+    return name;
+}
 
-    return static_cast<uint32_t>(crc0 ^ std::numeric_limits<uint32_t>::max());
+//
+// The fastest of reps runs of f over buf, in nanoseconds.
+//
+template <typename F>
+static uint64_t crc32c_time(F f, const std::vector<uint8_t>& buf, int reps) {
+    uint64_t best = std::numeric_limits<uint64_t>::max();
+    volatile uint32_t sink = 0;
+    for (int ii = 0; ii < reps; ii++) {
+        auto start = std::chrono::steady_clock::now();
+        sink = f(buf.data(), buf.size(), sink);
+        auto end = std::chrono::steady_clock::now();
+        uint64_t ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        best = std::min(best, ns);
+    }
+    return best;
 }
 
+static std::mutex calibrate_mutex;
+static bool calibrated = false;
+
 //
-// Initialise tables for software and hardware functions.
+// Time the kernels the CPU supports and make crc32c use the fastest. The
+// N-way crc32 pipeline is timed at every candidate width and long block
+// size on a buffer large enough to use long blocks, then the short block
+// size for the best of those on a buffer which only fits short blocks.
+// The best tuning then competes with the folding kernels.
 //
-bool setup_tables() {
-    uint32_t crc = 0;
-    for (int ii = 0; ii < TABLE_Y; ii++) {
-        crc = ii;
-        for (int jj = 0; jj < TABLE_X; jj++) {
-            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL_REV : crc >> 1;
+PLATFORM_PUBLIC_API
+const char* crc32c_calibrate() {
+    std::lock_guard<std::mutex> guard(calibrate_mutex);
+    if (calibrated) {
+        return crc32c_implementation();
+    }
+    calibrated = true;
+
+    if (!crc32c_hw_available()) {
+        return crc32c_implementation();
+    }
+
+    const int REPS = 32;
+    std::vector<uint8_t> large(256 * 1024), small(12 * 256);
+    for (size_t ii = 0; ii < large.size(); ii++) {
+        large[ii] = static_cast<uint8_t>(ii * 2654435761u >> 24);
+    }
+    for (size_t ii = 0; ii < small.size(); ii++) {
+        small[ii] = large[ii];
+    }
+
+    crc32c_hw_tuning* best = new crc32c_hw_tuning;
+    crc32c_hw_tuning candidate;
+    uint64_t best_time = std::numeric_limits<uint64_t>::max();
+    for (int ways : TUNING_WAYS) {
+        for (size_t long_block : TUNING_LONG_BLOCKS) {
+            crc32c_hw_tuning_init(candidate, ways, long_block, SHORT_BLOCK);
+            uint64_t t = crc32c_time([&candidate](const uint8_t* buf, size_t len,
+                                                  uint32_t crc) {
+                return crc32c_hw_nway(candidate, buf, len, crc);
+            }, large, REPS);
+            if (t < best_time) {
+                best_time = t;
+                *best = candidate;
+            }
         }
-        crc32c_sw_lookup_table[0][ii] = crc;
     }
 
-    for (int ii = 0; ii < TABLE_Y; ii++) {
-        crc = crc32c_sw_lookup_table[0][ii];
-        for (int jj = 1; jj < TABLE_X; jj++) {
-            crc = crc32c_sw_lookup_table[jj][ii] =
-                crc32c_sw_lookup_table[0][crc & 0xff] ^ (crc >> 8);
+    uint64_t best_short_time = std::numeric_limits<uint64_t>::max();
+    size_t best_short = SHORT_BLOCK;
+    for (size_t short_block : TUNING_SHORT_BLOCKS) {
+        crc32c_hw_tuning_init(candidate, best->ways, best->long_block, short_block);
+        uint64_t t = crc32c_time([&candidate](const uint8_t* buf, size_t len,
+                                              uint32_t crc) {
+            return crc32c_hw_nway(candidate, buf, len, crc);
+        }, small, REPS);
+        if (t < best_short_time) {
+            best_short_time = t;
+            best_short = short_block;
+        }
+    }
+    crc32c_hw_tuning_init(*best, best->ways, best->long_block, best_short);
+    hw_tuning.store(best, std::memory_order_release);
+
+    crc32c_function f = crc32c_hw_tuned;
+    const char* name = best->description;
+    best_time = crc32c_time(crc32c_hw_tuned, large, REPS);
+    for (crc32c_function kernel : crc32c_hw_candidates()) {
+        uint64_t t = crc32c_time(kernel, large, REPS);
+        if (t < best_time) {
+            best_time = t;
+            f = kernel;
+            name = crc32c_kernel_name(f);
         }
     }
 
-    crc32c_zeros(crc32c_long, LONG_BLOCK);
-    crc32c_zeros(crc32c_short, SHORT_BLOCK);
-
-    return true;
+    safe_crc32c_name.store(name, std::memory_order_release);
+    safe_crc32c.store(f, std::memory_order_release);
+    return name;
 }
 
-
-//
-// GCC < 4.8, CLANG and Visual C++ use the
-// cpuid selected safe_crc32 function pointer (via crc32c)
-//
-#ifndef USE_GCC_SSE4_ATTRIBUTE
-
 //
-// Return the appropriate function for the platform.
-// If SSE4.2 is available then hardware acceleration is used.
+// Setting CB_CRC32C_CALIBRATE in the environment calibrates crc32c when
+// the library is loaded, otherwise the kernel is chosen by the CPU's
+// features alone.
 //
-crc32c_function setup_crc32c() {
-    const uint32_t SSE42 = 0x00100000;
-
-    crc32c_function f = crc32c_sw;
-
-#if defined(WIN32)
-    std::array<int, 4> registers = {{0,0,0,0}};
-    __cpuid(registers.data(), 1);
-#else
-    std::array<uint32_t, 4> registers = {{0,0,0,0}};
-    __get_cpuid(1, &registers[0], &registers[1], &registers[2],&registers[3]);
-#endif
-
-    if (registers[2] & SSE42) {
-        f = crc32c_hw;
+static bool setup_calibration() {
+    const char* env = getenv("CB_CRC32C_CALIBRATE");
+    if (env != nullptr && *env != '\0' && *env != '0') {
+        crc32c_calibrate();
+        return true;
     }
-
-    return f;
+    return false;
 }
 
-static crc32c_function safe_crc32c = setup_crc32c();
+static bool calibrated_at_startup = setup_calibration();
 
 //
 // The exported crc32c method uses the function setup_crc32 decided
@@ -584,7 +504,68 @@ static crc32c_function safe_crc32c = setup_crc32c();
 //
 PLATFORM_PUBLIC_API
 uint32_t crc32c (const uint8_t* buf, size_t len, uint32_t crc_in) {
-    return safe_crc32c(buf, len, crc_in);
+    return safe_crc32c.load(std::memory_order_relaxed)(buf, len, crc_in);
 }
 
-#endif
\ No newline at end of file
+//
+// Couchbase::Crc32c gathers iovec fragments shorter than IOV_SMALL into a
+// buffer of IOV_GATHER bytes and checksums them in one go. crc32c is
+// slowest per byte on short buffers, which are too short for the 3-way
+// pipeline or the folding kernels and pay for aligning to 8 bytes, and
+// it's cheaper to copy them. Gathering 256-1024 byte fragments is about
+// 2.8x faster than a crc32c call for each, 100-250 byte ones 4x.
+//
+const size_t IOV_SMALL = 1024;
+const size_t IOV_GATHER = 8192;
+
+Couchbase::Crc32c& Couchbase::Crc32c::update(const struct iovec* iov,
+                                             size_t iovcnt) {
+    uint8_t gather[IOV_GATHER];
+    size_t gathered = 0;
+    for (size_t ii = 0; ii < iovcnt; ii++) {
+        const uint8_t* base = static_cast<const uint8_t*>(iov[ii].iov_base);
+        const size_t len = iov[ii].iov_len;
+        if (len < IOV_SMALL) {
+            if (gathered + len > sizeof(gather)) {
+                update(gather, gathered);
+                gathered = 0;
+            }
+            std::memcpy(gather + gathered, base, len);
+            gathered += len;
+        } else {
+            if (gathered > 0) {
+                update(gather, gathered);
+                gathered = 0;
+            }
+            update(base, len);
+        }
+    }
+    if (gathered > 0) {
+        update(gather, gathered);
+    }
+    return *this;
+}
+
+std::streamsize Couchbase::Crc32cStreamBuf::xsputn(const char* s,
+                                                   std::streamsize n) {
+    if (sink != nullptr) {
+        n = sink->sputn(s, n);
+    }
+    if (n > 0) {
+        hasher.update(s, static_cast<size_t>(n));
+    }
+    return n;
+}
+
+Couchbase::Crc32cStreamBuf::int_type
+Couchbase::Crc32cStreamBuf::overflow(int_type ch) {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+    }
+    const char c = traits_type::to_char_type(ch);
+    return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+}
+
+int Couchbase::Crc32cStreamBuf::sync() {
+    return sink != nullptr ? sink->pubsync() : 0;
+}
@@ -0,0 +1,187 @@
+ /* crc32c.c -- compute CRC-32C using the Intel crc32 instruction
+  * Copyright (C) 2013 Mark Adler
+  * Version 1.1  1 Aug 2013  Mark Adler
+  */
+
+/*
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the author be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Mark Adler
+  madler@alumni.caltech.edu
+ */
+
+//
+// ARMv8 crc32c kernels for AArch64, see crc32c.cc for the history and
+// the dispatcher. The CRC32 extension is optional before ARMv8.1 so the
+// kernels are only called when the kernel's hwcaps say it's present.
+// Built with -march=armv8-a+crc.
+//
+// The CRC32CX instruction has the same latency/throughput shape as the
+// SSE4.2 crc32 instruction (3 cycles, one per cycle on Cortex-A72 and
+// Neoverse) so it uses the same 3-way interleaving and shift-table
+// combine, via crc32c_hw_pipeline.
+//
+
+#include "crc32c_private.h"
+
+#if defined(CRC32C_HW_ARMV8)
+
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <windows.h>
+#else
+#include <arm_acle.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+/* Number of buffers crc32c_hw_multi keeps in flight, as for SSE4.2. */
+const int MULTI_WAYS = 4;
+
+//
+// The ARMv8 crc32c instructions for crc32c_hw_pipeline.
+//
+struct crc32c_armv8 {
+    static inline uint64_t crc8(uint64_t crc, uint8_t data) {
+        return __crc32cb(static_cast<uint32_t>(crc), data);
+    }
+    static inline uint64_t crc64(uint64_t crc, uint64_t data) {
+        return __crc32cd(static_cast<uint32_t>(crc), data);
+    }
+};
+
+//
+// CRC32-C implementation using the ARMv8 crc32c instructions
+// no pipeline optimisation.
+//
+uint32_t crc32c_hw_1way(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    uint64_t crc = static_cast<uint64_t>(~crc_in);
+    // use crc32-byte instruction until the buf pointer is 8-byte aligned
+    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+        crc = crc32c_armv8::crc8(crc, *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    // use crc32-64 instruction until there's no more 64-bits to eat
+    while (len >= sizeof(uint64_t)) {
+        crc = crc32c_armv8::crc64(crc, *reinterpret_cast<const uint64_t*>(buf));
+        buf += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+
+    // finish the rest using the byte instruction
+    while (len > 0) {
+        crc = crc32c_armv8::crc8(crc, *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    return static_cast<uint32_t>(crc ^ std::numeric_limits<uint32_t>::max());
+}
+
+//
+// HW assisted crc32c that processes as much data in parallel using 3xSHORT_BLOCKs
+//
+uint32_t crc32c_hw_short_block(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    // If len is less the 3xSHORT_BLOCK just use the 1-way hw version
+    if (len < (3 * SHORT_BLOCK)) {
+        return crc32c_hw_1way(buf, len, crc_in);
+    }
+    return crc32c_hw_pipeline<crc32c_armv8, 3>(buf, len, crc_in,
+                                               0, nullptr,
+                                               SHORT_BLOCK, crc32c_short);
+}
+
+//
+// A parallelised crc32c issuing 3 crc at once.
+//
+uint32_t crc32c_hw(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    // if len is less than the long block it's faster to just process using 3way short-block
+    if (len < (3 * LONG_BLOCK)) {
+        return crc32c_hw_short_block(buf, len, crc_in);
+    }
+    return crc32c_hw_pipeline<crc32c_armv8, 3>(buf, len, crc_in,
+                                               LONG_BLOCK, crc32c_long,
+                                               SHORT_BLOCK, crc32c_short);
+}
+
+template <int WAYS>
+static uint32_t crc32c_hw_nway(const crc32c_hw_tuning& tuning,
+                               const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_hw_pipeline<crc32c_armv8, WAYS>(buf, len, crc_in,
+                                                  tuning.long_block, tuning.long_table,
+                                                  tuning.short_block, tuning.short_table);
+}
+
+uint32_t crc32c_hw_nway(const crc32c_hw_tuning& tuning,
+                        const uint8_t* buf, size_t len, uint32_t crc_in) {
+    switch (tuning.ways) {
+    case 4:
+        return crc32c_hw_nway<4>(tuning, buf, len, crc_in);
+    case 6:
+        return crc32c_hw_nway<6>(tuning, buf, len, crc_in);
+    default:
+        return crc32c_hw_nway<3>(tuning, buf, len, crc_in);
+    }
+}
+
+void crc32c_hw_multi(const uint8_t* bufs[], const size_t lens[],
+                     uint32_t out[], size_t n) {
+    crc32c_hw_multi_lanes<crc32c_armv8, MULTI_WAYS>(bufs, lens, out, n);
+}
+
+// The non-temporal STNP is only a hint, and the Cortex and Neoverse cores
+// already switch memcpy to streaming writes for large copies.
+void crc32c_copy_stream(uint8_t* dst, const uint8_t* src, size_t len) {
+    std::memcpy(dst, src, len);
+}
+
+bool crc32c_hw_available() {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#elif defined(__APPLE__)
+    // Every Apple arm64 CPU has the CRC32 extension
+    return true;
+#elif defined(_MSC_VER)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != 0;
+#else
+    return false;
+#endif
+}
+
+crc32c_function crc32c_hw_select() {
+    return crc32c_hw_available() ? crc32c_hw : nullptr;
+}
+
+// ARMv8 has PMULL, but the folding kernels haven't been ported yet.
+std::vector<crc32c_function> crc32c_hw_candidates() {
+    return std::vector<crc32c_function>();
+}
+
+const char* crc32c_hw_kernel_name(crc32c_function) {
+    return nullptr;
+}
+
+#endif // CRC32C_HW_ARMV8
@@ -0,0 +1,379 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Internals shared by the crc32c implementation files.
+//
+// crc32c.cc has the tables, the software kernels and the dispatcher.
+// The hardware kernels for each architecture live in their own file so
+// they can be built with the instruction set flags they need:
+//
+//   crc32c_sse4_2.cc - x86-64 SSE4.2 crc32, PCLMULQDQ and VPCLMULQDQ
+//   crc32c_armv8.cc  - AArch64 ARMv8 crc32c
+//
+// Each of those files is empty when built for another architecture.
+//
+
+#pragma once
+
+#include "platform/crc32c.h"
+#include "crc_engine.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_HW_X86 1
+#define CRC32C_HW_ISA "sse4.2"
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CRC32C_HW_ARMV8 1
+#define CRC32C_HW_ISA "armv8"
+#endif
+
+#if defined(CRC32C_HW_X86) || defined(CRC32C_HW_ARMV8)
+#define CRC32C_HW 1
+#else
+// No crc instructions, crc32c_hw_available() is always false
+#define CRC32C_HW_ISA "none"
+#endif
+
+typedef uint32_t (*crc32c_function) (const uint8_t* buf, size_t len, uint32_t crc_in);
+
+const int TABLE_X = 16, TABLE_Y = 256, SHIFT_TABLE_X = 4, SHIFT_TABLE_Y = 256;
+
+const uint32_t CRC32C_POLYNOMIAL_REV = 0x82F63B78;
+
+//
+// crc32c is the crc engine (crc_engine.h) for the CRC-32C polynomial, which
+// generates the tables at compile time. The hardware kernels only need the
+// shift tables and the folding constants from it, the software kernels in
+// crc32c.cc are the engine's.
+//
+typedef crc_engine<uint32_t, CRC32C_POLYNOMIAL_REV> crc32c_engine;
+
+/* x^n mod p(x), for constants. */
+constexpr uint32_t crc32c_xpow_c(uint64_t n) {
+    return crc32c_engine::xpow_c(n);
+}
+
+static constexpr const uint32_t (&crc32c_sw_lookup_table)[TABLE_X][TABLE_Y] = crc32c_engine::sw::table;
+/* Tables for hardware crc that shift a crc by LONG and SHORT zeros. */
+static constexpr const uint32_t (&crc32c_long)[SHIFT_TABLE_X][SHIFT_TABLE_Y] = crc32c_engine::long_zeros::table;
+static constexpr const uint32_t (&crc32c_short)[SHIFT_TABLE_X][SHIFT_TABLE_Y] = crc32c_engine::short_zeros::table;
+
+/* The pair of constants which fold a 128-bit lane forward by bits bits:
+   x^(bits+32) for the low (earlier) 64 bits of the lane and x^(bits-32)
+   for the high 64 bits, both mod p(x). Shifting left by one lines up the
+   95-bit reflected product with the next lane. */
+#define CRC32C_FOLD_CONSTANTS(bits) \
+    {uint64_t(crc32c_xpow_c((bits) + 32)) << 1, \
+     uint64_t(crc32c_xpow_c((bits) - 32)) << 1}
+
+/* Constants for folding 128-bit lanes of data forward by 128, 512, 1024 and
+   2048 bits with a carry-less multiply. */
+constexpr uint64_t crc32c_fold_128[2] = CRC32C_FOLD_CONSTANTS(128);
+constexpr uint64_t crc32c_fold_512[2] = CRC32C_FOLD_CONSTANTS(512);
+constexpr uint64_t crc32c_fold_1024[2] = CRC32C_FOLD_CONSTANTS(1024);
+constexpr uint64_t crc32c_fold_2048[2] = CRC32C_FOLD_CONSTANTS(2048);
+
+#undef CRC32C_FOLD_CONSTANTS
+
+/* Apply the zeros operator table to crc. */
+static inline uint32_t crc32c_shift(const uint32_t zeros[SHIFT_TABLE_X][SHIFT_TABLE_Y],
+                                    uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+//
+// The interleave width and block sizes of an N-way crc32 pipeline, with
+// the shift tables to match. crc32c_hw is fixed at 3-way, LONG_BLOCK and
+// SHORT_BLOCK, which suits Nehalem through Ivy Bridge. crc32c_calibrate
+// picks the best of the candidates in crc32c.cc for the CPU we're
+// running on.
+//
+struct crc32c_hw_tuning {
+    int ways;
+    size_t long_block;
+    size_t short_block;
+    uint32_t long_table[SHIFT_TABLE_X][SHIFT_TABLE_Y];
+    uint32_t short_table[SHIFT_TABLE_X][SHIFT_TABLE_Y];
+    char description[64];
+};
+
+//
+// One crc32 instruction for each of N streams, each block bytes apart.
+// Unrolled with templates so the crcs are kept in registers, a loop over
+// the streams isn't unrolled at -O2 and then every crc goes via memory.
+//
+// Isa wraps the crc instructions of the architecture, see crc32c_sse42
+// and crc32c_armv8.
+//
+template <typename Isa, int N>
+struct crc32c_hw_step {
+    static inline void run(uint64_t* crc, const uint8_t* buf, size_t block) {
+        crc32c_hw_step<Isa, N - 1>::run(crc, buf, block);
+        crc[N - 1] = Isa::crc64(crc[N - 1],
+            *reinterpret_cast<const uint64_t*>(buf + ((N - 1) * block)));
+    }
+};
+
+template <typename Isa>
+struct crc32c_hw_step<Isa, 0> {
+    static inline void run(uint64_t*, const uint8_t*, size_t) {
+    }
+};
+
+//
+// Run WAYS independent crc32 streams over WAYS adjacent blocks of data,
+// then shift and merge them, for as long as there are WAYS blocks left.
+//
+template <typename Isa, int WAYS>
+static inline uint64_t crc32c_hw_nway_blocks(uint64_t crc0, const uint8_t*& buf_io,
+                                             size_t& len_io, const size_t block,
+                                             const uint32_t table[SHIFT_TABLE_X][SHIFT_TABLE_Y]) {
+    // work on copies so the compiler can keep them in registers
+    const uint8_t* buf = buf_io;
+    size_t len = len_io;
+    while (len >= (WAYS * block)) {
+        uint64_t crc[WAYS];
+        crc[0] = crc0;
+        for (int ii = 1; ii < WAYS; ii++) {
+            crc[ii] = 0;
+        }
+        const uint8_t* end = buf + block;
+        do
+        {
+            crc32c_hw_step<Isa, WAYS>::run(crc, buf, block);
+            buf += sizeof(uint64_t);
+        } while (buf < end);
+        crc0 = crc[0];
+        for (int ii = 1; ii < WAYS; ii++) {
+            crc0 = crc32c_shift(table, static_cast<uint32_t>(crc0)) ^ crc[ii];
+        }
+        buf += (WAYS - 1) * block;
+        len -= WAYS * block;
+    }
+    buf_io = buf;
+    len_io = len;
+    return crc0;
+}
+
+//
+// The complete N-way crc32 pipeline: align, WAYS x long_block sets, then
+// WAYS x short_block sets, then one stream for what's left. The long
+// blocks are skipped if long_table is null.
+//
+template <typename Isa, int WAYS>
+static inline uint32_t crc32c_hw_pipeline(const uint8_t* buf, size_t len, uint32_t crc_in,
+                                          size_t long_block,
+                                          const uint32_t long_table[SHIFT_TABLE_X][SHIFT_TABLE_Y],
+                                          size_t short_block,
+                                          const uint32_t short_table[SHIFT_TABLE_X][SHIFT_TABLE_Y]) {
+    uint64_t crc0 = static_cast<uint64_t>(~crc_in);
+
+    // use crc32-byte instruction until the buf pointer is 8-byte aligned
+    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+        crc0 = Isa::crc8(crc0, *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    if (long_table != nullptr) {
+        crc0 = crc32c_hw_nway_blocks<Isa, WAYS>(crc0, buf, len, long_block,
+                                                long_table);
+    }
+    crc0 = crc32c_hw_nway_blocks<Isa, WAYS>(crc0, buf, len, short_block,
+                                            short_table);
+
+    // use crc32-64 instruction until there's no more 64-bits to eat
+    while (len >= sizeof(uint64_t)) {
+        crc0 = Isa::crc64(crc0, *reinterpret_cast<const uint64_t*>(buf));
+        buf += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+
+    // finish the rest using the byte instruction
+    while (len > 0) {
+        crc0 = Isa::crc8(crc0, *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    return static_cast<uint32_t>(crc0 ^ std::numeric_limits<uint32_t>::max());
+}
+
+// Software kernels, crc32c.cc
+uint32_t crc32c_sw_1way(const uint8_t* buf, size_t len, uint32_t crc_in);
+uint32_t crc32c_sw_short_block(const uint8_t* buf, size_t len, uint32_t crc_in);
+uint32_t crc32c_sw(const uint8_t* buf, size_t len, uint32_t crc_in);
+
+//
+// The hardware interface, implemented by the file for the architecture
+// being built, or by stubs in crc32c.cc for one without crc instructions.
+//
+
+// True if the CPU has the crc instructions crc32c_hw* are built on.
+bool crc32c_hw_available();
+
+#if defined(CRC32C_HW_X86)
+// True if the CPU has PCLMULQDQ, for crc32c_hw_pclmul and crc_pclmul.
+bool crc32c_hw_pclmul_available();
+#endif
+
+// The fastest kernel for this CPU by feature detection alone, or null
+// if there's no hardware support.
+crc32c_function crc32c_hw_select();
+
+// Kernels beyond the crc32 pipeline which the CPU supports, for
+// crc32c_calibrate to race against the tuned pipeline.
+std::vector<crc32c_function> crc32c_hw_candidates();
+
+// Describe one of the kernels from crc32c_hw_candidates, or null if f
+// isn't one of them.
+const char* crc32c_hw_kernel_name(crc32c_function f);
+
+// The fixed 3-way LONG_BLOCK/SHORT_BLOCK pipeline and its short-block
+// and single stream versions.
+uint32_t crc32c_hw_1way(const uint8_t* buf, size_t len, uint32_t crc_in);
+uint32_t crc32c_hw_short_block(const uint8_t* buf, size_t len, uint32_t crc_in);
+uint32_t crc32c_hw(const uint8_t* buf, size_t len, uint32_t crc_in);
+
+// The pipeline with the interleave width and block sizes from tuning.
+uint32_t crc32c_hw_nway(const crc32c_hw_tuning& tuning,
+                        const uint8_t* buf, size_t len, uint32_t crc_in);
+
+// crc32c_multi, see crc32c_hw_multi_lanes.
+void crc32c_hw_multi(const uint8_t* bufs[], const size_t lens[],
+                     uint32_t out[], size_t n);
+
+// memcpy with non-temporal stores, so dst doesn't displace the cache, or
+// plain memcpy where the architecture file doesn't have one.
+void crc32c_copy_stream(uint8_t* dst, const uint8_t* src, size_t len);
+
+//
+// crc32c_hw_multi_lanes leaves buffers shorter than MULTI_MIN_LEN to
+// crc32c, crc32c_hw_tail needs a whole word. Longer buffers than
+// MULTI_MAX_LEN go to crc32c too, from there on crc32c is no longer
+// latency bound: it has either the 3-way pipeline or folding.
+//
+const size_t MULTI_MIN_LEN = sizeof(uint64_t);
+const size_t MULTI_MAX_LEN = 3 * SHORT_BLOCK;
+
+//
+// Advance N independent crc32 streams by 8 bytes, each through its own
+// buffer.
+//
+template <typename Isa, int N>
+struct crc32c_hw_multi_step {
+    static inline void run(uint64_t* crc, const uint8_t** buf) {
+        crc32c_hw_multi_step<Isa, N - 1>::run(crc, buf);
+        crc[N - 1] = Isa::crc64(crc[N - 1],
+                                *reinterpret_cast<const uint64_t*>(buf[N - 1]));
+        buf[N - 1] += sizeof(uint64_t);
+    }
+};
+
+template <typename Isa>
+struct crc32c_hw_multi_step<Isa, 0> {
+    static inline void run(uint64_t*, const uint8_t**) {
+    }
+};
+
+//
+// Finish a crc32 stream with the last len (0 to 7) bytes before end, in
+// one crc32 instruction and no branches to mispredict. The bytes are the
+// top of the word ending at end, which must all be readable. Crc'ing
+// them from a state of 0 at the top of a word of zeros gives the same
+// answer as crc'ing them from crc with the byte instruction, once crc is
+// xor'd into the data and what's left of crc after len bytes is xor'd
+// back in. The shifts are split in two so a shift of 64 comes out as 0.
+//
+template <typename Isa>
+static inline uint64_t crc32c_hw_tail(uint64_t crc, const uint8_t* end, size_t len) {
+    const unsigned bits = static_cast<unsigned>(len * 8);
+    uint64_t data = *reinterpret_cast<const uint64_t*>(end - sizeof(uint64_t));
+    data = (data >> (63 - bits)) >> 1;
+    return Isa::crc64(0, ((crc ^ data) << (63 - bits)) << 1) ^ (crc >> bits);
+}
+
+//
+// crc32c of n separate buffers, WAYS at a time. The crc32 instruction of
+// one buffer has to wait for the one before, so on its own a small buffer
+// only uses a fraction of the crc unit. Each group of WAYS buffers runs in
+// lock step until the shortest is down to its last few bytes, then the
+// rest of each is finished independently. The loads are unaligned, which
+// x86-64 and ARMv8 both handle at full speed, so there's no byte-at-a-time
+// alignment with its hard to predict branches.
+//
+template <typename Isa, int WAYS>
+static inline void crc32c_hw_multi_lanes(const uint8_t* bufs[], const size_t lens[],
+                                         uint32_t out[], size_t n) {
+    const uint8_t* buf[WAYS];
+    size_t left[WAYS];
+    uint64_t crc[WAYS];
+    size_t index[WAYS];
+    size_t next = 0;
+
+    for (;;) {
+        int lanes = 0;
+        while (lanes < WAYS && next < n) {
+            if (lens[next] < MULTI_MIN_LEN || lens[next] > MULTI_MAX_LEN) {
+                out[next] = crc32c(bufs[next], lens[next], 0);
+            } else {
+                buf[lanes] = bufs[next];
+                left[lanes] = lens[next];
+                crc[lanes] = std::numeric_limits<uint32_t>::max();
+                index[lanes] = next;
+                lanes++;
+            }
+            next++;
+        }
+
+        size_t words = 0;
+        if (lanes == WAYS) {
+            words = left[0];
+            for (int ii = 1; ii < WAYS; ii++) {
+                words = left[ii] < words ? left[ii] : words;
+            }
+            words /= sizeof(uint64_t);
+            for (size_t ii = 0; ii < words; ii++) {
+                crc32c_hw_multi_step<Isa, WAYS>::run(crc, buf);
+            }
+        }
+
+        for (int ii = 0; ii < lanes; ii++) {
+            size_t len = left[ii] - (words * sizeof(uint64_t));
+            const uint8_t* ptr = buf[ii];
+            uint64_t crc0 = crc[ii];
+            while (len >= sizeof(uint64_t)) {
+                crc0 = Isa::crc64(crc0, *reinterpret_cast<const uint64_t*>(ptr));
+                ptr += sizeof(uint64_t);
+                len -= sizeof(uint64_t);
+            }
+            crc0 = crc32c_hw_tail<Isa>(crc0, ptr + len, len);
+            out[index[ii]] = static_cast<uint32_t>(crc0 ^ std::numeric_limits<uint32_t>::max());
+        }
+
+        if (lanes < WAYS) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,658 @@
+ /* crc32c.c -- compute CRC-32C using the Intel crc32 instruction
+  * Copyright (C) 2013 Mark Adler
+  * Version 1.1  1 Aug 2013  Mark Adler
+  */
+
+/*
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the author be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+
+  Mark Adler
+  madler@alumni.caltech.edu
+ */
+
+//
+// SSE4.2 crc32 and carry-less multiply (PCLMULQDQ/VPCLMULQDQ) crc32c
+// kernels for x86-64, see crc32c.cc for the history and the dispatcher.
+// Built with -msse4.2; the carry-less multiply kernels are only called
+// when cpuid says they're available.
+//
+
+#include "crc32c_private.h"
+
+#if defined(CRC32C_HW_X86)
+
+// select header file for cpuid, crc and carry-less multiply instructions.
+#if defined(WIN32)
+#include <nmmintrin.h>
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__clang__)
+#include <cpuid.h>
+#include <smmintrin.h>
+#include <immintrin.h>
+#elif defined(__GNUC__)
+#include <smmintrin.h>
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#include <array>
+#include <cstring>
+#include <limits>
+
+// The carry-less multiply kernels are compiled for instruction sets beyond
+// the -msse4.2 baseline of this file and are only called when cpuid says
+// they are available. MSVC needs no attribute to use the intrinsics.
+#if defined(__GNUC__)
+#define CRC32C_TARGET(isa) __attribute__ ((target (isa)))
+#else
+#define CRC32C_TARGET(isa)
+#endif
+
+// VPCLMULQDQ intrinsics need GCC 8, clang 6 or VS2019.
+#if (defined(__clang__) && __clang_major__ >= 6) || \
+    (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 8) || \
+    (defined(_MSC_VER) && _MSC_VER >= 1920)
+#define CRC32C_HAVE_VPCLMUL 1
+#endif
+
+/* Below these sizes the set-up and final reduction of the folding kernels
+   costs more than it saves, so they hand over to the next tier down. */
+const size_t PCLMUL_MIN = 256;
+const size_t VPCLMUL_MIN = 1024;
+/* Number of 128-bit lanes folded in parallel by crc32c_hw_pclmul, enough to
+   cover the latency of the carry-less multiply. */
+const int PCLMUL_LANES = 8;
+/* Number of buffers crc32c_hw_multi keeps in flight. The crc32 instruction
+   has a latency of 3 and a throughput of 1, the fourth buffer covers the
+   loads and loop overhead. */
+const int MULTI_WAYS = 4;
+
+//
+// CRC32-C implementation using SSE4.2 acceleration
+// no pipeline optimisation.
+//
+uint32_t crc32c_hw_1way (const uint8_t* buf, size_t len, uint32_t crc_in) {
+    uint64_t crc = static_cast<uint64_t>(~crc_in);
+    // use crc32-byte instruction until the buf pointer is 8-byte aligned
+    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+        crc = _mm_crc32_u8(static_cast<uint32_t>(crc), *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    // use crc32-64 instruction until there's no more 64-bits to eat
+    while (len >= sizeof(uint64_t)) {
+        crc = _mm_crc32_u64(crc, *reinterpret_cast<const uint64_t*>(buf));
+        buf += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+
+    // finish the rest using the byte instruction
+    while (len > 0) {
+        crc = _mm_crc32_u8(static_cast<uint32_t>(crc), *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    return static_cast<uint32_t>(crc ^ std::numeric_limits<uint32_t>::max());
+}
+
+//
+// HW assisted crc32c that processes as much data in parallel using 3xSHORT_BLOCKs
+//
+uint32_t crc32c_hw_short_block (const uint8_t* buf, size_t len, uint32_t crc_in) {
+
+    // If len is less the 3xSHORT_BLOCK just use the 1-way hw version
+    if (len < (3*SHORT_BLOCK)) {
+        return crc32c_hw_1way(buf, len, crc_in);
+    }
+
+    uint64_t crc0 = static_cast<uint64_t>(~crc_in), crc1 = 0, crc2 = 0;
+
+    // use crc32-byte instruction until the buf pointer is 8-byte aligned
+    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    // process the data using 3 pipelined crc working on 3 blocks of SHORT_BLOCK
+    while (len >= (3 * SHORT_BLOCK)) {
+        crc1 = 0;
+        crc2 = 0;
+        const uint8_t* end = buf + SHORT_BLOCK;
+        do
+        {
+            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
+            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t*>(buf + SHORT_BLOCK));
+            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t*>(buf + (2 * SHORT_BLOCK)));
+            buf += sizeof(uint64_t);
+        } while (buf < end);
+        crc0 = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc0)) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc0)) ^ crc2;
+        buf += 2 * SHORT_BLOCK;
+        len -= 3 * SHORT_BLOCK;
+    }
+
+    // use crc32-64 instruction until there's no more 64-bits to eat
+    while (len >= sizeof(uint64_t)) {
+        crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
+        buf += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+
+    // finish the rest using the byte instruction
+    while (len > 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    return static_cast<uint32_t>(crc0 ^ std::numeric_limits<uint32_t>::max());
+}
+
+
+//
+// A parallelised crc32c issuing 3 crc at once.
+// Generally 3 crc instructions can be issued at once.
+//
+uint32_t crc32c_hw(const uint8_t* buf, size_t len, uint32_t crc_in) {
+
+    // if len is less than the long block it's faster to just process using 3way short-block
+    if (len < 3*LONG_BLOCK) {
+        return crc32c_hw_short_block(buf, len, crc_in);
+    }
+
+    uint64_t crc0 = static_cast<uint64_t>(~crc_in), crc1 = 0, crc2 = 0;
+
+    // use crc32-byte instruction until the buf pointer is 8-byte aligned
+    while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    /* compute the crc on sets of LONG_BLOCK*3 bytes, executing three independent crc
+       instructions, each on LONG_BLOCK bytes -- this is optimized for the Nehalem,
+       Westmere, Sandy Bridge, and Ivy Bridge architectures, which have a
+       throughput of one crc per cycle, but a latency of three cycles */
+    while (len >= (3 * LONG_BLOCK)) {
+        crc1 = 0;
+        crc2 = 0;
+        const uint8_t* end = buf + LONG_BLOCK;
+        do
+        {
+            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
+            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t*>(buf + LONG_BLOCK));
+            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t*>(buf + (2 * LONG_BLOCK)));
+            buf += sizeof(uint64_t);
+        } while (buf < end);
+        crc0 = crc32c_shift(crc32c_long, static_cast<uint32_t>(crc0)) ^ crc1;
+        crc0 = crc32c_shift(crc32c_long, static_cast<uint32_t>(crc0)) ^ crc2;
+        buf += 2 * LONG_BLOCK;
+        len -= 3 * LONG_BLOCK;
+    }
+
+    /* do the same thing, but now on SHORT_BLOCK*3 blocks for the remaining data less
+       than a LONG_BLOCK*3 block */
+    while (len >= (3 * SHORT_BLOCK)) {
+        crc1 = 0;
+        crc2 = 0;
+        const uint8_t* end = buf + SHORT_BLOCK;
+        do
+        {
+            crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
+            crc1 = _mm_crc32_u64(crc1, *reinterpret_cast<const uint64_t*>(buf + SHORT_BLOCK));
+            crc2 = _mm_crc32_u64(crc2, *reinterpret_cast<const uint64_t*>(buf + (2 * SHORT_BLOCK)));
+            buf += sizeof(uint64_t);
+        } while (buf < end);
+        crc0 = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc0)) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short, static_cast<uint32_t>(crc0)) ^ crc2;
+        buf += 2 * SHORT_BLOCK;
+        len -= 3 * SHORT_BLOCK;
+    }
+
+    // use crc32-64 instruction until there's no more 64-bits to eat
+    while (len >= sizeof(uint64_t)) {
+        crc0 = _mm_crc32_u64(crc0, *reinterpret_cast<const uint64_t*>(buf));
+        buf += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+
+    // finish the rest using the byte instruction
+    while (len > 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    return static_cast<uint32_t>(crc0 ^ std::numeric_limits<uint32_t>::max());
+}
+
+//
+// Fold a 128-bit lane of data forward over the distance k was built for,
+// see CRC32C_FOLD_CONSTANTS in crc32c_private.h.
+//
+CRC32C_TARGET("sse4.2,pclmul")
+static inline __m128i crc32c_fold(__m128i x, __m128i k) {
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+                         _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+//
+// Fold the remaining 16-byte pieces of buf into the lane x, then finish
+// with the crc32 instruction. x holds data with the same crc as everything
+// folded into it, so its crc can be taken as if it were 16 bytes of input.
+//
+CRC32C_TARGET("sse4.2,pclmul")
+static inline uint32_t crc32c_fold_finish(__m128i x, const uint8_t* buf, size_t len) {
+    const __m128i k128 = _mm_set_epi64x(crc32c_fold_128[1], crc32c_fold_128[0]);
+    while (len >= sizeof(__m128i)) {
+        x = _mm_xor_si128(crc32c_fold(x, k128),
+                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf)));
+        buf += sizeof(__m128i);
+        len -= sizeof(__m128i);
+    }
+
+    uint64_t crc0 = _mm_crc32_u64(0, _mm_cvtsi128_si64(x));
+    crc0 = _mm_crc32_u64(crc0, _mm_extract_epi64(x, 1));
+
+    // finish the rest using the byte instruction
+    while (len > 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *buf);
+        buf += sizeof(uint8_t);
+        len -= sizeof(uint8_t);
+    }
+
+    return static_cast<uint32_t>(crc0 ^ std::numeric_limits<uint32_t>::max());
+}
+
+//
+// HW assisted crc32c using PCLMULQDQ to fold eight independent 128-bit lanes
+// forward 128 bytes at a time. The lanes are then folded into one, which is
+// reduced to a crc with the SSE4.2 crc32 instruction.
+//
+CRC32C_TARGET("sse4.2,pclmul")
+uint32_t crc32c_hw_pclmul(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    if (len < PCLMUL_MIN) {
+        return crc32c_hw_short_block(buf, len, crc_in);
+    }
+
+    const __m128i k1024 = _mm_set_epi64x(crc32c_fold_1024[1], crc32c_fold_1024[0]);
+    const __m128i k128 = _mm_set_epi64x(crc32c_fold_128[1], crc32c_fold_128[0]);
+    const __m128i* data = reinterpret_cast<const __m128i*>(buf);
+    __m128i x[PCLMUL_LANES];
+
+    for (int ii = 0; ii < PCLMUL_LANES; ii++) {
+        x[ii] = _mm_loadu_si128(data + ii);
+    }
+    // the initial crc is xor'd into the first 4 bytes of data
+    x[0] = _mm_xor_si128(x[0], _mm_cvtsi32_si128(static_cast<int>(~crc_in)));
+    buf += PCLMUL_LANES * sizeof(__m128i);
+    len -= PCLMUL_LANES * sizeof(__m128i);
+
+    while (len >= PCLMUL_LANES * sizeof(__m128i)) {
+        data = reinterpret_cast<const __m128i*>(buf);
+        for (int ii = 0; ii < PCLMUL_LANES; ii++) {
+            x[ii] = _mm_xor_si128(crc32c_fold(x[ii], k1024),
+                                  _mm_loadu_si128(data + ii));
+        }
+        buf += PCLMUL_LANES * sizeof(__m128i);
+        len -= PCLMUL_LANES * sizeof(__m128i);
+    }
+
+    // fold the lanes into one
+    for (int ii = 1; ii < PCLMUL_LANES; ii++) {
+        x[0] = _mm_xor_si128(crc32c_fold(x[0], k128), x[ii]);
+    }
+
+    return crc32c_fold_finish(x[0], buf, len);
+}
+
+#ifdef CRC32C_HAVE_VPCLMUL
+//
+// Fold four 128-bit lanes of data at once with VPCLMULQDQ, xor'ing in the
+// next 64 bytes of data.
+//
+CRC32C_TARGET("sse4.2,pclmul,avx512f,vpclmulqdq")
+static inline __m512i crc32c_fold_x4(__m512i x, __m512i k, const uint8_t* buf) {
+    // 0x96 is a three way xor
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),
+                                     _mm512_clmulepi64_epi128(x, k, 0x11),
+                                     _mm512_loadu_si512(buf),
+                                     0x96);
+}
+
+//
+// HW assisted crc32c using AVX-512 VPCLMULQDQ, the same folding as
+// crc32c_hw_pclmul but with sixteen 128-bit lanes in four 512-bit
+// registers, consuming 256 bytes per step.
+//
+CRC32C_TARGET("sse4.2,pclmul,avx512f,vpclmulqdq")
+uint32_t crc32c_hw_vpclmul(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    if (len < VPCLMUL_MIN) {
+        return crc32c_hw_pclmul(buf, len, crc_in);
+    }
+
+    const __m512i k2048 = _mm512_broadcast_i32x4(
+        _mm_set_epi64x(crc32c_fold_2048[1], crc32c_fold_2048[0]));
+    const __m512i k512 = _mm512_broadcast_i32x4(
+        _mm_set_epi64x(crc32c_fold_512[1], crc32c_fold_512[0]));
+    const __m128i k128 = _mm_set_epi64x(crc32c_fold_128[1], crc32c_fold_128[0]);
+
+    // the initial crc is xor'd into the first 4 bytes of data
+    __m512i x0 = _mm512_xor_si512(_mm512_loadu_si512(buf),
+        _mm512_inserti32x4(_mm512_setzero_si512(),
+                           _mm_cvtsi32_si128(static_cast<int>(~crc_in)), 0));
+    __m512i x1 = _mm512_loadu_si512(buf + sizeof(__m512i));
+    __m512i x2 = _mm512_loadu_si512(buf + (2 * sizeof(__m512i)));
+    __m512i x3 = _mm512_loadu_si512(buf + (3 * sizeof(__m512i)));
+    buf += 4 * sizeof(__m512i);
+    len -= 4 * sizeof(__m512i);
+
+    while (len >= 4 * sizeof(__m512i)) {
+        x0 = crc32c_fold_x4(x0, k2048, buf);
+        x1 = crc32c_fold_x4(x1, k2048, buf + sizeof(__m512i));
+        x2 = crc32c_fold_x4(x2, k2048, buf + (2 * sizeof(__m512i)));
+        x3 = crc32c_fold_x4(x3, k2048, buf + (3 * sizeof(__m512i)));
+        buf += 4 * sizeof(__m512i);
+        len -= 4 * sizeof(__m512i);
+    }
+
+    // fold the 4 registers into one, then any remaining 64 byte pieces
+    x0 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x0, k512, 0x00),
+                                   _mm512_clmulepi64_epi128(x0, k512, 0x11),
+                                   x1, 0x96);
+    x0 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x0, k512, 0x00),
+                                   _mm512_clmulepi64_epi128(x0, k512, 0x11),
+                                   x2, 0x96);
+    x0 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x0, k512, 0x00),
+                                   _mm512_clmulepi64_epi128(x0, k512, 0x11),
+                                   x3, 0x96);
+    while (len >= sizeof(__m512i)) {
+        x0 = crc32c_fold_x4(x0, k512, buf);
+        buf += sizeof(__m512i);
+        len -= sizeof(__m512i);
+    }
+
+    // fold the 4 lanes of the register into one
+    __m128i x = _mm512_extracti32x4_epi32(x0, 0);
+    x = _mm_xor_si128(crc32c_fold(x, k128), _mm512_extracti32x4_epi32(x0, 1));
+    x = _mm_xor_si128(crc32c_fold(x, k128), _mm512_extracti32x4_epi32(x0, 2));
+    x = _mm_xor_si128(crc32c_fold(x, k128), _mm512_extracti32x4_epi32(x0, 3));
+
+    return crc32c_fold_finish(x, buf, len);
+}
+#else
+uint32_t crc32c_hw_vpclmul(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_hw_pclmul(buf, len, crc_in);
+}
+#endif
+
+//
+// PCLMULQDQ folding for the other crcs of crc_engine.h, which have no crc32
+// instruction: eight 128-bit lanes folded forward 128 bytes at a time, as
+// crc32c_hw_pclmul, then the one remaining lane and the tail are finished
+// with the engine's slicing-by-16.
+//
+template <typename T, uint64_t Poly>
+CRC32C_TARGET("sse4.2,pclmul")
+T crc_pclmul(const uint8_t* buf, size_t len, T crc_in) {
+    typedef crc_engine<T, Poly> Engine;
+    static constexpr uint64_t fold_1024[2] = {Engine::fold_c(1024 + 64),
+                                              Engine::fold_c(1024)};
+    static constexpr uint64_t fold_128[2] = {Engine::fold_c(128 + 64),
+                                             Engine::fold_c(128)};
+
+    if (len < PCLMUL_MIN) {
+        return Engine::sw_short_block(buf, len, crc_in);
+    }
+
+    const __m128i k1024 = _mm_set_epi64x(fold_1024[1], fold_1024[0]);
+    const __m128i k128 = _mm_set_epi64x(fold_128[1], fold_128[0]);
+    const __m128i* data = reinterpret_cast<const __m128i*>(buf);
+    __m128i x[PCLMUL_LANES];
+
+    for (int ii = 0; ii < PCLMUL_LANES; ii++) {
+        x[ii] = _mm_loadu_si128(data + ii);
+    }
+    // the initial crc is xor'd into the first Engine::bytes of data
+    x[0] = _mm_xor_si128(x[0], _mm_cvtsi64_si128(
+        static_cast<long long>(static_cast<T>(~crc_in))));
+    buf += PCLMUL_LANES * sizeof(__m128i);
+    len -= PCLMUL_LANES * sizeof(__m128i);
+
+    while (len >= PCLMUL_LANES * sizeof(__m128i)) {
+        data = reinterpret_cast<const __m128i*>(buf);
+        for (int ii = 0; ii < PCLMUL_LANES; ii++) {
+            x[ii] = _mm_xor_si128(crc32c_fold(x[ii], k1024),
+                                  _mm_loadu_si128(data + ii));
+        }
+        buf += PCLMUL_LANES * sizeof(__m128i);
+        len -= PCLMUL_LANES * sizeof(__m128i);
+    }
+
+    // fold the lanes into one, then any remaining 16 byte pieces
+    for (int ii = 1; ii < PCLMUL_LANES; ii++) {
+        x[0] = _mm_xor_si128(crc32c_fold(x[0], k128), x[ii]);
+    }
+    while (len >= sizeof(__m128i)) {
+        x[0] = _mm_xor_si128(crc32c_fold(x[0], k128),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf)));
+        buf += sizeof(__m128i);
+        len -= sizeof(__m128i);
+    }
+
+    // the lane has the same crc as everything folded into it
+    uint8_t lane[sizeof(__m128i)];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lane), x[0]);
+    uint64_t crc = Engine::sw_1way_raw(0, lane, sizeof(lane));
+    crc = Engine::sw_1way_raw(crc, buf, len);
+    return static_cast<T>(crc ^ std::numeric_limits<T>::max());
+}
+
+template uint32_t
+crc_pclmul<uint32_t, 0xEDB88320>(const uint8_t*, size_t, uint32_t);
+template uint64_t
+crc_pclmul<uint64_t, 0xC96C5795D7870F42>(const uint8_t*, size_t, uint64_t);
+
+//
+// The SSE4.2 crc32 instructions for crc32c_hw_pipeline.
+//
+struct crc32c_sse42 {
+    static inline uint64_t crc8(uint64_t crc, uint8_t data) {
+        return _mm_crc32_u8(static_cast<uint32_t>(crc), data);
+    }
+    static inline uint64_t crc64(uint64_t crc, uint64_t data) {
+        return _mm_crc32_u64(crc, data);
+    }
+};
+
+template <int WAYS>
+static uint32_t crc32c_hw_nway(const crc32c_hw_tuning& tuning,
+                               const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return crc32c_hw_pipeline<crc32c_sse42, WAYS>(buf, len, crc_in,
+                                                  tuning.long_block, tuning.long_table,
+                                                  tuning.short_block, tuning.short_table);
+}
+
+uint32_t crc32c_hw_nway(const crc32c_hw_tuning& tuning,
+                        const uint8_t* buf, size_t len, uint32_t crc_in) {
+    switch (tuning.ways) {
+    case 4:
+        return crc32c_hw_nway<4>(tuning, buf, len, crc_in);
+    case 6:
+        return crc32c_hw_nway<6>(tuning, buf, len, crc_in);
+    default:
+        return crc32c_hw_nway<3>(tuning, buf, len, crc_in);
+    }
+}
+
+void crc32c_hw_multi(const uint8_t* bufs[], const size_t lens[],
+                     uint32_t out[], size_t n) {
+    crc32c_hw_multi_lanes<crc32c_sse42, MULTI_WAYS>(bufs, lens, out, n);
+}
+
+//
+// Copy with SSE2 non-temporal stores, 64 bytes (a cache line) at a time
+// once dst is 16-byte aligned. The sfence orders the streamed stores
+// before anything which follows.
+//
+void crc32c_copy_stream(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t head = (sizeof(__m128i) - (reinterpret_cast<uintptr_t>(dst) &
+                                      (sizeof(__m128i) - 1))) & (sizeof(__m128i) - 1);
+    if (head > len) {
+        head = len;
+    }
+    std::memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+
+    while (len >= 4 * sizeof(__m128i)) {
+        const __m128i* in = reinterpret_cast<const __m128i*>(src);
+        __m128i* out = reinterpret_cast<__m128i*>(dst);
+        __m128i x0 = _mm_loadu_si128(in);
+        __m128i x1 = _mm_loadu_si128(in + 1);
+        __m128i x2 = _mm_loadu_si128(in + 2);
+        __m128i x3 = _mm_loadu_si128(in + 3);
+        _mm_stream_si128(out, x0);
+        _mm_stream_si128(out + 1, x1);
+        _mm_stream_si128(out + 2, x2);
+        _mm_stream_si128(out + 3, x3);
+        dst += 4 * sizeof(__m128i);
+        src += 4 * sizeof(__m128i);
+        len -= 4 * sizeof(__m128i);
+    }
+    _mm_sfence();
+
+    std::memcpy(dst, src, len);
+}
+
+
+//
+// The instruction set extensions the crc32c kernels can make use of.
+//
+struct crc32c_cpu_features {
+    bool sse42;
+    bool pclmul;
+    bool avx512_vpclmul;
+};
+
+static crc32c_cpu_features get_cpu_features() {
+    const uint32_t SSE42 = 0x00100000;
+    const uint32_t PCLMULQDQ = 0x00000002;
+    const uint32_t OSXSAVE = 0x08000000;
+    const uint32_t AVX512F = 0x00010000; // cpuid leaf 7, ebx
+    const uint32_t VPCLMULQDQ = 0x00000400; // cpuid leaf 7, ecx
+    // XCR0 bits for the OS saving SSE, AVX and AVX-512 register state
+    const uint64_t XCR0_AVX512 = 0xe6;
+
+    crc32c_cpu_features features = {false, false, false};
+
+#if defined(WIN32)
+    std::array<int, 4> registers = {{0,0,0,0}};
+    __cpuid(registers.data(), 1);
+#else
+    std::array<uint32_t, 4> registers = {{0,0,0,0}};
+    __get_cpuid(1, &registers[0], &registers[1], &registers[2],&registers[3]);
+#endif
+
+    features.sse42 = (registers[2] & SSE42) != 0;
+    features.pclmul = features.sse42 && (registers[2] & PCLMULQDQ) != 0;
+
+#ifdef CRC32C_HAVE_VPCLMUL
+    if (!features.pclmul || !(registers[2] & OSXSAVE)) {
+        return features;
+    }
+
+    // Only use the AVX-512 registers if the OS saves them on a context switch
+#if defined(WIN32)
+    uint64_t xcr0 = _xgetbv(0);
+    __cpuidex(registers.data(), 7, 0);
+#else
+    uint32_t xcr0_lo = 0, xcr0_hi = 0;
+    __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    uint64_t xcr0 = (static_cast<uint64_t>(xcr0_hi) << 32) | xcr0_lo;
+    registers = {{0,0,0,0}};
+    if (__get_cpuid_max(0, nullptr) >= 7) {
+        __cpuid_count(7, 0, registers[0], registers[1], registers[2], registers[3]);
+    }
+#endif
+
+    features.avx512_vpclmul = (xcr0 & XCR0_AVX512) == XCR0_AVX512 &&
+                              (registers[1] & AVX512F) &&
+                              (registers[2] & VPCLMULQDQ);
+#endif
+    return features;
+}
+
+bool crc32c_hw_pclmul_available() {
+    return get_cpu_features().pclmul;
+}
+
+bool crc32c_hw_vpclmul_available() {
+    return get_cpu_features().avx512_vpclmul;
+}
+
+bool crc32c_hw_available() {
+    return get_cpu_features().sse42;
+}
+
+//
+// If SSE4.2 is available then hardware acceleration is used, with
+// carry-less multiply folding on top if that's available too.
+//
+crc32c_function crc32c_hw_select() {
+    crc32c_cpu_features features = get_cpu_features();
+
+    if (features.avx512_vpclmul) {
+        return crc32c_hw_vpclmul;
+    } else if (features.pclmul) {
+        return crc32c_hw_pclmul;
+    } else if (features.sse42) {
+        return crc32c_hw;
+    }
+    return nullptr;
+}
+
+std::vector<crc32c_function> crc32c_hw_candidates() {
+    crc32c_cpu_features features = get_cpu_features();
+    std::vector<crc32c_function> candidates;
+
+    if (features.pclmul) {
+        candidates.push_back(crc32c_hw_pclmul);
+    }
+    if (features.avx512_vpclmul) {
+        candidates.push_back(crc32c_hw_vpclmul);
+    }
+    return candidates;
+}
+
+const char* crc32c_hw_kernel_name(crc32c_function f) {
+    if (f == crc32c_hw_vpclmul) {
+        return "avx512 vpclmulqdq 16x128";
+    } else if (f == crc32c_hw_pclmul) {
+        return "pclmulqdq 8x128";
+    }
+    return nullptr;
+}
+
+#endif // CRC32C_HW_X86
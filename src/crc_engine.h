@@ -0,0 +1,415 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// The software crc engine for any reflected CRC of up to 64 bits, with
+// the polynomial as a template parameter. crc32c is an instance of it
+// (see crc32c_private.h) as are the Couchbase::Crc variants (see crc.cc).
+//
+// All of the tables are generated at compile time by the constexpr
+// functions of crc_poly, so they're read-only data shared by every process
+// using the library and are ready before any static initialiser can need
+// them. C++11 constexpr functions are a single return statement, hence the
+// recursion.
+//
+// The code, crc_engine, is in an anonymous namespace. This header is
+// included by crc32c_sse4_2.cc, which is built with -msse4.2, and its
+// copies of the kernels mustn't be shared with the other files as weak
+// symbols, or the linker could pick them for the portable fallback.
+//
+// Polynomials are in the reflected bit order of the crc, where the top
+// bit of the crc is the x^0 coefficient. For example CRC-32C's 0x1EDC6F41
+// is 0x82F63B78.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <limits>
+
+/* Block sizes for three-way parallel crc computation.  LONG and SHORT must
+   both be powers of two. */
+const int LONG_BLOCK = 8192;
+const int SHORT_BLOCK = 256;
+
+const uintptr_t ALIGN64_MASK = sizeof(uint64_t)-1;
+
+template <size_t... I>
+struct crc_index_sequence {
+};
+
+template <typename A, typename B>
+struct crc_index_concat;
+
+template <size_t... A, size_t... B>
+struct crc_index_concat<crc_index_sequence<A...>, crc_index_sequence<B...>> {
+    typedef crc_index_sequence<A..., (sizeof...(A) + B)...> type;
+};
+
+/* 0..N-1, built in halves so the template depth is log2(N), a table of
+   2048 entries would be well past the compilers' limits otherwise. */
+template <size_t N>
+struct crc_make_index_sequence {
+    typedef typename crc_index_concat<
+        typename crc_make_index_sequence<N / 2>::type,
+        typename crc_make_index_sequence<N - (N / 2)>::type>::type type;
+};
+
+template <>
+struct crc_make_index_sequence<0> {
+    typedef crc_index_sequence<> type;
+};
+
+template <>
+struct crc_make_index_sequence<1> {
+    typedef crc_index_sequence<0> type;
+};
+
+template <typename Engine, typename Seq>
+struct crc_sw_table;
+
+template <typename Engine, size_t... I>
+struct crc_sw_table<Engine, crc_index_sequence<I...>> {
+    /* Slicing-by-16: row k applies 8 * (k + 1) zero bits to a byte. The
+       entries are listed flat and brace elision fills in the rows. */
+    static constexpr typename Engine::value_type table[16][256] = {
+        Engine::bits(I % 256, 8 * ((I / 256) + 1))...
+    };
+};
+
+template <typename Engine, size_t... I>
+constexpr typename Engine::value_type
+crc_sw_table<Engine, crc_index_sequence<I...>>::table[16][256];
+
+template <typename Engine, uint64_t Op, typename Seq>
+struct crc_zeros_table;
+
+template <typename Engine, uint64_t Op, size_t... I>
+struct crc_zeros_table<Engine, Op, crc_index_sequence<I...>> {
+    /* Row k applies the zeros operator Op, x^(8 * bytes) mod p(x), to
+       byte k of a crc. */
+    static constexpr typename Engine::value_type table[Engine::bytes][256] = {
+        Engine::multmodp_c(Op, static_cast<typename Engine::value_type>(I % 256)
+                                   << (8 * (I / 256)))...
+    };
+};
+
+template <typename Engine, uint64_t Op, size_t... I>
+constexpr typename Engine::value_type
+crc_zeros_table<Engine, Op, crc_index_sequence<I...>>::table[Engine::bytes][256];
+
+template <typename Engine, typename Seq>
+struct crc_x2n_table;
+
+template <typename Engine, size_t... I>
+struct crc_x2n_table<Engine, crc_index_sequence<I...>> {
+    /* x^(2^n) mod p(x) for n = 0..63. */
+    static constexpr typename Engine::value_type table[64] = {
+        Engine::xpow_c(uint64_t(1) << I)...
+    };
+};
+
+template <typename Engine, size_t... I>
+constexpr typename Engine::value_type
+crc_x2n_table<Engine, crc_index_sequence<I...>>::table[64];
+
+template <typename T, uint64_t Poly>
+struct crc_poly {
+    typedef T value_type;
+    static constexpr int bytes = sizeof(T);
+    static constexpr int width = 8 * sizeof(T);
+    static constexpr T top = T(1) << (width - 1); /* x^0 */
+
+    /* Run n zero bits through crc, one at a time. Multiplying by x^n. */
+    static constexpr T bits(T crc, int n) {
+        return n == 0 ? crc :
+            bits(crc & 1 ? (crc >> 1) ^ T(Poly) : crc >> 1, n - 1);
+    }
+
+    /* Multiply a and b modulo p(x), m being the bit of a to start at. */
+    static constexpr T multmodp_c(T a, T b, T m = top) {
+        return m == 0 ? 0 :
+            ((a & m) ? b : 0) ^ multmodp_c(a, bits(b, 1), m >> 1);
+    }
+
+    static constexpr T square_c(T a) {
+        return multmodp_c(a, a);
+    }
+
+    /* x^n mod p(x) by square and multiply. */
+    static constexpr T xpow_c(uint64_t n) {
+        return n == 0 ? top :
+            (n & 1) ? bits(xpow_c(n - 1), 1) : square_c(xpow_c(n / 2));
+    }
+
+    /* A 64-bit PCLMULQDQ constant which multiplies a 64-bit lane by
+       x^e mod p(x). The product of two reflected 64-bit values comes out
+       one place short of the 128-bit result's bit order, a factor of x,
+       hence the e - 1. A crc narrower than 64 bits is the top of the
+       constant, so also x^(64 - width) further along. */
+    static constexpr uint64_t fold_c(uint64_t e) {
+        return static_cast<uint64_t>(xpow_c(e - 1 - (64 - width)));
+    }
+
+    typedef crc_sw_table<crc_poly, typename crc_make_index_sequence<16 * 256>::type> sw;
+    typedef crc_zeros_table<crc_poly, xpow_c(8 * uint64_t(LONG_BLOCK)),
+                            typename crc_make_index_sequence<bytes * 256>::type> long_zeros;
+    typedef crc_zeros_table<crc_poly, xpow_c(8 * uint64_t(SHORT_BLOCK)),
+                            typename crc_make_index_sequence<bytes * 256>::type> short_zeros;
+    typedef crc_x2n_table<crc_poly, typename crc_make_index_sequence<64>::type> x2n;
+};
+
+namespace {
+
+/* The software crc for the polynomial, private to each file using it. */
+template <typename T, uint64_t Poly>
+struct crc_engine : crc_poly<T, Poly> {
+    typedef crc_poly<T, Poly> poly;
+    using poly::bytes;
+    using poly::top;
+    typedef typename poly::sw sw;
+    typedef typename poly::long_zeros long_zeros;
+    typedef typename poly::short_zeros short_zeros;
+    typedef typename poly::x2n x2n;
+
+    /* Multiply a and b modulo p(x) at run time, at most width shift-and-xor
+       steps. */
+    static T multmodp(T a, T b) {
+        T m = top;
+        T p = 0;
+
+        for (;;) {
+            if (a & m) {
+                p ^= b;
+                if ((a & (m - 1)) == 0) {
+                    break;
+                }
+            }
+            m >>= 1;
+            b = b & 1 ? (b >> 1) ^ T(Poly) : b >> 1;
+        }
+        return p;
+    }
+
+    /* Return x^(n * 2^k) mod p(x). With k == 3 this is the operator that
+       appends n zero bytes to a crc. Needs one multmodp for every set bit
+       in n, so O(log n). */
+    static T x2nmodp(size_t n, unsigned k) {
+        T p = top;
+
+        while (n) {
+            if (n & 1) {
+                p = multmodp(x2n::table[k & 63], p);
+            }
+            n >>= 1;
+            k++;
+        }
+        return p;
+    }
+
+    /* The crc of A followed by B, from crc_a, crc_b and the length of B. */
+    static T combine(T crc_a, T crc_b, size_t len_b) {
+        return multmodp(x2nmodp(len_b, 3), crc_a) ^ crc_b;
+    }
+
+    /* Build the table for applying len zero bytes to a crc at run time, the
+       long_zeros and short_zeros tables for other lengths. */
+    static void zeros(T table[bytes][256], size_t len) {
+        const T op = x2nmodp(len, 3);
+        for (int k = 0; k < bytes; k++) {
+            for (uint32_t n = 0; n < 256; n++) {
+                table[k][n] = multmodp(op, static_cast<T>(n) << (8 * k));
+            }
+        }
+    }
+
+    /* Apply the zeros operator table to crc. */
+    static inline T shift(const T table[bytes][256], T crc) {
+        T result = 0;
+        for (int k = 0; k < bytes; k++) {
+            result ^= table[k][(crc >> (8 * k)) & 0xff];
+        }
+        return result;
+    }
+
+    static inline uint64_t byte(uint64_t crc, uint8_t data) {
+        return sw::table[0][(crc ^ data) & 0xff] ^ (crc >> 8);
+    }
+
+    /* Slicing-by-8 over the next 8 bytes. A crc narrower than 64 bits
+       leaves the top of crc zero, so the same lookups work for any width. */
+    static inline uint64_t inner(uint64_t crc, const uint8_t* buffer) {
+        crc ^= *reinterpret_cast<const uint64_t*>(buffer);
+        crc = sw::table[7][crc & 0xff] ^
+            sw::table[6][(crc >> 8) & 0xff] ^
+            sw::table[5][(crc >> 16) & 0xff] ^
+            sw::table[4][(crc >> 24) & 0xff] ^
+            sw::table[3][(crc >> 32) & 0xff] ^
+            sw::table[2][(crc >> 40) & 0xff] ^
+            sw::table[1][(crc >> 48) & 0xff] ^
+            sw::table[0][crc >> 56];
+        return crc;
+    }
+
+    /* Slicing-by-16 over the next 16 bytes, twice the table lookups in
+       flight of inner for each dependency on crc. */
+    static inline uint64_t inner16(uint64_t crc, const uint8_t* buffer) {
+        const uint64_t* words = reinterpret_cast<const uint64_t*>(buffer);
+        crc ^= words[0];
+        const uint64_t next = words[1];
+        crc = sw::table[15][crc & 0xff] ^
+            sw::table[14][(crc >> 8) & 0xff] ^
+            sw::table[13][(crc >> 16) & 0xff] ^
+            sw::table[12][(crc >> 24) & 0xff] ^
+            sw::table[11][(crc >> 32) & 0xff] ^
+            sw::table[10][(crc >> 40) & 0xff] ^
+            sw::table[9][(crc >> 48) & 0xff] ^
+            sw::table[8][crc >> 56] ^
+            sw::table[7][next & 0xff] ^
+            sw::table[6][(next >> 8) & 0xff] ^
+            sw::table[5][(next >> 16) & 0xff] ^
+            sw::table[4][(next >> 24) & 0xff] ^
+            sw::table[3][(next >> 32) & 0xff] ^
+            sw::table[2][(next >> 40) & 0xff] ^
+            sw::table[1][(next >> 48) & 0xff] ^
+            sw::table[0][next >> 56];
+        return crc;
+    }
+
+    /* Feed buf into the (not inverted) crc register. */
+    static uint64_t sw_1way_raw(uint64_t crc, const uint8_t* buf, size_t len) {
+        while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+            crc = byte(crc, *buf);
+            buf += sizeof(uint8_t);
+            len -= sizeof(uint8_t);
+        }
+
+        while (len >= 2 * sizeof(uint64_t)) {
+            crc = inner16(crc, buf);
+            buf += 2 * sizeof(uint64_t);
+            len -= 2 * sizeof(uint64_t);
+        }
+
+        if (len >= sizeof(uint64_t)) {
+            crc = inner(crc, buf);
+            buf += sizeof(uint64_t);
+            len -= sizeof(uint64_t);
+        }
+
+        while (len > 0) {
+            crc = byte(crc, *buf);
+            buf += sizeof(uint8_t);
+            len -= sizeof(uint8_t);
+        }
+        return crc;
+    }
+
+    /* Three streams block bytes apart, block bytes at a time, combined with
+       the shift tables for block, while at least 3 * block bytes remain.
+       buf must be 8-byte aligned. */
+    static uint64_t sw_3way_raw(uint64_t crc, const uint8_t*& buf, size_t& len,
+                                size_t block, const T table[bytes][256]) {
+        while (len >= (3 * block)) {
+            uint64_t crc1 = 0;
+            uint64_t crc2 = 0;
+            const uint8_t* end = buf + block;
+            do
+            {
+                crc  = inner16(crc, buf);
+                crc1 = inner16(crc1, (buf + block));
+                crc2 = inner16(crc2, (buf + (2 * block)));
+                buf += 2 * sizeof(uint64_t);
+            } while (buf < end);
+            crc = shift(table, static_cast<T>(crc)) ^ crc1;
+            crc = shift(table, static_cast<T>(crc)) ^ crc2;
+            buf += 2 * block;
+            len -= 3 * block;
+        }
+        return crc;
+    }
+
+    //
+    // Single stream software crc.
+    //
+    static T sw_1way(const uint8_t* buf, size_t len, T crc_in) {
+        uint64_t crc = static_cast<T>(~crc_in);
+        crc = sw_1way_raw(crc, buf, len);
+        return static_cast<T>(crc ^ std::numeric_limits<T>::max());
+    }
+
+    //
+    // Divides the data into 3 blocks of SHORT_BLOCK, allowing some free CPU
+    // pipelining/parallelisation.
+    //
+    static T sw_short_block(const uint8_t* buf, size_t len, T crc_in) {
+        // If len is less the 3 x SHORT_BLOCK just use the 1-way sw version
+        if (len < (3 * SHORT_BLOCK)) {
+            return sw_1way(buf, len, crc_in);
+        }
+
+        uint64_t crc = static_cast<T>(~crc_in);
+        while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+            crc = byte(crc, *buf);
+            buf += sizeof(uint8_t);
+            len -= sizeof(uint8_t);
+        }
+
+        crc = sw_3way_raw(crc, buf, len, SHORT_BLOCK, short_zeros::table);
+        crc = sw_1way_raw(crc, buf, len);
+        return static_cast<T>(crc ^ std::numeric_limits<T>::max());
+    }
+
+    //
+    // The best software crc, 3 blocks of LONG_BLOCK and then SHORT_BLOCK.
+    //
+    static T sw_3way(const uint8_t* buf, size_t len, T crc_in) {
+        // If len is less than the 3 x LONG_BLOCK it's faster to use the short-block only.
+        if (len < (3 * LONG_BLOCK)) {
+            return sw_short_block(buf, len, crc_in);
+        }
+
+        uint64_t crc = static_cast<T>(~crc_in);
+        while ((reinterpret_cast<uintptr_t>(buf) & ALIGN64_MASK) != 0 && len > 0) {
+            crc = byte(crc, *buf);
+            buf += sizeof(uint8_t);
+            len -= sizeof(uint8_t);
+        }
+
+        crc = sw_3way_raw(crc, buf, len, LONG_BLOCK, long_zeros::table);
+        crc = sw_3way_raw(crc, buf, len, SHORT_BLOCK, short_zeros::table);
+        crc = sw_1way_raw(crc, buf, len);
+        return static_cast<T>(crc ^ std::numeric_limits<T>::max());
+    }
+};
+
+/* CRC-32 of zlib, gzip, PNG and IEEE 802.3. */
+typedef crc_engine<uint32_t, 0xEDB88320> crc32_engine;
+/* CRC-64/XZ, the reflected ECMA-182 polynomial as used by xz and Go's
+   hash/crc64.ECMA. */
+typedef crc_engine<uint64_t, 0xC96C5795D7870F42> crc64_engine;
+
+}
+
+//
+// Carry-less multiply folding for the polynomial, instantiated for CRC-32
+// and CRC-64 in crc32c_sse4_2.cc. The caller checks
+// crc32c_hw_pclmul_available().
+//
+template <typename T, uint64_t Poly>
+T crc_pclmul(const uint8_t* buf, size_t len, T crc_in);
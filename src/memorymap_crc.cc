@@ -0,0 +1,249 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// The crc index of a MemoryMappedFile, shared by the POSIX and Windows
+// versions.
+//
+// The sidecar file is little-endian:
+//
+//   8 bytes        "CBCRCIX1"
+//   4 bytes        block size
+//   4 bytes        0
+//   8 bytes        size of the file
+//   4 bytes each   crc32c of each block, the last one possibly short
+//   4 bytes        crc32c of everything above
+//
+
+#include "platform/memorymap.h"
+#include "platform/crc32c.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+static const char CRC_INDEX_MAGIC[8] = {'C', 'B', 'C', 'R', 'C', 'I', 'X', '1'};
+static const size_t CRC_INDEX_HEADER = 24;
+static const size_t CRC_BLOCK_MIN = 4096;
+/* Don't give a thread less than this to checksum. */
+static const size_t CRC_THREAD_MIN = 1024 * 1024;
+
+static void put32(uint8_t *p, uint32_t v) {
+    for (int ii = 0; ii < 4; ii++) {
+        p[ii] = static_cast<uint8_t>(v >> (8 * ii));
+    }
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    put32(p, static_cast<uint32_t>(v));
+    put32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) |
+           (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static uint64_t get64(const uint8_t *p) {
+    return uint64_t(get32(p)) | (uint64_t(get32(p + 4)) << 32);
+}
+
+static size_t crcBlocks(size_t size, size_t blockSize) {
+    return (size + blockSize - 1) / blockSize;
+}
+
+std::string Couchbase::MemoryMappedFile::getCrcIndexName(const std::string &fname) {
+    return fname + ".crcidx";
+}
+
+void Couchbase::MemoryMappedFile::dropCrcIndex(void) {
+    crcBlockSize = 0;
+    crcIndex.clear();
+    crcVerified.reset();
+}
+
+void Couchbase::MemoryMappedFile::writeCrcIndex(size_t blockSize,
+                                                unsigned nthreads) {
+    const uint8_t *data = static_cast<const uint8_t *>(getRoot());
+    if (blockSize < CRC_BLOCK_MIN || (blockSize & (blockSize - 1)) != 0 ||
+        blockSize > UINT32_MAX) {
+        std::stringstream ss;
+        ss << "Invalid crc index block size: " << blockSize;
+        throw ss.str();
+    }
+
+    const size_t blocks = crcBlocks(size, blockSize);
+    std::vector<uint32_t> crcs(blocks);
+
+    if (nthreads == 0) {
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t perThread = std::max(CRC_THREAD_MIN / blockSize, size_t(1));
+    perThread = std::max(perThread, (blocks + nthreads - 1) / nthreads);
+
+    auto checksum = [&crcs, data, blockSize, this](size_t first, size_t last) {
+        for (size_t ii = first; ii < last; ii++) {
+            const size_t offset = ii * blockSize;
+            crcs[ii] = crc32c(data + offset,
+                              std::min(blockSize, size - offset), 0);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads - 1);
+    for (size_t first = perThread; first < blocks; first += perThread) {
+        const size_t last = std::min(first + perThread, blocks);
+        try {
+            threads.emplace_back(checksum, first, last);
+        } catch (const std::system_error &) {
+            // Couldn't start a thread, checksum the blocks here instead.
+            checksum(first, last);
+        }
+    }
+    checksum(0, std::min(perThread, blocks));
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    std::vector<uint8_t> index(CRC_INDEX_HEADER + (4 * blocks) + 4);
+    std::memcpy(index.data(), CRC_INDEX_MAGIC, sizeof(CRC_INDEX_MAGIC));
+    put32(index.data() + 8, static_cast<uint32_t>(blockSize));
+    put32(index.data() + 12, 0);
+    put64(index.data() + 16, size);
+    for (size_t ii = 0; ii < blocks; ii++) {
+        put32(index.data() + CRC_INDEX_HEADER + (4 * ii), crcs[ii]);
+    }
+    put32(index.data() + index.size() - 4,
+          crc32c(index.data(), index.size() - 4, 0));
+
+    const std::string name = getCrcIndexName(filename);
+    FILE *fp = fopen(name.c_str(), "wb");
+    if (fp == NULL) {
+        std::stringstream ss;
+        ss << "Failed to open file: " << name << " (" << strerror(errno) << ")";
+        throw ss.str();
+    }
+    size_t written = fwrite(index.data(), 1, index.size(), fp);
+    if (fclose(fp) != 0 || written != index.size()) {
+        std::stringstream ss;
+        ss << "Failed to write file: " << name << " (" << strerror(errno) << ")";
+        throw ss.str();
+    }
+
+    // Everything was just checksummed from the mapping
+    dropCrcIndex();
+    crcIndex.swap(crcs);
+    crcVerified.reset(new std::atomic<bool>[blocks]);
+    for (size_t ii = 0; ii < blocks; ii++) {
+        crcVerified[ii].store(true, std::memory_order_relaxed);
+    }
+    crcBlockSize = blockSize;
+}
+
+void Couchbase::MemoryMappedFile::loadCrcIndex(void) {
+    getRoot();
+    dropCrcIndex();
+
+    const std::string name = getCrcIndexName(filename);
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (fp == NULL) {
+        std::stringstream ss;
+        ss << "Failed to open file: " << name << " (" << strerror(errno) << ")";
+        throw ss.str();
+    }
+    std::vector<uint8_t> index;
+    uint8_t buffer[8192];
+    size_t nr;
+    while ((nr = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        index.insert(index.end(), buffer, buffer + nr);
+    }
+    bool error = ferror(fp) != 0;
+    fclose(fp);
+    if (error) {
+        std::stringstream ss;
+        ss << "Failed to read file: " << name;
+        throw ss.str();
+    }
+
+    if (index.size() < CRC_INDEX_HEADER + 4 ||
+        std::memcmp(index.data(), CRC_INDEX_MAGIC, sizeof(CRC_INDEX_MAGIC)) != 0 ||
+        get32(index.data() + index.size() - 4) !=
+            crc32c(index.data(), index.size() - 4, 0)) {
+        throw std::string("Corrupt crc index: ") + name;
+    }
+
+    const size_t blockSize = get32(index.data() + 8);
+    const uint64_t fileSize = get64(index.data() + 16);
+    if (blockSize < CRC_BLOCK_MIN || (blockSize & (blockSize - 1)) != 0) {
+        throw std::string("Corrupt crc index: ") + name;
+    }
+    if (fileSize != size) {
+        std::stringstream ss;
+        ss << "Crc index " << name << " is for a file of " << fileSize
+           << " bytes, not " << size;
+        throw ss.str();
+    }
+    const size_t blocks = crcBlocks(size, blockSize);
+    if (index.size() != CRC_INDEX_HEADER + (4 * blocks) + 4) {
+        throw std::string("Corrupt crc index: ") + name;
+    }
+
+    crcIndex.resize(blocks);
+    for (size_t ii = 0; ii < blocks; ii++) {
+        crcIndex[ii] = get32(index.data() + CRC_INDEX_HEADER + (4 * ii));
+    }
+    crcVerified.reset(new std::atomic<bool>[blocks]);
+    for (size_t ii = 0; ii < blocks; ii++) {
+        crcVerified[ii].store(false, std::memory_order_relaxed);
+    }
+    crcBlockSize = blockSize;
+}
+
+bool Couchbase::MemoryMappedFile::verifyRange(size_t offset, size_t len) {
+    const uint8_t *data = static_cast<const uint8_t *>(getRoot());
+    if (!hasCrcIndex()) {
+        throw std::string("verifyRange: no crc index loaded for ") + filename;
+    }
+    if (offset > size || len > size - offset) {
+        std::stringstream ss;
+        ss << "verifyRange: " << offset << "+" << len
+           << " is outside the mapping of " << size << " bytes";
+        throw ss.str();
+    }
+    if (len == 0) {
+        return true;
+    }
+
+    bool ok = true;
+    const size_t last = (offset + len - 1) / crcBlockSize;
+    for (size_t ii = offset / crcBlockSize; ii <= last; ii++) {
+        if (crcVerified[ii].load(std::memory_order_acquire)) {
+            continue;
+        }
+        const size_t start = ii * crcBlockSize;
+        if (crc32c(data + start, std::min(crcBlockSize, size - start), 0) ==
+            crcIndex[ii]) {
+            crcVerified[ii].store(true, std::memory_order_release);
+        } else {
+            ok = false;
+        }
+    }
+    return ok;
+}
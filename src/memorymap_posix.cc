@@ -34,7 +34,8 @@ Couchbase::MemoryMappedFile::MemoryMappedFile(const char *fname, bool share, boo
         root(NULL),
         size(0),
         sharedMapping(share),
-        readonly(rdonly) {
+        readonly(rdonly),
+        crcBlockSize(0) {
     // Empty
 }
 
@@ -47,6 +48,7 @@ void Couchbase::MemoryMappedFile::close(void) {
     if (root == NULL) {
         return;
     }
+    dropCrcIndex();
     std::stringstream ss;
 
     if (munmap(root, size) != 0) {
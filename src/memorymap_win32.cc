@@ -27,7 +27,8 @@ Couchbase::MemoryMappedFile::MemoryMappedFile(const char *fname, bool share, boo
         root(NULL),
         size(0),
         sharedMapping(share),
-        readonly(rdonly) {
+        readonly(rdonly),
+        crcBlockSize(0) {
 }
 
 Couchbase::MemoryMappedFile::~MemoryMappedFile() {
@@ -39,6 +40,7 @@ void Couchbase::MemoryMappedFile::close(void) {
     if (root == NULL) {
         return;
     }
+    dropCrcIndex();
     std::stringstream ss;
 
     if (!UnmapViewOfFile(root)) {
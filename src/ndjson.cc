@@ -0,0 +1,131 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Couchbase::NdjsonBatch. Lines are found with memchr, which the C
+// libraries vectorise, and each thread parses its lines with
+// cJSON_ParseInSitu once the newlines are NULs.
+//
+
+#include "platform/ndjson.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <thread>
+
+/* Don't give a thread less than this to parse. */
+static const size_t NDJSON_THREAD_MIN = 256 * 1024;
+
+Couchbase::NdjsonBatch::NdjsonBatch(unsigned nthreads_)
+    : nthreads(nthreads_) {
+    if (nthreads == 0) {
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+Couchbase::NdjsonBatch::~NdjsonBatch() {
+    for (auto &chunk : chunks) {
+        cJSON_DeleteArena(chunk.arena);
+    }
+}
+
+void Couchbase::NdjsonBatch::parseChunk(Chunk &chunk, const char *data,
+                                        size_t len) {
+    try {
+        chunk.text.assign(data, data + len);
+        chunk.text.push_back('\n');
+        cJSON_ResetArena(chunk.arena);
+        chunk.documents.clear();
+
+        char *line = chunk.text.data();
+        char *end = line + chunk.text.size();
+        while (line < end) {
+            char *eol = static_cast<char *>(std::memchr(line, '\n', end - line));
+            *eol = '\0';
+            if (eol > line && eol[-1] == '\r') {
+                eol[-1] = '\0';
+            }
+            if (*line != '\0') {
+                chunk.documents.push_back(cJSON_ParseInSitu(line, chunk.arena));
+            }
+            line = eol + 1;
+        }
+        chunk.failed = false;
+    } catch (const std::bad_alloc &) {
+        chunk.failed = true;
+    }
+}
+
+size_t Couchbase::NdjsonBatch::parse(const char *data, size_t len) {
+    documents.clear();
+
+    const size_t nchunks = std::max(size_t(1),
+                                    std::min(size_t(nthreads),
+                                             len / NDJSON_THREAD_MIN));
+    while (chunks.size() < nchunks) {
+        Chunk chunk;
+        chunk.arena = cJSON_CreateArena(0);
+        if (chunk.arena == NULL) {
+            throw std::bad_alloc();
+        }
+        chunks.push_back(std::move(chunk));
+    }
+    // Give back what a bigger batch used
+    for (size_t ii = nchunks; ii < chunks.size(); ii++) {
+        std::vector<char>().swap(chunks[ii].text);
+        chunks[ii].documents.clear();
+        cJSON_ResetArena(chunks[ii].arena);
+    }
+
+    // Split the text into nchunks runs of whole lines
+    std::vector<const char *> starts(nchunks + 1, data + len);
+    starts[0] = data;
+    for (size_t ii = 1; ii < nchunks; ii++) {
+        const char *split = std::max(data + (len * ii) / nchunks, starts[ii - 1]);
+        const char *eol = static_cast<const char *>(
+            std::memchr(split, '\n', data + len - split));
+        starts[ii] = eol ? eol + 1 : data + len;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(nchunks - 1);
+    for (size_t ii = 1; ii < nchunks; ii++) {
+        size_t size = starts[ii + 1] - starts[ii];
+        try {
+            threads.emplace_back(&NdjsonBatch::parseChunk, this,
+                                 std::ref(chunks[ii]), starts[ii], size);
+        } catch (const std::system_error &) {
+            // Couldn't start a thread, parse the chunk here instead.
+            parseChunk(chunks[ii], starts[ii], size);
+        }
+    }
+    parseChunk(chunks[0], starts[0], size_t(starts[1] - starts[0]));
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (size_t ii = 0; ii < nchunks; ii++) {
+        if (chunks[ii].failed) {
+            throw std::bad_alloc();
+        }
+        documents.insert(documents.end(), chunks[ii].documents.begin(),
+                         chunks[ii].documents.end());
+    }
+    return documents.size();
+}
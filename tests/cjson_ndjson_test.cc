@@ -0,0 +1,170 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Check Couchbase::NdjsonBatch gives the documents cJSON_Parse does, in
+// order, and compare the throughput of parsing the lines one after the
+// other with the batch on one thread and on one per core. The input is
+// the test document, numbered, on each of the lines.
+//
+
+#include "cJSON.h"
+#include "platform/ndjson.h"
+#include "platform/platform.h"
+
+#include <getopt.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string print(cJSON *item) {
+    if (item == NULL) {
+        return "(null)";
+    }
+    char *text = cJSON_PrintUnformatted(item);
+    std::string ret(text);
+    cJSON_Free(text);
+    return ret;
+}
+
+static void report(const char *what, size_t bytes, hrtime_t time) {
+    std::cerr << what << ": " << (bytes * 1000.0) / std::max(time, hrtime_t(1))
+              << " MB/s" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const char *fname = "testdata.json";
+    int num = 1;
+    int lines = 500;
+    int cmd;
+
+    while ((cmd = getopt(argc, argv, "f:n:l:")) != -1) {
+        switch (cmd) {
+        case 'f' : fname = optarg; break;
+        case 'n' : num = atoi(optarg); break;
+        case 'l' : lines = atoi(optarg); break;
+        default:
+            std::cerr << "usage: " << argv[0]
+                      << " [-f fname] [-n num] [-l lines]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::ifstream file(fname, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    cJSON *doc = cJSON_Parse(contents.str().c_str());
+    if (doc == NULL) {
+        std::cerr << "Failed to parse " << fname << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string line = print(doc);
+    cJSON_Delete(doc);
+
+    // Numbered documents, with an empty line, a CRLF and a bad line
+    std::string text;
+    for (int ii = 0; ii < lines; ii++) {
+        text += "[" + std::to_string(ii) + "," + line + "]";
+        text += ii == 1 ? "\r\n\n" : "\n";
+    }
+    text += "{\"bad\":\n[1,2]";
+
+    std::vector<std::string> expected;
+    for (int ii = 0; ii < lines; ii++) {
+        expected.push_back("[" + std::to_string(ii) + "," + line + "]");
+    }
+    expected.push_back("(null)");
+    expected.push_back("[1,2]");
+
+    bool pass = true;
+    for (unsigned nthreads : {1u, 3u, 0u}) {
+        Couchbase::NdjsonBatch batch(nthreads);
+        // Small enough to need only one thread, then big enough for all
+        for (size_t len : {size_t(100), text.size()}) {
+            std::string part = text.substr(0, len);
+            std::vector<std::string> want;
+            size_t pos = 0;
+            while (pos < part.size()) {
+                size_t eol = std::min(part.find('\n', pos), part.size());
+                std::string one = part.substr(pos, eol - pos);
+                if (!one.empty() && one.back() == '\r') {
+                    one.pop_back();
+                }
+                if (!one.empty()) {
+                    cJSON *item = cJSON_Parse(one.c_str());
+                    want.push_back(print(item));
+                    cJSON_Delete(item);
+                }
+                pos = eol + 1;
+            }
+            if (len == text.size() && want != expected) {
+                std::cerr << "The test data is wrong" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (batch.parse(part.data(), part.size()) != want.size()) {
+                std::cerr << "NdjsonBatch(" << nthreads << ") found "
+                          << batch.size() << " documents in " << len
+                          << " bytes, not " << want.size() << std::endl;
+                pass = false;
+                continue;
+            }
+            for (size_t ii = 0; ii < want.size(); ii++) {
+                if (print(batch[ii]) != want[ii]) {
+                    std::cerr << "NdjsonBatch(" << nthreads << ") document "
+                              << ii << " of " << len << " bytes differs"
+                              << std::endl;
+                    pass = false;
+                    break;
+                }
+            }
+        }
+    }
+    if (!pass) {
+        return EXIT_FAILURE;
+    }
+
+    hrtime_t start = gethrtime();
+    for (int ii = 0; ii < num; ii++) {
+        std::istringstream in(text);
+        std::string one;
+        while (std::getline(in, one)) {
+            cJSON_Delete(cJSON_Parse(one.c_str()));
+        }
+    }
+    report("cJSON_Parse of each line", text.size(),
+           (gethrtime() - start) / num);
+
+    for (unsigned nthreads : {1u, 0u}) {
+        Couchbase::NdjsonBatch batch(nthreads);
+        start = gethrtime();
+        for (int ii = 0; ii < num; ii++) {
+            batch.parse(text.data(), text.size());
+        }
+        std::string what = "NdjsonBatch on " +
+            std::to_string(nthreads ? nthreads : std::thread::hardware_concurrency()) +
+            " threads";
+        report(what.c_str(), text.size(), (gethrtime() - start) / num);
+    }
+
+    return EXIT_SUCCESS;
+}
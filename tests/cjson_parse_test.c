@@ -64,7 +64,7 @@ static void *load_file(const char *file)
     return data;
 }
 
-static void report(hrtime_t time) {
+static void report(const char *what, hrtime_t time) {
    const char * const extensions[] = { " ns", " usec", " ms", " s", NULL };
    int id = 0;
 
@@ -77,12 +77,459 @@ static void report(hrtime_t time) {
    }
 
    assert(extensions[id] != NULL);
-   fprintf(stderr, "Parsing took an average of %"PRIu64"%s\n",
-           (uint64_t)time, extensions[id]);
+   fprintf(stderr, "%s took an average of %"PRIu64"%s\n",
+           what, (uint64_t)time, extensions[id]);
+}
+
+static void compare(const char *what, cJSON *expected, cJSON *actual)
+{
+    char *expected_text;
+    char *actual_text;
+
+    if (actual == NULL) {
+        fprintf(stderr, "%s failed to parse test data\n", what);
+        exit(EXIT_FAILURE);
+    }
+    expected_text = cJSON_PrintUnformatted(expected);
+    actual_text = cJSON_PrintUnformatted(actual);
+    if (strcmp(expected_text, actual_text) != 0) {
+        fprintf(stderr, "%s differs from cJSON_Parse\n", what);
+        exit(EXIT_FAILURE);
+    }
+    cJSON_Free(expected_text);
+    cJSON_Free(actual_text);
+}
+
+/* The other ways of parsing must give the same tree as cJSON_Parse */
+static void check_parsers(const char *data, cJSON_Arena *arena)
+{
+    cJSON *heap = cJSON_Parse(data);
+    cJSON *tree;
+    char *buffer = strdup(data);
+    char truncated[] = "{\"a\":[\"b\",\"c";
+
+    if (heap == NULL || buffer == NULL) {
+        fprintf(stderr, "Failed to parse test data\n");
+        exit(EXIT_FAILURE);
+    }
+
+    tree = cJSON_ParseWithArena(data, arena);
+    compare("cJSON_ParseWithArena", heap, tree);
+    /* Only frees the parts added from the heap, which is nothing */
+    cJSON_Delete(tree);
+    cJSON_ResetArena(arena);
+
+    /* An index on an arena tree comes from the heap, and is freed by
+       cJSON_Delete before the arena is reset */
+    tree = cJSON_ParseWithArena(data, arena);
+    if (tree == NULL || cJSON_BuildIndex(tree, 1) != 0) {
+        fprintf(stderr, "Failed to index an arena tree\n");
+        exit(EXIT_FAILURE);
+    }
+    compare("cJSON_ParseWithArena indexed", heap, tree);
+    cJSON_Delete(tree);
+    cJSON_ResetArena(arena);
+
+    tree = cJSON_ParseInSitu(buffer, NULL);
+    compare("cJSON_ParseInSitu", heap, tree);
+    cJSON_Delete(tree);
+
+    strcpy(buffer, data);
+    tree = cJSON_ParseInSitu(buffer, arena);
+    compare("cJSON_ParseInSitu with an arena", heap, tree);
+    cJSON_ResetArena(arena);
+
+    if (cJSON_ParseWithArena(truncated, arena) != NULL ||
+        cJSON_ParseInSitu(truncated, arena) != NULL ||
+        cJSON_ParseInSitu(truncated, NULL) != NULL) {
+        fprintf(stderr, "Truncated JSON was accepted\n");
+        exit(EXIT_FAILURE);
+    }
+    cJSON_ResetArena(arena);
+
+    free(buffer);
+    cJSON_Delete(heap);
+}
+
+/* Feeds a document to a reader a chunk at a time */
+typedef struct {
+    cJSON_Reader *reader;
+    const char *data;
+    size_t length;
+    size_t offset;
+    size_t chunk;
+} feeder;
+
+static int next_token(feeder *f, cJSON_Token *token)
+{
+    int type;
+    size_t len;
+
+    while ((type = cJSON_ReaderNext(f->reader, token)) == cJSON_TokenNeedMore) {
+        len = f->length - f->offset;
+        if (len > f->chunk) {
+            len = f->chunk;
+        }
+        cJSON_ReaderFeed(f->reader, f->data + f->offset, len,
+                         f->offset + len == f->length);
+        f->offset += len;
+    }
+    return type;
+}
+
+/* Build a tree from the tokens of a value, starting with its first */
+static cJSON *read_value(feeder *f, cJSON_Token *token)
+{
+    cJSON *item;
+    cJSON *child;
+    char *key;
+    int type;
+
+    switch (token->type) {
+    case cJSON_TokenString:
+        return cJSON_CreateString(token->string);
+    case cJSON_TokenNumber:
+        if ((double)token->valueint64 == token->valuedouble) {
+            return cJSON_CreateInt64(token->valueint64);
+        }
+        return cJSON_CreateNumber(token->valuedouble);
+    case cJSON_TokenTrue:
+        return cJSON_CreateTrue();
+    case cJSON_TokenFalse:
+        return cJSON_CreateFalse();
+    case cJSON_TokenNull:
+        return cJSON_CreateNull();
+    case cJSON_TokenStartArray:
+        item = cJSON_CreateArray();
+        while ((type = next_token(f, token)) != cJSON_TokenEndArray) {
+            if (type == cJSON_TokenError || !(child = read_value(f, token))) {
+                cJSON_Delete(item);
+                return NULL;
+            }
+            cJSON_AddItemToArray(item, child);
+        }
+        return item;
+    case cJSON_TokenStartObject:
+        item = cJSON_CreateObject();
+        while ((type = next_token(f, token)) != cJSON_TokenEndObject) {
+            if (type != cJSON_TokenKey) {
+                cJSON_Delete(item);
+                return NULL;
+            }
+            key = strdup(token->string);
+            child = NULL;
+            if (next_token(f, token) != cJSON_TokenError) {
+                child = read_value(f, token);
+            }
+            if (child == NULL) {
+                free(key);
+                cJSON_Delete(item);
+                return NULL;
+            }
+            cJSON_AddItemToObject(item, key, child);
+            free(key);
+        }
+        return item;
+    default:
+        return NULL;
+    }
+}
+
+/* Read a whole document, which must be a single value */
+static cJSON *read_document(const char *data, size_t chunk, int max_depth)
+{
+    feeder f;
+    cJSON_Token token;
+    cJSON *tree = NULL;
+
+    f.reader = cJSON_CreateReader(max_depth);
+    f.data = data;
+    f.length = strlen(data);
+    f.offset = 0;
+    f.chunk = chunk;
+    if (f.reader == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (next_token(&f, &token) != cJSON_TokenError) {
+        tree = read_value(&f, &token);
+    }
+    if (tree != NULL && next_token(&f, &token) != cJSON_TokenEnd) {
+        cJSON_Delete(tree);
+        tree = NULL;
+    }
+    cJSON_DeleteReader(f.reader);
+    return tree;
+}
+
+/* The reader must give the tokens of the tree cJSON_Parse does, however
+   the document is split up, and refuse what cJSON_Parse refuses. */
+static void check_reader(const char *data)
+{
+    cJSON *heap = cJSON_Parse(data);
+    cJSON *tree;
+    const size_t chunks[] = { 1, 3, 64, 4096, strlen(data) + 1 };
+    const char * const bad[] = {
+        "{\"a\":[\"b\",\"c",
+        "{\"a\":[1,2",
+        "[1,2]]",
+        "{\"a\":1} x",
+        "{\"a\" 1}",
+        "[1,]",
+        "[tru]",
+        "[\"\\u12\"]",
+        "",
+        NULL
+    };
+    char message[64];
+    size_t ii;
+
+    for (ii = 0; ii < sizeof(chunks) / sizeof(chunks[0]); ii++) {
+        snprintf(message, sizeof(message),
+                 "cJSON_ReaderNext in chunks of %lu", (unsigned long)chunks[ii]);
+        tree = read_document(data, chunks[ii], 0);
+        compare(message, heap, tree);
+        cJSON_Delete(tree);
+    }
+    cJSON_Delete(heap);
+
+    for (ii = 0; bad[ii] != NULL; ii++) {
+        if ((tree = read_document(bad[ii], 1, 0)) != NULL ||
+            (tree = read_document(bad[ii], 64, 0)) != NULL) {
+            fprintf(stderr, "cJSON_ReaderNext accepted %s\n", bad[ii]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    heap = cJSON_Parse("[[[1]],2]");
+    tree = read_document("[[[1]],2]", 1, 3);
+    compare("cJSON_ReaderNext at the depth limit", heap, tree);
+    cJSON_Delete(tree);
+    cJSON_Delete(heap);
+    if (read_document("[[[[1]]],2]", 1, 3) != NULL) {
+        fprintf(stderr, "cJSON_ReaderNext went past the depth limit\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Parse documents one after another out of a buffer with no NUL */
+static void check_length(const char *data)
+{
+    cJSON *heap = cJSON_Parse(data);
+    cJSON *tree;
+    size_t size = strlen(data);
+    char *buffer = malloc(size * 3 + 2);
+    const char *end;
+    const char *ptr;
+    int ii;
+
+    if (buffer == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(buffer, data, size);
+    buffer[size] = '\n';
+    memcpy(buffer + size + 1, data, size);
+    memcpy(buffer + size * 2 + 1, data, size);
+
+    ptr = buffer;
+    for (ii = 0; ii < 3; ii++) {
+        while (ptr < buffer + size * 3 + 1 && (*ptr == ' ' || *ptr == '\n')) {
+            ptr++;
+        }
+        tree = cJSON_ParseWithLength(ptr, size * 3 + 1 - (ptr - buffer), &end);
+        compare("cJSON_ParseWithLength", heap, tree);
+        cJSON_Delete(tree);
+        ptr = end;
+    }
+    while (ptr < buffer + size * 3 + 1 && (*ptr == ' ' || *ptr == '\n')) {
+        ptr++;
+    }
+    if (ptr != buffer + size * 3 + 1) {
+        fprintf(stderr, "cJSON_ParseWithLength stopped in the wrong place\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Cut short, a document is truncated however it ends */
+    if (cJSON_ParseWithLength(buffer, size / 2, NULL) != NULL ||
+        cJSON_ParseWithLength("[1,2]", 4, NULL) != NULL ||
+        cJSON_ParseWithLength("\"abc\"", 4, NULL) != NULL ||
+        cJSON_ParseWithLength("true", 3, NULL) != NULL ||
+        cJSON_ParseWithLength("\"a\\\"", 4, NULL) != NULL ||
+        cJSON_ParseWithLength("\"a\\", 3, NULL) != NULL ||
+        cJSON_ParseWithLength("[1 ", 3, &end) != NULL || end != NULL ||
+        cJSON_ParseWithLength("", 0, NULL) != NULL) {
+        fprintf(stderr, "cJSON_ParseWithLength read past the end\n");
+        exit(EXIT_FAILURE);
+    }
+    tree = cJSON_ParseWithLength("123456", 3, &end);
+    if (tree == NULL || tree->valueint != 123 || *end != '4') {
+        fprintf(stderr, "cJSON_ParseWithLength read past the end\n");
+        exit(EXIT_FAILURE);
+    }
+    cJSON_Delete(tree);
+
+    /* Nested 512 deep is fine, 513 isn't */
+    for (ii = 0; ii < 513; ii++) {
+        buffer[ii] = '[';
+        buffer[ii + 513] = ']';
+    }
+    tree = cJSON_ParseWithLength(buffer + 1, 1024, NULL);
+    if (tree == NULL || cJSON_ParseWithLength(buffer, 1026, NULL) != NULL) {
+        fprintf(stderr, "cJSON_ParseWithLength has the wrong depth limit\n");
+        exit(EXIT_FAILURE);
+    }
+    cJSON_Delete(tree);
+
+    free(buffer);
+    cJSON_Delete(heap);
+}
+
+/* Threads parsing with one key table at once */
+#define KEY_THREADS 4
+
+struct key_thread {
+    const char *data;
+    cJSON_KeyTable *keys;
+    cJSON *tree;
+};
+
+static void parse_with_keys(void *arg)
+{
+    struct key_thread *thread = arg;
+    int ii;
+
+    for (ii = 0; ii < 20; ii++) {
+        cJSON_Delete(thread->tree);
+        thread->tree = cJSON_ParseWithKeys(thread->data, thread->keys, NULL);
+    }
+}
+
+/* Are the names of the two trees the same strings, not just equal? */
+static int same_names(cJSON *a, cJSON *b)
+{
+    for (; a != NULL && b != NULL; a = a->next, b = b->next) {
+        if (a->string != b->string || !same_names(a->child, b->child)) {
+            return 0;
+        }
+    }
+    return a == b;
+}
+
+static void check_keys(const char *data)
+{
+    cJSON *heap = cJSON_Parse(data);
+    cJSON_KeyTable *keys = cJSON_CreateKeyTable(0);
+    struct key_thread threads[KEY_THREADS];
+    cb_thread_t ids[KEY_THREADS];
+    int ii;
+
+    if (keys == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (ii = 0; ii < KEY_THREADS; ii++) {
+        threads[ii].data = data;
+        threads[ii].keys = keys;
+        threads[ii].tree = NULL;
+        if (cb_create_thread(&ids[ii], parse_with_keys, &threads[ii], 0) != 0) {
+            fprintf(stderr, "Failed to create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (ii = 0; ii < KEY_THREADS; ii++) {
+        cb_join_thread(ids[ii]);
+        compare("cJSON_ParseWithKeys", heap, threads[ii].tree);
+    }
+
+    /* Every thread got the same names */
+    for (ii = 1; ii < KEY_THREADS; ii++) {
+        if (!same_names(threads[0].tree, threads[ii].tree)) {
+            fprintf(stderr, "cJSON_ParseWithKeys didn't share names\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (ii = 0; ii < KEY_THREADS; ii++) {
+        cJSON_Delete(threads[ii].tree);
+    }
+    cJSON_DeleteKeyTable(keys);
+    cJSON_Delete(heap);
+}
+
+/* Build a tree from an item on a tape */
+static cJSON *tape_to_tree(const cJSON_Tape *tape, size_t item)
+{
+    cJSON *tree;
+    size_t child;
+
+    switch (cJSON_TapeType(tape, item)) {
+    case cJSON_False:
+        return cJSON_CreateFalse();
+    case cJSON_True:
+        return cJSON_CreateTrue();
+    case cJSON_NULL:
+        return cJSON_CreateNull();
+    case cJSON_Number:
+        if ((double)cJSON_TapeGetInt64(tape, item) == cJSON_TapeGetNumber(tape, item)) {
+            return cJSON_CreateInt64(cJSON_TapeGetInt64(tape, item));
+        }
+        return cJSON_CreateNumber(cJSON_TapeGetNumber(tape, item));
+    case cJSON_String:
+        return cJSON_CreateString(cJSON_TapeGetString(tape, item));
+    case cJSON_Array:
+        tree = cJSON_CreateArray();
+        for (child = cJSON_TapeChild(tape, item); child != cJSON_TapeNone;
+             child = cJSON_TapeNext(tape, child)) {
+            cJSON_AddItemToArray(tree, tape_to_tree(tape, child));
+        }
+        return tree;
+    case cJSON_Object:
+        tree = cJSON_CreateObject();
+        for (child = cJSON_TapeChild(tape, item); child != cJSON_TapeNone;
+             child = cJSON_TapeNext(tape, child)) {
+            cJSON_AddItemToObject(tree, cJSON_TapeGetName(tape, child),
+                                  tape_to_tree(tape, child));
+        }
+        return tree;
+    default:
+        return NULL;
+    }
+}
+
+/* The tape must hold the same document as the tree from cJSON_Parse */
+static void check_tape(const char *data)
+{
+    cJSON *heap = cJSON_Parse(data);
+    cJSON *tree;
+    cJSON_Tape *tape = cJSON_ParseTape(data);
+
+    if (tape == NULL) {
+        fprintf(stderr, "cJSON_ParseTape failed to parse test data\n");
+        exit(EXIT_FAILURE);
+    }
+    tree = tape_to_tree(tape, 0);
+    compare("cJSON_ParseTape", heap, tree);
+    fprintf(stderr, "The tape takes %lu bytes\n",
+            (unsigned long)cJSON_TapeSize(tape));
+    cJSON_Delete(tree);
+    cJSON_Delete(heap);
+    cJSON_DeleteTape(tape);
+
+    if (cJSON_ParseTape("{\"a\":[\"b\",\"c") != NULL ||
+        cJSON_ParseTape("{\"a\":[1,2") != NULL ||
+        cJSON_ParseTape("{\"a\" 1}") != NULL) {
+        fprintf(stderr, "cJSON_ParseTape accepted bad JSON\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
 int main(int argc, char **argv) {
     char *data = NULL;
+    char *buffer;
+    size_t size;
+    cJSON_Arena *arena;
+    cJSON_KeyTable *keys;
     const char *fname = "testdata.json";
     int num = 1;
     int cmd;
@@ -110,7 +557,130 @@ int main(int argc, char **argv) {
     }
     delta = gethrtime() - start;
 
-    report(delta / (hrtime_t)num);
+    report("Parsing", delta / (hrtime_t)num);
+
+    /* A small block size so the arena has to grow */
+    arena = cJSON_CreateArena(4096);
+    if (arena == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    check_parsers(data, arena);
+    cJSON_DeleteArena(arena);
+    check_reader(data);
+    check_tape(data);
+    check_length(data);
+    check_keys(data);
+
+    arena = cJSON_CreateArena(0);
+    if (arena == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    start = gethrtime();
+    for (ii = 0; ii < num; ++ii) {
+        cJSON *ptr = cJSON_ParseWithArena(data, arena);
+        if (ptr == NULL) {
+            fprintf(stderr, "Failed to parse into an arena\n");
+            exit(EXIT_FAILURE);
+        }
+        cJSON_ResetArena(arena);
+    }
+    delta = gethrtime() - start;
+
+    report("Parsing into an arena", delta / (hrtime_t)num);
+
+    /* In place parsing destroys the text, the copy is part of the time */
+    size = strlen(data) + 1;
+    buffer = malloc(size);
+    if (buffer == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    start = gethrtime();
+    for (ii = 0; ii < num; ++ii) {
+        cJSON *ptr;
+        memcpy(buffer, data, size);
+        ptr = cJSON_ParseInSitu(buffer, arena);
+        if (ptr == NULL) {
+            fprintf(stderr, "Failed to parse in place\n");
+            exit(EXIT_FAILURE);
+        }
+        cJSON_ResetArena(arena);
+    }
+    delta = gethrtime() - start;
+    free(buffer);
+    cJSON_DeleteArena(arena);
+
+    report("Parsing in place into an arena", delta / (hrtime_t)num);
+
+    keys = cJSON_CreateKeyTable(0);
+    if (keys == NULL) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    start = gethrtime();
+    for (ii = 0; ii < num; ++ii) {
+        cJSON *ptr = cJSON_ParseWithKeys(data, keys, NULL);
+        if (ptr == NULL) {
+            fprintf(stderr, "Failed to parse with a key table\n");
+            exit(EXIT_FAILURE);
+        }
+        cJSON_Delete(ptr);
+    }
+    delta = gethrtime() - start;
+    cJSON_DeleteKeyTable(keys);
+
+    report("Parsing with a key table", delta / (hrtime_t)num);
+
+    start = gethrtime();
+    for (ii = 0; ii < num; ++ii) {
+        cJSON *ptr = cJSON_ParseWithLength(data, size - 1, NULL);
+        if (ptr == NULL) {
+            fprintf(stderr, "Failed to parse with a length\n");
+            exit(EXIT_FAILURE);
+        }
+        cJSON_Delete(ptr);
+    }
+    delta = gethrtime() - start;
+
+    report("Parsing with a length", delta / (hrtime_t)num);
+
+    start = gethrtime();
+    for (ii = 0; ii < num; ++ii) {
+        cJSON_Tape *tape = cJSON_ParseTape(data);
+        if (tape == NULL) {
+            fprintf(stderr, "Failed to parse into a tape\n");
+            exit(EXIT_FAILURE);
+        }
+        cJSON_DeleteTape(tape);
+    }
+    delta = gethrtime() - start;
+
+    report("Parsing into a tape", delta / (hrtime_t)num);
+
+    /* Only the tokens, without building a tree */
+    start = gethrtime();
+    for (ii = 0; ii < num; ++ii) {
+        cJSON_Reader *reader = cJSON_CreateReader(0);
+        cJSON_Token token;
+        int type;
+        if (reader == NULL) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        cJSON_ReaderFeed(reader, data, size - 1, 1);
+        while ((type = cJSON_ReaderNext(reader, &token)) != cJSON_TokenEnd) {
+            if (type <= cJSON_TokenNeedMore) {
+                fprintf(stderr, "Failed to read the tokens\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        cJSON_DeleteReader(reader);
+    }
+    delta = gethrtime() - start;
+
+    report("Reading tokens", delta / (hrtime_t)num);
 
     free(data);
     exit(EXIT_SUCCESS);
@@ -4,6 +4,422 @@
 #include <cJSON.h>
 #include <stdio.h>
 
+/* Numbers must parse to the nearest double, and integers which fit in
+   64 bits must print back the way they came in. */
+static int test_numbers(void) {
+   static const struct {
+      const char *text;
+      double value;
+   } doubles[] = {
+      { "0.1", 0.1 },
+      { "-123.456e-5", -123.456e-5 },
+      { "1e22", 1e22 },
+      { "1e23", 1e23 },
+      { "9007199254740993.0", 9007199254740992.0 },
+      { "12345678901234567890123", 12345678901234567890123.0 },
+      { "0.30000000000000004441", 0.30000000000000004441 },
+      { "1.7976931348623157e308", 1.7976931348623157e308 },
+      { "4.9406564584124654e-324", 4.9406564584124654e-324 },
+      { "1e-400", 0.0 }
+   };
+   static const char * const integers[] = {
+      "0", "-1", "2147483648", "-2147483649", "9007199254740993",
+      "9223372036854775807", "-9223372036854775808", "9223372036854775808"
+   };
+   int retcode = EXIT_SUCCESS;
+   size_t ii;
+   cJSON *item;
+   char *str;
+
+   for (ii = 0; ii < sizeof(doubles) / sizeof(doubles[0]); ii++) {
+      item = cJSON_Parse(doubles[ii].text);
+      if (item == NULL || item->valuedouble != doubles[ii].value) {
+         fprintf(stderr, "Expected %s to parse as %.17g got %.17g\n",
+                 doubles[ii].text, doubles[ii].value,
+                 item ? item->valuedouble : 0.0);
+         retcode = EXIT_FAILURE;
+      }
+      cJSON_Delete(item);
+   }
+
+   for (ii = 0; ii < sizeof(integers) / sizeof(integers[0]); ii++) {
+      item = cJSON_Parse(integers[ii]);
+      str = cJSON_PrintUnformatted(item);
+      if (strcmp(str, integers[ii]) != 0) {
+         fprintf(stderr, "Expected %s got %s\n", integers[ii], str);
+         retcode = EXIT_FAILURE;
+      }
+      cJSON_Delete(item);
+      cJSON_Free(str);
+   }
+
+   item = cJSON_Parse("[2147483648, -1e300, 4294967296.5]");
+   if (cJSON_GetArrayItem(item, 0)->valueint != 2147483647 ||
+       cJSON_GetArrayItem(item, 0)->valueint64 != 2147483648LL ||
+       cJSON_GetArrayItem(item, 1)->valueint64 != INT64_MIN ||
+       cJSON_GetArrayItem(item, 2)->valueint64 != 4294967296LL) {
+      fprintf(stderr, "Integer values of numbers out of range are wrong\n");
+      retcode = EXIT_FAILURE;
+   }
+   cJSON_Delete(item);
+
+   item = cJSON_CreateInt64(INT64_MAX - 1);
+   str = cJSON_PrintUnformatted(item);
+   if (strcmp(str, "9223372036854775806") != 0) {
+      fprintf(stderr, "Expected 9223372036854775806 got %s\n", str);
+      retcode = EXIT_FAILURE;
+   }
+   cJSON_Delete(item);
+   cJSON_Free(str);
+
+   return retcode;
+}
+
+struct sink_buffer {
+   char data[8192];
+   size_t used;
+   int calls;
+};
+
+static int sink(void *ctx, const char *data, size_t len) {
+   struct sink_buffer *buffer = ctx;
+   if (len > sizeof(buffer->data) - buffer->used) {
+      return -1;
+   }
+   memcpy(buffer->data + buffer->used, data, len);
+   buffer->used += len;
+   buffer->calls++;
+   return 0;
+}
+
+/* The sink must get the same text as cJSON_Print, and be able to stop it */
+static int test_sink(void) {
+   struct sink_buffer *buffer = calloc(1, sizeof(*buffer));
+   int retcode = EXIT_SUCCESS;
+   cJSON *obj = cJSON_CreateObject();
+   cJSON *arr = cJSON_CreateArray();
+   char *str;
+   int ii;
+
+   for (ii = 0; ii < 200; ii++) {
+      cJSON_AddItemToArray(arr, cJSON_CreateString("some\ttext\n"));
+   }
+   cJSON_AddItemToObject(obj, "array", arr);
+   cJSON_AddNumberToObject(obj, "number", 1.5);
+
+   str = cJSON_Print(obj);
+   if (cJSON_PrintToSink(obj, 1, sink, buffer) != 0 ||
+       buffer->used != strlen(str) ||
+       memcmp(buffer->data, str, buffer->used) != 0) {
+      fprintf(stderr, "cJSON_PrintToSink differs from cJSON_Print\n");
+      retcode = EXIT_FAILURE;
+   }
+   cJSON_Free(str);
+
+   /* A sink which is full stops the print */
+   buffer->used = sizeof(buffer->data) - 10;
+   if (cJSON_PrintToSink(obj, 0, sink, buffer) != -1) {
+      fprintf(stderr, "cJSON_PrintToSink ignored the sink failing\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   cJSON_Delete(obj);
+   free(buffer);
+   return retcode;
+}
+
+static int item_number(cJSON *item) {
+   return item ? item->valueint : -1;
+}
+
+/* Random adds, detaches and replaces on an indexed object must leave it
+   answering lookups the same as one without an index. Names differ only
+   in case so there are plenty of duplicates. */
+static int test_index(void) {
+   static const char * const names[] = {
+      "a", "A", "b", "B", "key", "KEY", "Key", "vb_0", "vb_1", "vb_2"
+   };
+   const int nnames = sizeof(names) / sizeof(names[0]);
+   cJSON *plain = cJSON_CreateObject();
+   cJSON *indexed = cJSON_CreateObject();
+   unsigned int seed = 1;
+   int retcode = EXIT_SUCCESS;
+   int ii, jj, op, which, size;
+   const char *name;
+
+   if (cJSON_BuildIndex(indexed, 0) != 0) {
+      fprintf(stderr, "cJSON_BuildIndex failed\n");
+      return EXIT_FAILURE;
+   }
+   for (ii = 0; ii < 20000 && retcode == EXIT_SUCCESS; ii++) {
+      seed = seed * 1103515245 + 12345;
+      op = (seed >> 16) % 6;
+      name = names[(seed >> 8) % nnames];
+      size = cJSON_GetArraySize(plain);
+      which = size ? (int)((seed >> 20) % size) : 0;
+      switch (op) {
+      case 0:
+      case 1:
+         cJSON_AddItemToObject(plain, name, cJSON_CreateNumber(ii));
+         cJSON_AddItemToObject(indexed, name, cJSON_CreateNumber(ii));
+         break;
+      case 2:
+         cJSON_DeleteItemFromArray(plain, which);
+         cJSON_DeleteItemFromArray(indexed, which);
+         break;
+      case 3:
+         cJSON_DeleteItemFromObject(plain, name);
+         cJSON_DeleteItemFromObject(indexed, name);
+         break;
+      case 4:
+         /* Replacing a missing item leaks the new one */
+         if (cJSON_GetObjectItem(plain, name)) {
+            cJSON_ReplaceItemInObject(plain, name, cJSON_CreateNumber(ii));
+            cJSON_ReplaceItemInObject(indexed, name, cJSON_CreateNumber(ii));
+         }
+         break;
+      case 5:
+         if (size) {
+            cJSON *item = cJSON_CreateNumber(ii);
+            item->string = strdup(name);
+            cJSON_ReplaceItemInArray(plain, which, item);
+            item = cJSON_CreateNumber(ii);
+            item->string = strdup(name);
+            cJSON_ReplaceItemInArray(indexed, which, item);
+         }
+         break;
+      }
+
+      if (cJSON_GetArraySize(plain) != cJSON_GetArraySize(indexed)) {
+         fprintf(stderr, "Indexed object has the wrong size after op %d\n", ii);
+         retcode = EXIT_FAILURE;
+      }
+      for (jj = 0; jj < nnames; jj++) {
+         if (item_number(cJSON_GetObjectItem(plain, names[jj])) !=
+             item_number(cJSON_GetObjectItem(indexed, names[jj])) ||
+             item_number(cJSON_GetObjectItemCaseSensitive(plain, names[jj])) !=
+             item_number(cJSON_GetObjectItemCaseSensitive(indexed, names[jj]))) {
+            fprintf(stderr, "Indexed lookup of %s differs after op %d\n",
+                    names[jj], ii);
+            retcode = EXIT_FAILURE;
+         }
+      }
+      size = cJSON_GetArraySize(plain);
+      for (jj = 0; jj < size; jj++) {
+         if (item_number(cJSON_GetArrayItem(plain, jj)) !=
+             item_number(cJSON_GetArrayItem(indexed, jj))) {
+            fprintf(stderr, "Indexed array item %d differs after op %d\n",
+                    jj, ii);
+            retcode = EXIT_FAILURE;
+         }
+      }
+   }
+
+   cJSON_Delete(plain);
+   cJSON_Delete(indexed);
+   return retcode;
+}
+
+/* Lookups on a tape must find what they do in a tree */
+static int test_tape(void) {
+   const char *text =
+      "{\"Name\":\"cb\",\"list\":[1,-0,2.5,9223372036854775807,[],{}],"
+      "\"nested\":{\"yes\":true,\"no\":false,\"none\":null,"
+      "\"escaped\":\"a\\u00e9\\n\"},\"name\":\"lower\"}";
+   cJSON_Tape *tape = cJSON_ParseTape(text);
+   size_t list, item;
+   int retcode = EXIT_SUCCESS;
+
+   if (tape == NULL) {
+      fprintf(stderr, "cJSON_ParseTape failed\n");
+      return EXIT_FAILURE;
+   }
+   list = cJSON_TapeGetObjectItem(tape, 0, "LIST");
+   item = cJSON_TapeGetObjectItem(tape,
+                                  cJSON_TapeGetObjectItem(tape, 0, "nested"),
+                                  "escaped");
+   if (cJSON_TapeType(tape, 0) != cJSON_Object ||
+       cJSON_TapeGetArraySize(tape, 0) != 4 ||
+       strcmp(cJSON_TapeGetString(tape, cJSON_TapeGetObjectItem(tape, 0, "name")), "cb") ||
+       strcmp(cJSON_TapeGetString(tape, cJSON_TapeGetObjectItemCaseSensitive(tape, 0, "name")), "lower") ||
+       strcmp(cJSON_TapeGetString(tape, item), "a\xc3\xa9\n") ||
+       strcmp(cJSON_TapeGetName(tape, item), "escaped") ||
+       cJSON_TapeGetName(tape, 0) != NULL ||
+       cJSON_TapeGetArraySize(tape, list) != 6 ||
+       cJSON_TapeGetInt64(tape, cJSON_TapeGetArrayItem(tape, list, 0)) != 1 ||
+       cJSON_TapeGetName(tape, cJSON_TapeGetArrayItem(tape, list, 1)) != NULL ||
+       cJSON_TapeGetNumber(tape, cJSON_TapeGetArrayItem(tape, list, 2)) != 2.5 ||
+       cJSON_TapeGetInt64(tape, cJSON_TapeGetArrayItem(tape, list, 2)) != 2 ||
+       cJSON_TapeGetInt64(tape, cJSON_TapeGetArrayItem(tape, list, 3)) != INT64_MAX ||
+       cJSON_TapeGetArraySize(tape, cJSON_TapeGetArrayItem(tape, list, 4)) != 0 ||
+       cJSON_TapeChild(tape, cJSON_TapeGetArrayItem(tape, list, 5)) != cJSON_TapeNone ||
+       cJSON_TapeGetArrayItem(tape, list, 6) != cJSON_TapeNone) {
+      fprintf(stderr, "Tape lookup gave the wrong item\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   /* -0 stays negative */
+   if (1 / cJSON_TapeGetNumber(tape, cJSON_TapeGetArrayItem(tape, list, 1)) > 0) {
+      fprintf(stderr, "Tape lost the sign of -0\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   item = cJSON_TapeGetObjectItem(tape, 0, "nested");
+   if (cJSON_TapeType(tape, cJSON_TapeGetObjectItem(tape, item, "yes")) != cJSON_True ||
+       cJSON_TapeType(tape, cJSON_TapeGetObjectItem(tape, item, "no")) != cJSON_False ||
+       cJSON_TapeType(tape, cJSON_TapeGetObjectItem(tape, item, "none")) != cJSON_NULL ||
+       cJSON_TapeType(tape, cJSON_TapeGetObjectItem(tape, item, "missing")) != -1 ||
+       cJSON_TapeGetObjectItem(tape, cJSON_TapeGetObjectItem(tape, 0, "missing"), "yes") !=
+       cJSON_TapeNone ||
+       cJSON_TapeGetObjectItem(tape, list, "yes") != cJSON_TapeNone) {
+      fprintf(stderr, "Tape lookup of a literal failed\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   cJSON_DeleteTape(tape);
+   return retcode;
+}
+
+/* Documents parsed with a key table share their names, and delete
+   without freeing them */
+static int test_keys(void) {
+   cJSON_KeyTable *keys = cJSON_CreateKeyTable(3);
+   cJSON *one = cJSON_ParseWithKeys("{\"ab\":1,\"cd\":{\"ab\":2}}", keys, NULL);
+   cJSON *two = cJSON_ParseWithKeys("{\"a\\u0062\":3,\"xy\":4,\"zz\":5}", keys, NULL);
+   const char *ab = cJSON_InternKey(keys, "ab");
+   int retcode = EXIT_SUCCESS;
+
+   if (one == NULL || two == NULL || ab == NULL) {
+      fprintf(stderr, "cJSON_ParseWithKeys failed\n");
+      return EXIT_FAILURE;
+   }
+   if (one->child->string != ab ||
+       cJSON_GetObjectItem(one, "cd")->child->string != ab ||
+       two->child->string != ab ||
+       !(one->child->type & cJSON_StringIsConst) ||
+       cJSON_GetObjectItemCaseSensitive(two, ab)->valueint != 3) {
+      fprintf(stderr, "Keys weren't taken from the key table\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   /* The table is full after ab, cd and xy */
+   if (cJSON_InternKey(keys, "zz") != NULL ||
+       (cJSON_GetObjectItem(two, "zz")->type & cJSON_StringIsConst) ||
+       cJSON_GetObjectItem(two, "zz")->valueint != 5 ||
+       cJSON_InternKey(keys, "xy") != cJSON_GetObjectItem(two, "xy")->string) {
+      fprintf(stderr, "A full key table gave the wrong key\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   /* Changing names leaves the table's alone */
+   cJSON_ReplaceItemInObject(one, "ab", cJSON_CreateNumber(6));
+   cJSON_AddItemToObject(one, "new", cJSON_DetachItemFromObject(two, "ab"));
+   if (strcmp(ab, "ab") != 0 || cJSON_GetObjectItem(one, "new")->valueint != 3) {
+      fprintf(stderr, "Changing a name changed the key table\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   if (cJSON_ParseWithKeys("{\"ab\":", keys, NULL) != NULL ||
+       cJSON_ParseWithKeys("{\"a\\u00", keys, NULL) != NULL ||
+       cJSON_ParseWithKeys("{\"a\\tb", keys, NULL) != NULL) {
+      fprintf(stderr, "cJSON_ParseWithKeys accepted bad JSON\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   cJSON_Delete(one);
+   cJSON_Delete(two);
+   cJSON_DeleteKeyTable(keys);
+   return retcode;
+}
+
+/* Counts what the allocator in test_allocator has out */
+typedef struct {
+   int mallocs;
+   int frees;
+} counts;
+
+static void *counting_malloc(void *ctx, size_t sz) {
+   ((counts *)ctx)->mallocs++;
+   return malloc(sz);
+}
+
+static void counting_free(void *ctx, void *ptr) {
+   ((counts *)ctx)->frees++;
+   free(ptr);
+}
+
+static void *no_malloc(size_t sz) {
+   (void)sz;
+   return NULL;
+}
+
+static void *no_calloc(size_t nmemb, size_t size) {
+   (void)nmemb;
+   (void)size;
+   return NULL;
+}
+
+/* Parsing, printing and deleting with an allocator use only it */
+static int test_allocator(void) {
+   const char *text = "{\"a\":[1,2.5,\"x\\u00e9\"],\"b\":{\"c\":null}}";
+   /* Too long for parse_number's buffer on the stack */
+   char number[] = "[0.1234567890123456789012345678901234567890123456789012345678901234567890]";
+   counts count = { 0, 0 };
+   cJSON_Allocator allocator;
+   cJSON_Hooks hooks;
+   cJSON_Arena *arena;
+   cJSON *item;
+   char *str;
+   int retcode = EXIT_SUCCESS;
+
+   allocator.malloc_fn = counting_malloc;
+   allocator.free_fn = counting_free;
+   allocator.ctx = &count;
+   memset(&hooks, 0, sizeof(hooks));
+   hooks.malloc_fn = no_malloc;
+   hooks.calloc_fn = no_calloc;
+   cJSON_InitHooks(&hooks);
+
+   item = cJSON_ParseWithAllocator(text, &allocator);
+   str = item ? cJSON_PrintWithAllocator(item, 0, &allocator) : NULL;
+   if (str == NULL || strcmp(str, "{\"a\":[1,2.500000,\"x\xc3\xa9\"],\"b\":{\"c\":null}}") != 0) {
+      fprintf(stderr, "cJSON_ParseWithAllocator gave %s\n", str ? str : "NULL");
+      retcode = EXIT_FAILURE;
+   }
+   if (str) {
+      counting_free(&count, str);
+   }
+   cJSON_DeleteWithAllocator(item, &allocator);
+   if (cJSON_ParseWithAllocator("[1,", &allocator) != NULL) {
+      fprintf(stderr, "cJSON_ParseWithAllocator accepted bad JSON\n");
+      retcode = EXIT_FAILURE;
+   }
+
+   item = cJSON_ParseWithAllocator(number, &allocator);
+   if (item == NULL || item->child->valuedouble != 0.12345678901234568) {
+      fprintf(stderr, "cJSON_ParseWithAllocator failed on a long number\n");
+      retcode = EXIT_FAILURE;
+   }
+   cJSON_DeleteWithAllocator(item, &allocator);
+
+   arena = cJSON_CreateArenaWithAllocator(0, &allocator);
+   if (arena == NULL || cJSON_ParseWithArena(text, arena) == NULL ||
+       cJSON_ParseWithArena(number, arena) == NULL ||
+       cJSON_ParseInSitu(number, arena) == NULL) {
+      fprintf(stderr, "cJSON_CreateArenaWithAllocator failed\n");
+      retcode = EXIT_FAILURE;
+   }
+   cJSON_DeleteArena(arena);
+
+   cJSON_InitHooks(NULL);
+   if (count.mallocs == 0 || count.mallocs != count.frees) {
+      fprintf(stderr, "The allocator made %d allocations and %d frees\n",
+              count.mallocs, count.frees);
+      retcode = EXIT_FAILURE;
+   }
+   return retcode;
+}
+
 int main(void) {
    const char *expected = "{\"foo\":\"bar\"}";
    char *str;
@@ -20,5 +436,11 @@ int main(void) {
    cJSON_Delete(obj);
    cJSON_Free(str);
 
+   if (test_numbers() != EXIT_SUCCESS || test_sink() != EXIT_SUCCESS ||
+       test_index() != EXIT_SUCCESS || test_tape() != EXIT_SUCCESS ||
+       test_keys() != EXIT_SUCCESS || test_allocator() != EXIT_SUCCESS) {
+      retcode = EXIT_FAILURE;
+   }
+
    return retcode;
 }
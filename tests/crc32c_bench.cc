@@ -20,146 +20,742 @@
 // We extern the symbols directly so software and the tuned/untuned
 // hardware versions can be checked.
 //
+// Every kernel is timed over a sweep of sizes and alignments, with the
+// data in cache (hot) and with each call on data which isn't (cold).
+// Each measurement is a number of samples after a warm-up, a sample
+// being enough back to back calls to take at least a couple of
+// microseconds, and is reported as the min, median and 99th percentile
+// ns per call. Run with --help for the options, including --json to
+// write the results for tracking regressions.
+//
 
 #include <stdint.h>
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <getopt.h>
 #include <vector>
 #include <iostream>
 #include <random>
 #include <string>
 #include <iomanip>
 #include <sstream>
+#include <thread>
 
+#include "cJSON.h"
+#include "platform/crc.h"
+#include "platform/crc32c.h"
 #include "platform/platform.h"
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 // extern directly to the hw/sw versions
+extern uint32_t crc32c(const uint8_t* buf, size_t len, uint32_t crc_in);
 extern uint32_t crc32c_sw(const uint8_t* buf, size_t len, uint32_t crc_in);
+extern uint32_t crc32c_sw_1way(const uint8_t* buf, size_t len, uint32_t crc_in);
+extern uint32_t crc32c_sw_short_block(const uint8_t* buf, size_t len, uint32_t crc_in);
 extern uint32_t crc32c_hw(const uint8_t* buf, size_t len, uint32_t crc_in);
 extern uint32_t crc32c_hw_1way(const uint8_t* buf, size_t len, uint32_t crc_in);
+extern uint32_t crc32c_hw_short_block(const uint8_t* buf, size_t len, uint32_t crc_in);
+extern bool crc32c_hw_available();
+#if defined(__x86_64__) || defined(_M_X64)
+extern uint32_t crc32c_hw_pclmul(const uint8_t* buf, size_t len, uint32_t crc_in);
+extern uint32_t crc32c_hw_vpclmul(const uint8_t* buf, size_t len, uint32_t crc_in);
+extern bool crc32c_hw_pclmul_available();
+extern bool crc32c_hw_vpclmul_available();
+#else
+// The folding kernels are x86-64 only
+static uint32_t (*crc32c_hw_pclmul)(const uint8_t*, size_t, uint32_t) = nullptr;
+static uint32_t (*crc32c_hw_vpclmul)(const uint8_t*, size_t, uint32_t) = nullptr;
+static bool crc32c_hw_pclmul_available() { return false; }
+static bool crc32c_hw_vpclmul_available() { return false; }
+#endif
+extern uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b);
+extern uint32_t crc32c_parallel(const uint8_t* buf, size_t len, uint32_t crc_in,
+                                unsigned nthreads);
+extern void crc32c_multi(const uint8_t* bufs[], const size_t lens[],
+                         uint32_t out[], size_t n);
+extern uint32_t crc32c_copy(uint8_t* dst, const uint8_t* src, size_t len,
+                            uint32_t crc_in);
+extern const char* crc32c_calibrate();
+extern const char* crc32c_implementation();
 
 typedef uint32_t (*crc32c_function)(const uint8_t* buf, size_t len, uint32_t crc_in);
 
-static std::vector<std::string> column_heads(0);
-
-void crc_results_banner() {
-    column_heads.push_back("Data size (bytes) ");
-    column_heads.push_back("SW ns      ");
-    column_heads.push_back("SW GiB/s   ");
-    column_heads.push_back("HW ns      ");
-    column_heads.push_back("HW GiB/s   ");
-    column_heads.push_back("HW vs SW ");
-    column_heads.push_back("HW opt ns  ");
-    column_heads.push_back("HW opt GiB/s ");
-    column_heads.push_back("HW vs HW opt ");
-    for (auto str : column_heads) {
-        std::cout << str << ": ";
-    }
-    std::cout << std::endl;
+double gib_per_sec_value(size_t test_size, double ns) {
+    return (static_cast<double>(test_size) * 1e9 / ns) /
+           (1024.0 * 1024.0 * 1024.0);
 }
 
-std::string gib_per_sec(size_t test_size, hrtime_t t) {
-    uint64_t one_sec = 1000000000;
-    uint64_t how_many_per_sec = one_sec / t;
-    double bytes_per_sec = test_size * how_many_per_sec;
-    double gib_per_sec = bytes_per_sec/(1024.0*1024.0*1024.0);
+std::string gib_per_sec(size_t test_size, double ns) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3) << gib_per_sec_value(test_size, ns);
+    return ss.str();
+}
+
+std::string ns_string(double ns) {
     std::stringstream ss;
-    ss << std::fixed << std::setprecision(3) << gib_per_sec;
+    ss << std::fixed << std::setprecision(1) << ns;
     return ss.str();
 }
 
-void crc_results(size_t test_size,
-                 std::vector<hrtime_t> &timings_sw,
-                 std::vector<hrtime_t> &timings_hw,
-                 std::vector<hrtime_t> &timings_hw_opt) {
-    hrtime_t avg_sw = 0, avg_hw = 0, avg_hw_opt = 0;
-    for(auto duration : timings_sw) {
-        avg_sw += duration;
+std::string gib_per_sec(size_t test_size, hrtime_t t) {
+    return gib_per_sec(test_size, static_cast<double>(t));
+}
+
+struct bench_options {
+    bench_options()
+        : cpu(-1),
+          warmup(20),
+          hot(true),
+          cold(true),
+          extras(true),
+          working_set(128 * 1024 * 1024) {
     }
-    for(auto duration : timings_hw) {
-        avg_hw += duration;
+
+    int cpu;
+    int warmup;
+    bool hot;
+    bool cold;
+    bool extras;
+    size_t working_set;
+    std::vector<std::string> kernels;
+    std::vector<size_t> sizes;
+    std::vector<size_t> alignments;
+    std::string json;
+};
+
+struct bench_kernel {
+    const char* name;
+    crc32c_function fn;
+};
+
+// Couchbase::Crc32 and Crc64 as kernels, for comparison with crc32c.
+static uint32_t bench_crc32(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return Couchbase::Crc32::checksum(buf, len, crc_in);
+}
+
+static uint32_t bench_crc64(const uint8_t* buf, size_t len, uint32_t crc_in) {
+    return static_cast<uint32_t>(Couchbase::Crc64::checksum(buf, len, crc_in));
+}
+
+//
+// Every kernel this CPU can run. "crc32c" is the exported function, so
+// whatever crc32c_calibrate chose. "crc32" and "crc64" are the other crcs
+// of platform/crc.h.
+//
+static std::vector<bench_kernel> bench_kernels() {
+    std::vector<bench_kernel> kernels;
+    kernels.push_back({"sw_1way", crc32c_sw_1way});
+    kernels.push_back({"sw_short_block", crc32c_sw_short_block});
+    kernels.push_back({"sw", crc32c_sw});
+    if (crc32c_hw_available()) {
+        kernels.push_back({"hw_1way", crc32c_hw_1way});
+        kernels.push_back({"hw_short_block", crc32c_hw_short_block});
+        kernels.push_back({"hw", crc32c_hw});
     }
-    for(auto duration : timings_hw_opt) {
-        avg_hw_opt += duration;
+    if (crc32c_hw_pclmul_available()) {
+        kernels.push_back({"pclmul", crc32c_hw_pclmul});
     }
-    avg_sw = avg_sw / timings_sw.size();
-    avg_hw = avg_hw / timings_hw.size();
-    avg_hw_opt = avg_hw_opt / timings_hw.size();
+    if (crc32c_hw_vpclmul_available()) {
+        kernels.push_back({"vpclmul", crc32c_hw_vpclmul});
+    }
+    kernels.push_back({"crc32c", crc32c});
+    kernels.push_back({"crc32", bench_crc32});
+    kernels.push_back({"crc64", bench_crc64});
+    return kernels;
+}
 
-    double sw_hw = static_cast<double>(avg_sw) / static_cast<double>(avg_hw);
-    double hw_hw_opt = static_cast<double>(avg_hw) / static_cast<double>(avg_hw_opt);
+struct bench_stats {
+    size_t samples;
+    size_t calls;
+    double min;
+    double median;
+    double p99;
+    double mean;
+};
 
-    std::vector<std::string> rows(0);
-    rows.push_back(std::to_string(test_size));
-    rows.push_back(std::to_string(avg_sw));
-    rows.push_back(gib_per_sec(test_size, avg_sw));
-    rows.push_back(std::to_string(avg_hw));
-    rows.push_back(gib_per_sec(test_size, avg_hw));
-    rows.push_back(std::to_string(sw_hw));
-    rows.push_back(std::to_string(avg_hw_opt));
-    rows.push_back(gib_per_sec(test_size, avg_hw_opt));
-    rows.push_back(std::to_string(hw_hw_opt));
+// A sample should take long enough for the timer not to matter
+const double SAMPLE_MIN_NS = 2000;
+// Samples per measurement, fewer if that would take over MEASURE_MAX_NS
+const size_t SAMPLES_MAX = 200, SAMPLES_MIN = 20;
+const double MEASURE_MAX_NS = 250e6;
 
-    for (size_t ii = 0; ii < column_heads.size(); ii++) {
-        std::string spacer(column_heads[ii].length() - rows[ii].length(), ' ');
-        std::cout << rows[ii] << spacer << ": ";
+//
+// Time fn on len byte buffers align bytes past a 64 byte boundary in
+// data. Hot runs use the same buffer every call. Cold runs use a
+// different one for each call, in an order the prefetcher can't follow,
+// from all of data which should be larger than the last level cache.
+//
+static bench_stats bench_measure(crc32c_function fn, std::vector<uint8_t>& data,
+                                 size_t len, size_t align, bool cold,
+                                 int warmup) {
+    const size_t stride = (len + align + 4095) & ~size_t(4095);
+    const size_t slots = cold ? std::max<size_t>((data.size() - 64) / stride, 1) : 1;
+    uint8_t* base = data.data() + ((64 - (reinterpret_cast<uintptr_t>(data.data()) & 63)) & 63);
+    size_t slot = 0;
+    auto next = [&]() -> const uint8_t* {
+        // 7919 is prime, so this visits every slot unless slots is a multiple
+        slot = (slot + 7919) % slots;
+        return base + (slot * stride) + align;
+    };
+    volatile uint32_t sink = 0;
+
+    hrtime_t start = gethrtime();
+    for (int ii = 0; ii < warmup; ii++) {
+        sink = fn(next(), len, sink);
     }
-    std::cout << std::endl;
+    hrtime_t end = gethrtime();
+    const double per_call = warmup > 0 ?
+        static_cast<double>(end - start) / warmup : SAMPLE_MIN_NS;
+
+    bench_stats stats;
+    stats.calls = std::max<size_t>(1, static_cast<size_t>(SAMPLE_MIN_NS / std::max(per_call, 1.0)));
+    stats.samples = static_cast<size_t>(MEASURE_MAX_NS / (per_call * stats.calls + 1));
+    stats.samples = std::min(std::max(stats.samples, SAMPLES_MIN), SAMPLES_MAX);
+
+    std::vector<double> ns(stats.samples);
+    for (auto& sample : ns) {
+        start = gethrtime();
+        for (size_t ii = 0; ii < stats.calls; ii++) {
+            sink = fn(next(), len, sink);
+        }
+        end = gethrtime();
+        sample = static_cast<double>(end - start) / stats.calls;
+    }
+    (void)sink;
+
+    std::sort(ns.begin(), ns.end());
+    stats.min = ns.front();
+    stats.median = ns[ns.size() / 2];
+    stats.p99 = ns[((ns.size() * 99) + 99) / 100 - 1];
+    stats.mean = 0;
+    for (auto sample : ns) {
+        stats.mean += sample;
+    }
+    stats.mean /= ns.size();
+    return stats;
 }
 
-void crc_bench_core(const uint8_t* buffer,
-                    size_t len,
-                    int iterations,
-                    crc32c_function crc32c_fn,
-                    std::vector<hrtime_t> &timings) {
+//
+// Time each kernel at each size and alignment, hot and/or cold, printing
+// a line for each and adding them to results if it isn't null.
+//
+static void bench_kernel_sweep(const bench_options& options, cJSON* results) {
+    std::vector<uint8_t> data(options.working_set + 8192);
+    uint32_t seed = 1;
+    for (auto& byte : data) {
+        seed = seed * 1103515245 + 12345;
+        byte = static_cast<uint8_t>(seed >> 24);
+    }
+
+    std::vector<bool> modes;
+    if (options.hot) {
+        modes.push_back(false);
+    }
+    if (options.cold) {
+        modes.push_back(true);
+    }
+
+    for (bool cold : modes) {
+        std::cout << "Kernels, " << (cold ? "cold" : "hot") << " cache" << std::endl;
+        std::cout << "Kernel          : Size (bytes): Align : Min ns      : Median ns   : p99 ns      : GiB/s" << std::endl;
+        for (const auto& kernel : bench_kernels()) {
+            if (!options.kernels.empty() &&
+                std::find(options.kernels.begin(), options.kernels.end(),
+                          kernel.name) == options.kernels.end()) {
+                continue;
+            }
+            for (size_t len : options.sizes) {
+                for (size_t align : options.alignments) {
+                    bench_stats stats = bench_measure(kernel.fn, data, len, align,
+                                                      cold, options.warmup);
+                    std::vector<std::string> rows;
+                    rows.push_back(kernel.name);
+                    rows.push_back(std::to_string(len));
+                    rows.push_back(std::to_string(align));
+                    rows.push_back(ns_string(stats.min));
+                    rows.push_back(ns_string(stats.median));
+                    rows.push_back(ns_string(stats.p99));
+                    rows.push_back(gib_per_sec(len, stats.median));
+                    const size_t widths[] = {16, 12, 6, 12, 12, 12, 0};
+                    for (size_t ii = 0; ii < rows.size(); ii++) {
+                        std::string spacer(widths[ii] > rows[ii].length() ?
+                                           widths[ii] - rows[ii].length() : 0, ' ');
+                        std::cout << rows[ii] << spacer << (widths[ii] ? ": " : "");
+                    }
+                    std::cout << std::endl;
+
+                    if (results != nullptr) {
+                        cJSON* result = cJSON_CreateObject();
+                        cJSON_AddStringToObject(result, "kernel", kernel.name);
+                        cJSON_AddNumberToObject(result, "size", static_cast<double>(len));
+                        cJSON_AddNumberToObject(result, "alignment", static_cast<double>(align));
+                        cJSON_AddStringToObject(result, "cache", cold ? "cold" : "hot");
+                        cJSON_AddNumberToObject(result, "samples", static_cast<double>(stats.samples));
+                        cJSON_AddNumberToObject(result, "calls_per_sample", static_cast<double>(stats.calls));
+                        cJSON_AddNumberToObject(result, "min_ns", stats.min);
+                        cJSON_AddNumberToObject(result, "median_ns", stats.median);
+                        cJSON_AddNumberToObject(result, "p99_ns", stats.p99);
+                        cJSON_AddNumberToObject(result, "mean_ns", stats.mean);
+                        cJSON_AddNumberToObject(result, "gib_per_sec",
+                                                gib_per_sec_value(len, stats.median));
+                        cJSON_AddItemToArray(results, result);
+                    }
+                }
+            }
+        }
+        std::cout << std::endl;
+    }
+}
+
+//
+// Pin the process to one cpu so the numbers don't depend on where the
+// scheduler puts it.
+//
+static bool bench_pin_cpu(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+static void bench_usage(const char* name) {
+    std::cerr << "Usage: " << name << " [options]" << std::endl
+              << "  --json <file>      write the kernel results to file as JSON" << std::endl
+              << "  --cpu <n>          pin to cpu n" << std::endl
+              << "  --cache <mode>     hot, cold or both (default both)" << std::endl
+              << "  --kernel <name>    only time this kernel, may be repeated" << std::endl
+              << "  --size <bytes>     only time this size, may be repeated" << std::endl
+              << "  --align <offset>   only time this alignment, may be repeated" << std::endl
+              << "  --warmup <calls>   untimed calls before each measurement (default 20)" << std::endl
+              << "  --working-set <MiB> data for cold runs, bigger than the LLC (default 128)" << std::endl
+              << "  --kernels-only     skip the combine, multi, iovec, copy and parallel tables" << std::endl;
+}
+
+//
+// Parse the command line into options. Returns false after printing the
+// usage if it's wrong.
+//
+static bool bench_parse(int argc, char** argv, bench_options& options) {
+    const struct option longopts[] = {
+        {"json", required_argument, nullptr, 'j'},
+        {"cpu", required_argument, nullptr, 'c'},
+        {"cache", required_argument, nullptr, 'C'},
+        {"kernel", required_argument, nullptr, 'k'},
+        {"size", required_argument, nullptr, 's'},
+        {"align", required_argument, nullptr, 'a'},
+        {"warmup", required_argument, nullptr, 'w'},
+        {"working-set", required_argument, nullptr, 'W'},
+        {"kernels-only", no_argument, nullptr, 'K'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int cmd;
+    while ((cmd = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (cmd) {
+        case 'j':
+            options.json = optarg;
+            break;
+        case 'c':
+            options.cpu = std::atoi(optarg);
+            break;
+        case 'C':
+            if (std::strcmp(optarg, "hot") != 0 && std::strcmp(optarg, "cold") != 0 &&
+                std::strcmp(optarg, "both") != 0) {
+                bench_usage(argv[0]);
+                return false;
+            }
+            options.hot = std::strcmp(optarg, "cold") != 0;
+            options.cold = std::strcmp(optarg, "hot") != 0;
+            break;
+        case 'k':
+            options.kernels.push_back(optarg);
+            break;
+        case 's':
+            options.sizes.push_back(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 'a':
+            options.alignments.push_back(std::strtoull(optarg, nullptr, 10) % 64);
+            break;
+        case 'w':
+            options.warmup = std::atoi(optarg);
+            break;
+        case 'W':
+            options.working_set = std::strtoull(optarg, nullptr, 10) * 1024 * 1024;
+            break;
+        case 'K':
+            options.extras = false;
+            break;
+        default:
+            bench_usage(argv[0]);
+            return false;
+        }
+    }
+
+    if (options.sizes.empty()) {
+        options.sizes = {8, 31, 64, 255, 256, 768, 1024, 4096, 8191, 8192,
+                         65536, 262144, 1024 * 1024, 4 * 1024 * 1024};
+    }
+    if (options.alignments.empty()) {
+        options.alignments = {0, 1, 4};
+    }
+    size_t largest = *std::max_element(options.sizes.begin(), options.sizes.end());
+    options.working_set = std::max(options.working_set, 2 * (largest + 4096));
+    return true;
+}
+
+//
+// Time crc32c_combine for a range of lengths of the second block.
+// The cost should grow with log(len_b), not len_b.
+//
+void crc_combine_bench(size_t len_b, int iterations) {
+    std::vector<hrtime_t> timings;
+    uint32_t crc = 0;
     for (int i = 0; i < iterations; i++) {
         const hrtime_t start = gethrtime();
-        crc32c_fn(buffer, len, 0);
+        crc = crc32c_combine(crc, static_cast<uint32_t>(i), len_b);
         const hrtime_t end = gethrtime();
         timings.push_back(end - start);
     }
+
+    hrtime_t avg = 0;
+    for (auto duration : timings) {
+        avg += duration;
+    }
+    avg = avg / timings.size();
+
+    std::string size = std::to_string(len_b);
+    std::string spacer(size.length() < 18 ? 18 - size.length() : 0, ' ');
+    // print crc so the calls can't be optimised away
+    std::cout << size << spacer << ": " << avg << " ns (" << std::hex
+              << crc << std::dec << ")" << std::endl;
+}
+
+//
+// Time crc32c_parallel over one large buffer for an increasing number of
+// threads and report the throughput of each.
+//
+void crc_parallel_bench(size_t len, int iterations, unsigned max_threads) {
+    std::vector<uint8_t> data(len);
+    std::mt19937 twister(static_cast<int>(len));
+    std::uniform_int_distribution<> dis(0, 0xff);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(dis(twister));
+    }
+
+    std::cout << "crc32c_parallel, " << len << " bytes" << std::endl;
+    std::cout << "Threads : ns          : GiB/s      : vs 1 thread" << std::endl;
+    hrtime_t avg_one = 0;
+    for (unsigned nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        std::vector<hrtime_t> timings;
+        for (int i = 0; i < iterations; i++) {
+            const hrtime_t start = gethrtime();
+            crc32c_parallel(data.data(), len, 0, nthreads);
+            const hrtime_t end = gethrtime();
+            timings.push_back(end - start);
+        }
+        hrtime_t avg = 0;
+        for (auto duration : timings) {
+            avg += duration;
+        }
+        avg = avg / timings.size();
+        if (nthreads == 1) {
+            avg_one = avg;
+        }
+
+        std::vector<std::string> rows;
+        rows.push_back(std::to_string(nthreads));
+        rows.push_back(std::to_string(avg));
+        rows.push_back(gib_per_sec(len, avg));
+        rows.push_back(std::to_string(static_cast<double>(avg_one) /
+                                      static_cast<double>(avg)));
+        const size_t widths[] = {8, 12, 11, 0};
+        for (size_t ii = 0; ii < rows.size(); ii++) {
+            std::string spacer(widths[ii] > rows[ii].length() ?
+                               widths[ii] - rows[ii].length() : 0, ' ');
+            std::cout << rows[ii] << spacer << (widths[ii] ? ": " : "");
+        }
+        std::cout << std::endl;
+
+        if (nthreads < max_threads && nthreads * 2 > max_threads) {
+            // make sure the hardware thread count is always measured
+            nthreads = max_threads / 2;
+        }
+    }
+}
+
+//
+// Time crc32c_multi against a loop of crc32c calls over a batch of small
+// documents, each between min_len and max_len bytes long.
+//
+void crc_multi_bench(size_t min_len, size_t max_len, size_t count, int iterations) {
+    std::mt19937 twister(static_cast<int>(max_len));
+    std::uniform_int_distribution<size_t> len_dis(min_len, max_len);
+    std::uniform_int_distribution<> dis(0, 0xff);
+    std::vector<size_t> lens(count);
+    size_t total = 0;
+    for (auto& len : lens) {
+        len = len_dis(twister);
+        total += len;
+    }
+    std::vector<uint8_t> data(total);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(dis(twister));
+    }
+    std::vector<const uint8_t*> bufs(count);
+    size_t offset = 0;
+    for (size_t ii = 0; ii < count; ii++) {
+        bufs[ii] = data.data() + offset;
+        offset += lens[ii];
+    }
+    std::vector<uint32_t> out(count);
+
+    hrtime_t avg_loop = 0, avg_multi = 0;
+    for (int i = 0; i < iterations; i++) {
+        hrtime_t start = gethrtime();
+        for (size_t ii = 0; ii < count; ii++) {
+            out[ii] = crc32c(bufs[ii], lens[ii], 0);
+        }
+        hrtime_t end = gethrtime();
+        avg_loop += end - start;
+
+        start = gethrtime();
+        crc32c_multi(bufs.data(), lens.data(), out.data(), count);
+        end = gethrtime();
+        avg_multi += end - start;
+    }
+    avg_loop = avg_loop / iterations;
+    avg_multi = avg_multi / iterations;
+
+    std::vector<std::string> rows;
+    rows.push_back(std::to_string(min_len) + "-" + std::to_string(max_len));
+    rows.push_back(std::to_string(avg_loop / count));
+    rows.push_back(gib_per_sec(total, avg_loop));
+    rows.push_back(std::to_string(avg_multi / count));
+    rows.push_back(gib_per_sec(total, avg_multi));
+    rows.push_back(std::to_string(static_cast<double>(avg_loop) /
+                                  static_cast<double>(avg_multi)));
+    const size_t widths[] = {12, 12, 12, 12, 12, 0};
+    for (size_t ii = 0; ii < rows.size(); ii++) {
+        std::string spacer(widths[ii] > rows[ii].length() ?
+                           widths[ii] - rows[ii].length() : 0, ' ');
+        std::cout << rows[ii] << spacer << (widths[ii] ? ": " : "");
+    }
+    std::cout << std::endl;
+}
+
+//
+// Time Couchbase::Crc32c::update of an iovec against a loop chaining
+// crc32c over each fragment.
+//
+void crc_iov_bench(size_t min_len, size_t max_len, size_t count, int iterations) {
+    std::mt19937 twister(static_cast<int>(max_len));
+    std::uniform_int_distribution<size_t> len_dis(min_len, max_len);
+    std::uniform_int_distribution<> dis(0, 0xff);
+    std::vector<struct iovec> iov(count);
+    size_t total = 0;
+    for (auto& v : iov) {
+        v.iov_len = len_dis(twister);
+        total += v.iov_len;
+    }
+    std::vector<uint8_t> data(total);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(dis(twister));
+    }
+    size_t offset = 0;
+    for (auto& v : iov) {
+        v.iov_base = data.data() + offset;
+        offset += v.iov_len;
+    }
+
+    hrtime_t avg_loop = 0, avg_iov = 0;
+    volatile uint32_t sink = 0;
+    for (int i = 0; i < iterations; i++) {
+        hrtime_t start = gethrtime();
+        uint32_t crc = 0;
+        for (const auto& v : iov) {
+            crc = crc32c(static_cast<const uint8_t*>(v.iov_base), v.iov_len, crc);
+        }
+        hrtime_t end = gethrtime();
+        avg_loop += end - start;
+        sink = crc;
+
+        start = gethrtime();
+        Couchbase::Crc32c hasher;
+        hasher.update(iov.data(), iov.size());
+        end = gethrtime();
+        avg_iov += end - start;
+        sink = hasher.finalize();
+    }
+    (void)sink;
+    avg_loop = avg_loop / iterations;
+    avg_iov = avg_iov / iterations;
+
+    std::vector<std::string> rows;
+    rows.push_back(std::to_string(min_len) + "-" + std::to_string(max_len));
+    rows.push_back(std::to_string(avg_loop));
+    rows.push_back(gib_per_sec(total, avg_loop));
+    rows.push_back(std::to_string(avg_iov));
+    rows.push_back(gib_per_sec(total, avg_iov));
+    rows.push_back(std::to_string(static_cast<double>(avg_loop) /
+                                  static_cast<double>(avg_iov)));
+    const size_t widths[] = {12, 12, 12, 12, 12, 0};
+    for (size_t ii = 0; ii < rows.size(); ii++) {
+        std::string spacer(widths[ii] > rows[ii].length() ?
+                           widths[ii] - rows[ii].length() : 0, ' ');
+        std::cout << rows[ii] << spacer << (widths[ii] ? ": " : "");
+    }
+    std::cout << std::endl;
 }
 
-void crc_bench(size_t len,
-               int iterations,
-               int unalignment) {
-    uint8_t* data = new uint8_t[len+unalignment];
+//
+// Time crc32c_copy against memcpy followed by crc32c of the copy. The
+// buffers are rotated through a working set larger than the cache, so
+// large sizes are measured from memory rather than from a warm cache.
+//
+void crc_copy_bench(size_t len, int iterations) {
+    const size_t working_set = 64 * 1024 * 1024;
+    size_t copies = working_set / len < 2 ? 2 : working_set / len;
+    std::vector<uint8_t> src(copies * len), dst(copies * len);
     std::mt19937 twister(static_cast<int>(len));
     std::uniform_int_distribution<> dis(0, 0xff);
-    for (size_t data_index = 0; data_index < len; data_index++) {
-        uint8_t data_value = static_cast<uint8_t>(dis(twister));
-        data[data_index] = data_value;
+    for (auto& byte : src) {
+        byte = static_cast<uint8_t>(dis(twister));
     }
-    std::vector<hrtime_t> timings_sw, timings_hw, timings_hw_opt;
-    crc_bench_core(data+unalignment, len, iterations, crc32c_sw, timings_sw);
-    crc_bench_core(data+unalignment, len, iterations, crc32c_hw_1way, timings_hw);
-    crc_bench_core(data+unalignment, len, iterations, crc32c_hw, timings_hw_opt);
-    delete [] data;
+    std::fill(dst.begin(), dst.end(), 0);
 
-    crc_results(len, timings_sw, timings_hw, timings_hw_opt);
+    hrtime_t avg_separate = 0, avg_fused = 0;
+    uint32_t crc = 0;
+    for (int i = 0; i < iterations; i++) {
+        size_t at = (i % copies) * len;
+        hrtime_t start = gethrtime();
+        std::memcpy(dst.data() + at, src.data() + at, len);
+        crc ^= crc32c(dst.data() + at, len, 0);
+        hrtime_t end = gethrtime();
+        avg_separate += end - start;
+
+        at = ((i + (copies / 2)) % copies) * len;
+        start = gethrtime();
+        crc ^= crc32c_copy(dst.data() + at, src.data() + at, len, 0);
+        end = gethrtime();
+        avg_fused += end - start;
+    }
+    avg_separate = avg_separate / iterations;
+    avg_fused = avg_fused / iterations;
 
+    std::vector<std::string> rows;
+    rows.push_back(std::to_string(len));
+    rows.push_back(std::to_string(avg_separate));
+    rows.push_back(gib_per_sec(len, avg_separate));
+    rows.push_back(std::to_string(avg_fused));
+    rows.push_back(gib_per_sec(len, avg_fused));
+    rows.push_back(std::to_string(static_cast<double>(avg_separate) /
+                                  static_cast<double>(avg_fused)));
+    const size_t widths[] = {12, 12, 12, 12, 12, 0};
+    for (size_t ii = 0; ii < rows.size(); ii++) {
+        std::string spacer(widths[ii] > rows[ii].length() ?
+                           widths[ii] - rows[ii].length() : 0, ' ');
+        std::cout << rows[ii] << spacer << (widths[ii] ? ": " : "");
+    }
+    // print crc so the calls can't be optimised away
+    std::cout << " (" << std::hex << crc << std::dec << ")" << std::endl;
 }
 
-int main() {
-    crc_results_banner();
+int main(int argc, char** argv) {
+    bench_options options;
+    if (!bench_parse(argc, argv, options)) {
+        return 1;
+    }
+    if (options.cpu >= 0 && !bench_pin_cpu(options.cpu)) {
+        std::cerr << "Couldn't pin to cpu " << options.cpu << std::endl;
+        return 1;
+    }
+
+    const std::string implementation = crc32c_implementation();
+    const std::string calibrated = crc32c_calibrate();
+    std::cout << "crc32c implementation (cpuid): " << implementation << std::endl;
+    std::cout << "crc32c implementation (calibrated): " << calibrated << std::endl;
+    std::cout << std::endl;
 
-    // test up to 8Mb
-    std::cout << "Power of 2 lengths." << std::endl;
-    for(size_t size = 32; size <= 8*(1024*1024); size = size * 4) {
-        crc_bench(size, 1000, 0);
+    cJSON* root = nullptr;
+    cJSON* results = nullptr;
+    if (!options.json.empty()) {
+        root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "implementation", implementation.c_str());
+        cJSON_AddStringToObject(root, "calibrated", calibrated.c_str());
+        cJSON_AddNumberToObject(root, "cpu", options.cpu);
+        cJSON_AddNumberToObject(root, "warmup", options.warmup);
+        cJSON_AddNumberToObject(root, "working_set", static_cast<double>(options.working_set));
+        results = cJSON_CreateArray();
+        cJSON_AddItemToObject(root, "results", results);
     }
+
+    bench_kernel_sweep(options, results);
+
+    if (root != nullptr) {
+        char* text = cJSON_Print(root);
+        std::ofstream out(options.json.c_str());
+        out << text << std::endl;
+        cJSON_Free(text);
+        cJSON_Delete(root);
+        if (!out) {
+            std::cerr << "Couldn't write " << options.json << std::endl;
+            return 1;
+        }
+    }
+
+    if (!options.extras) {
+        return 0;
+    }
+
+    std::cout << "crc32c_combine, second block length (bytes) vs ns" << std::endl;
+    for(size_t size = 1; size <= 8*(1024*1024*1024ULL); size = size * 16) {
+        crc_combine_bench(size, 1000);
+    }
+    std::cout << std::endl;
+
+    std::cout << "crc32c_multi vs a loop of crc32c, 10000 documents" << std::endl;
+    std::cout << "Length (bytes): Loop ns/doc : Loop GiB/s  : Multi ns/doc: Multi GiB/s : Speedup" << std::endl;
+    crc_multi_bench(16, 64, 10000, 100);
+    crc_multi_bench(100, 500, 10000, 100);
+    crc_multi_bench(300, 300, 10000, 100);
+    crc_multi_bench(500, 2000, 10000, 100);
+    std::cout << std::endl;
+
+    std::cout << "Crc32c::update(iovec) vs a loop of crc32c, 256 fragments" << std::endl;
+    std::cout << "Length (bytes): Loop ns    : Loop GiB/s  : Iovec ns    : Iovec GiB/s : Speedup" << std::endl;
+    crc_iov_bench(8, 32, 256, 1000);
+    crc_iov_bench(100, 250, 256, 1000);
+    crc_iov_bench(256, 1024, 256, 1000);
+    crc_iov_bench(1500, 3000, 256, 1000);
     std::cout << std::endl;
 
-    // Test some non power of 2 input sizes
-    std::cout << "Non-power of 2 lengths." << std::endl;
-    for(size_t size = 33; size <= 8*(1024*1024); size = size * 4) {
-        crc_bench(size, 1000, 0);
+    std::cout << "crc32c_copy vs memcpy + crc32c" << std::endl;
+    std::cout << "Size (bytes): Separate ns : Sep. GiB/s  : Fused ns    : Fused GiB/s : Speedup" << std::endl;
+    for(size_t size = 1024; size <= 64*(1024*1024); size = size * 4) {
+        crc_copy_bench(size, size < 1024*1024 ? 1000 : 20);
     }
     std::cout << std::endl;
 
-    // Test some inputs that are odd lengths and unaligned pointers
-    std::cout << "Unaligned buffer of odd lengths" << std::endl;
-    for(size_t size = 33; size <= 8*(1024*1024); size = size * 4) {
-        crc_bench(size % 2 == 0? size+1:size, 1000, 1);
+    if (options.cpu >= 0) {
+        // Pinned, all the threads would share one cpu
+        return 0;
     }
+    unsigned max_threads = std::thread::hardware_concurrency();
+    crc_parallel_bench(256*(1024*1024), 10, max_threads < 2 ? 2 : max_threads);
     return 0;
 }
\ No newline at end of file
@@ -20,18 +20,29 @@
 //  - https://tools.ietf.org/html/rfc3720#appendix-B.4
 //
 
-#ifndef CRC32C_UNIT_TEST
 #include "platform/crc32c.h"
+
+#ifdef WIN32
+#include <platform/platform.h>
+#else
+#include <sys/uio.h>
 #endif
 
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <cstring>
 #include <stddef.h>
 #include <stdint.h>
 #include <vector>
 
+// The folding kernels are only built for x86-64, see src/crc32c_private.h
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_TEST_X86 1
+#endif
+
 typedef uint32_t (*test_function)(uint8_t* buf, size_t len);
 
 // The test vector functions intialise the buffer and return the expected CRC32C
@@ -121,11 +132,31 @@ bool run_test(const uint8_t* buffer, int len, uint32_t expected, std::string nam
 #ifdef CRC32C_UNIT_TEST
     // extern directly to the hw/sw versions
     extern uint32_t crc32c_sw(const uint8_t* buf, size_t len, uint32_t crc_in);
-    extern uint32_t crc32c_hw(const uint8_t* buf, size_t len, uint32_t crc_in);
-    extern uint32_t crc32c_hw_1way(const uint8_t* buf, size_t len, uint32_t crc_in);
     // in the unit test version, we're bypassing the DLL exposed interface
     // and running hard/software function together for full validation.
-    actual = crc32c_hw_1way(buffer, len, 0) & crc32c_sw(buffer, len, 0) & crc32c_hw(buffer, len, 0);
+    actual = crc32c_sw(buffer, len, 0);
+
+    extern uint32_t crc32c_hw(const uint8_t* buf, size_t len, uint32_t crc_in);
+    extern uint32_t crc32c_hw_1way(const uint8_t* buf, size_t len, uint32_t crc_in);
+    extern bool crc32c_hw_available();
+    // Without the crc instructions the hw versions would fault
+    if (crc32c_hw_available()) {
+        actual &= crc32c_hw_1way(buffer, len, 0) & crc32c_hw(buffer, len, 0);
+    }
+
+#ifdef CRC32C_TEST_X86
+    extern uint32_t crc32c_hw_pclmul(const uint8_t* buf, size_t len, uint32_t crc_in);
+    extern uint32_t crc32c_hw_vpclmul(const uint8_t* buf, size_t len, uint32_t crc_in);
+    extern bool crc32c_hw_pclmul_available();
+    extern bool crc32c_hw_vpclmul_available();
+    // The folding kernels can only run if the CPU supports them
+    if (crc32c_hw_pclmul_available()) {
+        actual &= crc32c_hw_pclmul(buffer, len, 0);
+    }
+    if (crc32c_hw_vpclmul_available()) {
+        actual &= crc32c_hw_vpclmul(buffer, len, 0);
+    }
+#endif
 #else
     actual = crc32c(buffer, len, 0);
 #endif
@@ -138,11 +169,59 @@ bool run_test(const uint8_t* buffer, int len, uint32_t expected, std::string nam
     return expected == actual;
 }
 
+#ifdef CRC32C_UNIT_TEST
+typedef uint32_t (*crc32c_function)(const uint8_t* buf, size_t len, uint32_t crc_in);
+
+//
+// Compare a kernel against the simplest software version for every
+// length up to max_len and every alignment of the start of the data.
+//
+bool run_kernel_sweep(crc32c_function fn, size_t max_len, std::string name) {
+    extern uint32_t crc32c_sw_1way(const uint8_t* buf, size_t len, uint32_t crc_in);
+    std::vector<uint8_t> data(max_len + 8);
+    for (size_t ii = 0; ii < data.size(); ii++) {
+        data[ii] = static_cast<uint8_t>((ii * 2654435761u) >> 13);
+    }
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t len = 0; len <= max_len; len++) {
+            uint32_t expected = crc32c_sw_1way(data.data() + offset, len, 0xdeadbeef);
+            uint32_t actual = fn(data.data() + offset, len, 0xdeadbeef);
+            if (expected != actual) {
+                std::cerr << "Test " << name << " sweep, length " << len
+                    << " offset " << offset << ": failed. Expected crc "
+                    << std::hex << expected << " != actual crc " << actual
+                    << std::dec << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+#endif
+
 bool run_test_function(uint8_t* buffer, int len, test_function test, std::string name) {
     uint32_t expected = test(buffer, len);
     return run_test(buffer, len, expected, name);
 }
 
+//
+// Split buffer at split and check that combining the crc of both halves
+// gives the same result as the crc of the whole buffer.
+//
+bool run_combine_test(const uint8_t* buffer, size_t len, size_t split) {
+    uint32_t expected = crc32c(buffer, len, 0);
+    uint32_t crc_a = crc32c(buffer, split, 0);
+    uint32_t crc_b = crc32c(buffer + split, len - split, 0);
+    uint32_t actual = crc32c_combine(crc_a, crc_b, len - split);
+
+    if (expected != actual) {
+        std::cerr << "Test combine " << len << " split at " << split
+            << ": failed. Expected crc " << std::hex << expected
+            << " != actual crc " << actual << std::dec << std::endl;
+    }
+    return expected == actual;
+}
+
 
 int main() {
     uint8_t* buffer = new uint8_t[33];
@@ -183,6 +262,17 @@ int main() {
     pass &= run_test(buffer, (256*6) + 65, 0x92819a69, "2x short block + 65");
     pass &= run_test(buffer+3, (256*6) + 65, 0x3ab67f68, "2x short block + 65 - unaligned");
 
+    // The folding kernels fold 128/256 byte steps, then 64 or 16 byte steps,
+    // then finish bytewise. Check the lengths either side of each.
+    pass &= run_test(buffer, 1024, 0xe7bec4d6, "1024 bytes");
+    pass &= run_test(buffer+1, 1024, 0xe7bec4d6, "1024 bytes - unaligned");
+    pass &= run_test(buffer, 1024 + 256 + 64 + 16 + 15, 0x87b15f31,
+                     "1024 + 256 + 64 + 16 + 15 bytes");
+    pass &= run_test(buffer+1, 1024 + 256 + 64 + 16 + 15, 0xbf478764,
+                     "1024 + 256 + 64 + 16 + 15 bytes - unaligned");
+    pass &= run_test(buffer, 512 + 63, 0x9081cde7, "512 + 63 bytes");
+    pass &= run_test(buffer+1, 512 + 63, 0x9081cde7, "512 + 63 bytes - unaligned");
+
     // Test sizes 0 to 8 bytes.
     // These are the precomputed results (checked against two different crc32c implementations)
     // Input data is the decrementing_32 buffer.
@@ -201,7 +291,302 @@ int main() {
         pass &= run_test(buffer+1, ii, results[res+1], size + " bytes - unaligned");
     }
 
+    // Combine the crc of two blocks split at various points, including
+    // the empty block at either end.
+    pass &= run_test_function(buffer, 1024*1024, long_data, "long data");
+    std::vector<size_t> splits = {0, 1, 7, 8, 48, 255, 256, 8191, 8192,
+                                  (3*8192) + 65, 512*1024, (1024*1024) - 1,
+                                  1024*1024};
+    for (auto split : splits) {
+        pass &= run_combine_test(buffer, 1024*1024, split);
+        pass &= run_combine_test(buffer+1, (1024*1024) - 1,
+                                 split == 1024*1024 ? split - 1 : split);
+    }
 
+    // Checksum out of order, as if the 48 byte chunks had arrived in reverse.
+    {
+        const size_t chunk = 48;
+        const size_t len = 100 * chunk;
+        uint32_t expected = crc32c(buffer, len, 0);
+        uint32_t crc = 0;
+        size_t crc_len = 0;
+        for (size_t offset = len; offset > 0; offset -= chunk) {
+            uint32_t crc_chunk = crc32c(buffer + offset - chunk, chunk, 0);
+            crc = crc32c_combine(crc_chunk, crc, crc_len);
+            crc_len += chunk;
+        }
+        if (crc != expected) {
+            std::cerr << "Test combine out of order: failed. Expected crc "
+                << std::hex << expected << " != actual crc " << crc
+                << std::dec << std::endl;
+            pass = false;
+        }
+    }
     delete [] buffer;
+
+    // crc32c_parallel must match crc32c for any thread count, including
+    // a length which doesn't divide evenly and an unaligned start.
+    {
+        const size_t len = (8 * 1024 * 1024) + 13;
+        std::vector<uint8_t> data(len + 1);
+        for (size_t ii = 0; ii < data.size(); ii++) {
+            data[ii] = static_cast<uint8_t>(ii * 31);
+        }
+        for (unsigned nthreads = 0; nthreads <= 9; nthreads++) {
+            for (size_t offset = 0; offset < 2; offset++) {
+                uint32_t expected = crc32c(data.data() + offset, len - offset, 0x1234);
+                uint32_t actual = crc32c_parallel(data.data() + offset,
+                                                  len - offset, 0x1234, nthreads);
+                if (expected != actual) {
+                    std::cerr << "Test parallel " << nthreads << " threads"
+                        << (offset ? " - unaligned" : "")
+                        << ": failed. Expected crc " << std::hex << expected
+                        << " != actual crc " << actual << std::dec << std::endl;
+                    pass = false;
+                }
+            }
+        }
+    }
+
+    // crc32c_multi must match crc32c for every buffer, whatever mix of
+    // lengths and alignments it's given.
+    {
+        std::vector<uint8_t> data(64 * 1024);
+        for (size_t ii = 0; ii < data.size(); ii++) {
+            data[ii] = static_cast<uint8_t>((ii * 2654435761u) >> 11);
+        }
+        std::vector<const uint8_t*> bufs;
+        std::vector<size_t> lens;
+        for (size_t ii = 0; ii < 1000; ii++) {
+            size_t len = (ii * 7919) % 600;
+            if (ii % 97 == 0) {
+                len += 5000; // long enough for crc32c to take it
+            }
+            bufs.push_back(data.data() + ((ii * 13) % 4096));
+            lens.push_back(len);
+        }
+        for (size_t n : {size_t(0), size_t(1), size_t(3), size_t(5), size_t(1000)}) {
+            std::vector<uint32_t> out(n + 1, 0xdeadbeef);
+            crc32c_multi(bufs.data(), lens.data(), out.data(), n);
+            for (size_t ii = 0; ii < n; ii++) {
+                uint32_t expected = crc32c(bufs[ii], lens[ii], 0);
+                if (expected != out[ii]) {
+                    std::cerr << "Test multi " << n << " buffers, buffer " << ii
+                        << " length " << lens[ii] << ": failed. Expected crc "
+                        << std::hex << expected << " != actual crc " << out[ii]
+                        << std::dec << std::endl;
+                    pass = false;
+                }
+            }
+            if (out[n] != 0xdeadbeef) {
+                std::cerr << "Test multi " << n << " buffers: wrote past the end"
+                    << std::endl;
+                pass = false;
+            }
+        }
+    }
+
+    // crc32c_copy must copy exactly len bytes and return crc32c of them,
+    // for lengths either side of its chunk size and streaming threshold
+    // and any alignment of src and dst.
+    {
+        const size_t max_len = (3 * 1024 * 1024) + 17;
+        std::vector<uint8_t> src(max_len + 16), dst(max_len + 16);
+        for (size_t ii = 0; ii < src.size(); ii++) {
+            src[ii] = static_cast<uint8_t>((ii * 2654435761u) >> 7);
+        }
+        for (size_t len : {size_t(0), size_t(1), size_t(63), size_t(8191),
+                           size_t(8192), size_t(8193), size_t(100000),
+                           size_t(256 * 1024), max_len}) {
+            for (size_t offset = 0; offset < 4; offset++) {
+                const uint8_t* in = src.data() + offset;
+                uint8_t* out = dst.data() + (offset * 5);
+                std::fill(dst.begin(), dst.end(), 0xa5);
+                uint32_t expected = crc32c(in, len, 0xcafe);
+                uint32_t actual = crc32c_copy(out, in, len, 0xcafe);
+                bool copied = std::memcmp(out, in, len) == 0 &&
+                              out[len] == 0xa5 &&
+                              (out == dst.data() || out[-1] == 0xa5);
+                if (expected != actual || !copied) {
+                    std::cerr << "Test copy length " << len << " offset "
+                        << offset << ": failed. Expected crc " << std::hex
+                        << expected << " actual crc " << actual << std::dec
+                        << (copied ? "" : ", bad copy") << std::endl;
+                    pass = false;
+                }
+            }
+        }
+    }
+
+#ifdef CRC32C_UNIT_TEST
+    {
+        extern uint32_t crc32c_sw(const uint8_t* buf, size_t len, uint32_t crc_in);
+        pass &= run_kernel_sweep(crc32c_sw, 2200, "sw");
+    }
+
+    extern bool crc32c_hw_available();
+    if (crc32c_hw_available()) {
+        extern uint32_t crc32c_hw(const uint8_t* buf, size_t len, uint32_t crc_in);
+        pass &= run_kernel_sweep(crc32c_hw, 2200, "hw");
+    }
+
+#ifdef CRC32C_TEST_X86
+    {
+        extern uint32_t crc32c_hw_pclmul(const uint8_t* buf, size_t len, uint32_t crc_in);
+        extern uint32_t crc32c_hw_vpclmul(const uint8_t* buf, size_t len, uint32_t crc_in);
+        extern bool crc32c_hw_pclmul_available();
+        extern bool crc32c_hw_vpclmul_available();
+        if (crc32c_hw_pclmul_available()) {
+            pass &= run_kernel_sweep(crc32c_hw_pclmul, 2200, "hw_pclmul");
+        }
+        if (crc32c_hw_vpclmul_available()) {
+            pass &= run_kernel_sweep(crc32c_hw_vpclmul, 2200, "hw_vpclmul");
+        }
+    }
+#endif
+
+    // Every width and block size crc32c_calibrate can choose from
+    if (crc32c_hw_available()) {
+        extern uint32_t crc32c_sw_1way(const uint8_t* buf, size_t len, uint32_t crc_in);
+        extern uint32_t crc32c_hw_tuned(const uint8_t* buf, size_t len, uint32_t crc_in);
+        extern bool crc32c_hw_set_tuning(int ways, size_t long_block, size_t short_block);
+        std::vector<uint8_t> data((6 * 16384 * 2) + 600);
+        for (size_t ii = 0; ii < data.size(); ii++) {
+            data[ii] = static_cast<uint8_t>((ii * 2654435761u) >> 13);
+        }
+        for (int ways : {3, 4, 6}) {
+            for (size_t long_block : {4096, 8192, 16384}) {
+                for (size_t short_block : {128, 256, 512}) {
+                    if (!crc32c_hw_set_tuning(ways, long_block, short_block)) {
+                        std::cerr << "Test hw tuning " << ways << "-way "
+                            << long_block << "/" << short_block
+                            << ": failed to set tuning" << std::endl;
+                        pass = false;
+                    }
+                    for (size_t len = 0; len < data.size() - 8; len += 997) {
+                        for (size_t offset = 0; offset < 8; offset += 3) {
+                            const uint8_t* start = data.data() + offset;
+                            uint32_t expected = crc32c_sw_1way(start, len, 7);
+                            uint32_t actual = crc32c_hw_tuned(start, len, 7);
+                            if (expected != actual) {
+                                std::cerr << "Test hw " << ways << "-way "
+                                    << long_block << "/" << short_block
+                                    << " length " << len << " offset "
+                                    << offset << ": failed. Expected crc "
+                                    << std::hex << expected << " != actual crc "
+                                    << actual << std::dec << std::endl;
+                                pass = false;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if (crc32c_hw_set_tuning(5, 8192, 256) ||
+            crc32c_hw_set_tuning(3, 8192, 100)) {
+            std::cerr << "Test hw tuning: invalid tuning accepted" << std::endl;
+            pass = false;
+        }
+    }
+#endif
+
+    // Couchbase::Crc32c must match crc32c of the whole buffer, however
+    // the data is split up
+    {
+        std::vector<uint8_t> data(100000);
+        for (size_t ii = 0; ii < data.size(); ii++) {
+            data[ii] = static_cast<uint8_t>(ii * 2654435761u >> 24);
+        }
+        const uint32_t expected = crc32c(data.data(), data.size(), 0);
+
+        // Fragment sizes either side of the gathering thresholds
+        const size_t sizes[] = {0, 1, 7, 100, 1023, 1024, 3000, 8191, 9000};
+        std::vector<struct iovec> iov;
+        size_t offset = 0;
+        for (size_t ii = 0; offset < data.size(); ii++) {
+            size_t len = std::min(sizes[(ii * 7) % 9], data.size() - offset);
+            struct iovec v;
+            v.iov_base = data.data() + offset;
+            v.iov_len = len;
+            iov.push_back(v);
+            offset += len;
+        }
+        Couchbase::Crc32c scattered;
+        scattered.update(iov.data(), iov.size());
+
+        Couchbase::Crc32c pieces;
+        for (const auto& v : iov) {
+            pieces.update(v.iov_base, v.iov_len);
+        }
+
+        Couchbase::Crc32c head, tail;
+        head.update(data.data(), 12345);
+        tail.update(data.data() + 12345, data.size() - 12345);
+        head.combine(tail);
+
+        Couchbase::Crc32c chained(crc32c(data.data(), 500, 0));
+        chained.update(std::vector<uint8_t>(data.begin() + 500, data.end()));
+
+        if (scattered.finalize() != expected || pieces.finalize() != expected ||
+            head.finalize() != expected || chained.finalize() != expected ||
+            scattered.size() != data.size() || head.size() != data.size()) {
+            std::cerr << "Test Crc32c: mismatch" << std::endl;
+            pass = false;
+        }
+    }
+
+    // Couchbase::Crc32cStreamBuf, with and without a sink
+    {
+        const std::string text = "The quick brown fox jumps over the lazy dog";
+        std::stringbuf sink;
+        Couchbase::Crc32cStreamBuf passthrough(&sink), discard;
+        std::ostream out(&passthrough), dropped(&discard);
+        out << text.substr(0, 10) << text[10] << text.substr(11) << std::flush;
+        dropped << text;
+        const uint32_t expected =
+            crc32c(reinterpret_cast<const uint8_t*>(text.data()), text.size(), 0);
+        if (sink.str() != text || passthrough.crc().finalize() != expected ||
+            discard.crc().finalize() != expected) {
+            std::cerr << "Test Crc32cStreamBuf: mismatch" << std::endl;
+            pass = false;
+        }
+    }
+
+    // crc32c_constexpr at compile time, and against crc32c at run time
+    static_assert(crc32c_constexpr("123456789") == 0xe3069283,
+                  "crc32c_constexpr check value");
+    static_assert(crc32c_constexpr("") == 0, "crc32c_constexpr empty");
+    static_assert(crc32c_constexpr("6789", 4, crc32c_constexpr("12345")) ==
+                      crc32c_constexpr("123456789"),
+                  "crc32c_constexpr crc_in");
+    {
+        std::string text;
+        for (size_t len = 0; len < 5000; len += 1 + len / 4) {
+            while (text.size() < len) {
+                text.push_back(static_cast<char>(text.size() * 2654435761u >> 24));
+            }
+            uint32_t expected = crc32c(reinterpret_cast<const uint8_t*>(text.data()),
+                                       len, 0x1234);
+            if (crc32c_constexpr(text.data(), len, 0x1234) != expected) {
+                std::cerr << "Test crc32c_constexpr: mismatch at length "
+                          << len << std::endl;
+                pass = false;
+            }
+        }
+    }
+
+    // crc32c must give the same answers after switching kernel
+    std::cout << "crc32c implementation: " << crc32c_implementation();
+    std::cout << ", calibrated: " << crc32c_calibrate() << std::endl;
+    {
+        std::vector<uint8_t> data(1024 * 1024);
+        pass &= run_test_function(data.data(), 1024*1024, long_data,
+                                  "long data - calibrated");
+        pass &= run_test_function(data.data(), 32, incrementing_32,
+                                  "Incr 32 - calibrated");
+        pass &= run_test_function(data.data() + 1, 48, iscsi_read,
+                                  "ISCSI read - unaligned, calibrated");
+    }
+
     return pass ? 0 : 1;
 }
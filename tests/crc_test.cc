@@ -0,0 +1,157 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// Test Couchbase::Crc32 and Crc64 with their standard check values, the
+// crc of "123456789", and against a bit at a time crc for lengths either
+// side of the block sizes of the 3-way and carry-less multiply kernels.
+//
+
+#include "platform/crc.h"
+#include "platform/crc32c.h"
+
+#ifdef WIN32
+#include <platform/platform.h>
+#else
+#include <sys/uio.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// The reference crc, one bit at a time.
+template <typename T>
+static T reference_crc(T poly, const uint8_t* buf, size_t len, T crc_in) {
+    T crc = ~crc_in;
+    for (size_t ii = 0; ii < len; ii++) {
+        crc ^= buf[ii];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ poly : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+template <typename Crc>
+static bool check(const char* name, const std::string& test,
+                  typename Crc::value_type expected,
+                  typename Crc::value_type actual) {
+    if (expected != actual) {
+        std::cerr << "Test " << name << " " << test << ": failed. Expected crc "
+            << std::hex << expected << " != actual crc " << actual
+            << std::dec << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename Crc>
+static bool run_tests(const char* name, typename Crc::value_type poly,
+                      typename Crc::value_type check_value) {
+    typedef typename Crc::value_type value_type;
+    bool pass = true;
+
+    pass &= check<Crc>(name, "check value", check_value,
+                       Crc::checksum("123456789", 9));
+    pass &= check<Crc>(name, "empty", 0, Crc::checksum("", 0));
+
+    std::vector<uint8_t> data((3 * 8192) + (3 * 256) + 1024 + 4);
+    for (size_t ii = 0; ii < data.size(); ii++) {
+        data[ii] = static_cast<uint8_t>((ii * 2654435761u) >> 13);
+    }
+
+    // Lengths either side of the 3-way short and long blocks, the folding
+    // kernel's 256 byte minimum and its 128 byte steps, at each alignment.
+    std::vector<size_t> lens;
+    for (size_t len = 0; len <= 300; len++) {
+        lens.push_back(len);
+    }
+    for (size_t len : {size_t(767), size_t(768), size_t(769), size_t(1023),
+                       size_t(1024), size_t(1024 + 128 + 16 + 15),
+                       size_t(3 * 8192) - 1, size_t(3 * 8192),
+                       size_t((3 * 8192) + (3 * 256) + 1024)}) {
+        lens.push_back(len);
+    }
+    for (size_t len : lens) {
+        for (size_t offset = 0; offset < 4; offset++) {
+            const uint8_t* buf = data.data() + offset;
+            value_type crc_in = static_cast<value_type>(len * 0x9e3779b97f4a7c15ULL);
+            pass &= check<Crc>(name, "length " + std::to_string(len) +
+                               " offset " + std::to_string(offset),
+                               reference_crc(poly, buf, len, crc_in),
+                               Crc::checksum(buf, len, crc_in));
+        }
+    }
+
+    // Incremental updates, a scatter-gather list and combine must all give
+    // the crc of the whole buffer.
+    const size_t len = data.size();
+    const value_type expected = Crc::checksum(data.data(), len);
+    {
+        Crc crc;
+        for (size_t offset = 0; offset < len; offset += 1000) {
+            crc.update(data.data() + offset, std::min(size_t(1000), len - offset));
+        }
+        pass &= check<Crc>(name, "update", expected, crc.finalize());
+        if (crc.size() != len) {
+            std::cerr << "Test " << name << " update: failed. Wrong size "
+                << crc.size() << std::endl;
+            pass = false;
+        }
+    }
+    {
+        struct iovec iov[3];
+        iov[0].iov_base = data.data();
+        iov[0].iov_len = 5;
+        iov[1].iov_base = data.data() + 5;
+        iov[1].iov_len = 4000;
+        iov[2].iov_base = data.data() + 4005;
+        iov[2].iov_len = len - 4005;
+        Crc crc;
+        pass &= check<Crc>(name, "iovec", expected, crc.update(iov, 3).finalize());
+    }
+    for (size_t split : {size_t(0), size_t(1), size_t(300), len - 1, len}) {
+        Crc a, b;
+        a.update(data.data(), split);
+        b.update(data.data() + split, len - split);
+        pass &= check<Crc>(name, "combine at " + std::to_string(split),
+                           expected, a.combine(b).finalize());
+    }
+    return pass;
+}
+
+int main() {
+    bool pass = true;
+
+    pass &= run_tests<Couchbase::Crc32>("crc32", 0xedb88320, 0xcbf43926);
+    pass &= run_tests<Couchbase::Crc64>("crc64", 0xc96c5795d7870f42ULL,
+                                        0x995dc9bbdf1939faULL);
+    pass &= run_tests<Couchbase::Crc<0x82f63b78, 32> >("crc32c", 0x82f63b78,
+                                                       0xe3069283);
+
+    // The well known crc32 of a pangram.
+    const std::string fox = "The quick brown fox jumps over the lazy dog";
+    pass &= check<Couchbase::Crc32>("crc32", "fox", 0x414fa339,
+                                    Couchbase::Crc32::checksum(fox.data(), fox.size()));
+
+    return pass ? 0 : 1;
+}
@@ -34,9 +34,9 @@
 using namespace Couchbase;
 std::string filename;
 
-static std::vector<uint8_t> readFile(void) {
+static std::vector<uint8_t> readFile(const std::string &name) {
     std::vector<uint8_t> ret;
-    FILE *fp = fopen(filename.c_str(), "rb");
+    FILE *fp = fopen(name.c_str(), "rb");
     cb_assert(fp != NULL);
     cb_assert(fseek(fp, 0, SEEK_END) == 0);
     ret.resize(ftell(fp));
@@ -47,6 +47,10 @@ static std::vector<uint8_t> readFile(void) {
     return ret;
 }
 
+static std::vector<uint8_t> readFile(void) {
+    return readFile(filename);
+}
+
 static void testInvalidMapOptions(void) {
     MemoryMappedFile mymap(filename.c_str(), true, true);
     try {
@@ -107,6 +111,128 @@ static void testSharedMapping(void) {
     cb_assert(memcmp(before.data(), after.data(), before.size()) != 0);
 }
 
+static void flipByte(const std::string &name, size_t offset) {
+    FILE *fp = fopen(name.c_str(), "r+b");
+    cb_assert(fp != NULL);
+    cb_assert(fseek(fp, long(offset), SEEK_SET) == 0);
+    int ch = fgetc(fp);
+    cb_assert(ch != EOF);
+    cb_assert(fseek(fp, long(offset), SEEK_SET) == 0);
+    cb_assert(fputc(ch ^ 0x5a, fp) != EOF);
+    fclose(fp);
+}
+
+static void testCrcIndex(void) {
+    const std::string index = MemoryMappedFile::getCrcIndexName(filename);
+    {
+        MemoryMappedFile mymap(filename.c_str(), false, true);
+        mymap.open();
+        try {
+            mymap.verify();
+            std::cerr << "ERROR: verify without a crc index" << std::endl;
+            exit(EXIT_FAILURE);
+        } catch (std::string err) {
+        }
+        mymap.writeCrcIndex(4096, 3);
+        cb_assert(mymap.hasCrcIndex());
+        cb_assert(mymap.verify());
+    }
+
+    // A clean file verifies a block at a time, and any range
+    {
+        MemoryMappedFile mymap(filename.c_str(), false, true);
+        mymap.open();
+        try {
+            mymap.loadCrcIndex();
+        } catch (std::string err) {
+            std::cerr << "ERROR: " << err << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        cb_assert(mymap.verifyRange(5000, 10));
+        cb_assert(mymap.verifyRange(4095, 2));
+        cb_assert(mymap.verifyRange(mymap.getSize(), 0));
+        cb_assert(mymap.verify());
+        try {
+            mymap.verifyRange(mymap.getSize() - 1, 2);
+            std::cerr << "ERROR: verifyRange outside the mapping" << std::endl;
+            exit(EXIT_FAILURE);
+        } catch (std::string err) {
+        }
+        mymap.close();
+        cb_assert(!mymap.hasCrcIndex());
+    }
+
+    // Only the ranges covering a corrupt block fail
+    flipByte(filename, 9000);
+    {
+        MemoryMappedFile mymap(filename.c_str(), false, true);
+        mymap.open();
+        mymap.loadCrcIndex();
+        cb_assert(mymap.verifyRange(0, 8192));
+        cb_assert(!mymap.verifyRange(8192, 1));
+        cb_assert(mymap.verifyRange(12288, 4096));
+        cb_assert(!mymap.verify());
+    }
+    flipByte(filename, 9000);
+
+    // A corrupt index can't be loaded
+    flipByte(index, 30);
+    {
+        MemoryMappedFile mymap(filename.c_str(), false, true);
+        mymap.open();
+        try {
+            mymap.loadCrcIndex();
+            std::cerr << "ERROR: loaded a corrupt crc index" << std::endl;
+            exit(EXIT_FAILURE);
+        } catch (std::string err) {
+        }
+        cb_assert(!mymap.hasCrcIndex());
+    }
+    remove(index.c_str());
+}
+
+static void testThreadedCrcIndex(void) {
+    // Big enough that writeCrcIndex splits it over several threads, with
+    // a short last block
+    std::vector<uint8_t> buffer(3 * 1024 * 1024 + 100);
+    RandomGenerator generator(false);
+    generator.getBytes(buffer.data(), buffer.size());
+
+    std::stringstream fnm;
+    fnm << "memorymap-threaded-" << getpid() << ".txt";
+    const std::string name = fnm.str();
+    const std::string index = MemoryMappedFile::getCrcIndexName(name);
+    FILE *fp = fopen(name.c_str(), "w");
+    cb_assert(fp != NULL);
+    cb_assert(fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size());
+    fclose(fp);
+
+    std::vector<uint8_t> single;
+    {
+        MemoryMappedFile mymap(name.c_str(), false, true);
+        mymap.open();
+        mymap.writeCrcIndex(4096, 1);
+        single = readFile(index);
+        mymap.writeCrcIndex(4096, 4);
+        cb_assert(mymap.verify());
+    }
+    cb_assert(readFile(index) == single);
+
+    // A corrupt block in the last thread's share is found
+    flipByte(name, 3 * 1024 * 1024 + 50);
+    {
+        MemoryMappedFile mymap(name.c_str(), false, true);
+        mymap.open();
+        mymap.loadCrcIndex();
+        cb_assert(mymap.verifyRange(0, 3 * 1024 * 1024));
+        cb_assert(!mymap.verifyRange(3 * 1024 * 1024, 1));
+        cb_assert(!mymap.verify());
+    }
+
+    remove(index.c_str());
+    remove(name.c_str());
+}
+
 static void createFile(void) {
     std::vector<uint8_t> buffer;
     buffer.resize(16 * 1024);
@@ -127,6 +253,8 @@ int main(void) {
     createFile();
     testInvalidMapOptions();
     testReadonlyMapping();
+    testCrcIndex();
+    testThreadedCrcIndex();
 #ifndef WIN32
     testPrivateMapping();
 #endif